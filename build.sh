@@ -1 +1 @@
-g++ -Wall -std=c++17 -O3 -flto -march=native -mtune=native main.cpp core/*.cpp -lSDL2main -lSDL2 -o gb-emulator
+g++ -Wall -std=c++17 -O3 -flto -march=native -mtune=native main.cpp core/*.cpp -lSDL2main -lSDL2 -ldl -pthread -o gb-emulator
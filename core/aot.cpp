@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include "./aot.hpp"
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+const AotModule* loadAotModule(const char* path) {
+    #ifdef _WIN32
+    printf("ERROR :: Loading recompiled modules is not supported on this platform\n");
+    return nullptr;
+    #else
+    // The handle is kept open for the life of the process, since blocks point into it
+    void* library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (library == nullptr) {
+        printf("ERROR :: Could not load recompiled module: %s\n", dlerror());
+        return nullptr;
+    }
+    const AotModule* module = (const AotModule*)dlsym(library, AOT_MODULE_SYMBOL);
+    if (module == nullptr) {
+        printf("ERROR :: %s is not a recompiled module\n", path);
+        dlclose(library);
+        return nullptr;
+    }
+    return module;
+    #endif
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "./util.hpp"
+
+// Interface between the emulator and modules generated by `tools/recompile`.
+// A module is a shared library with one C++ function per guest block found by walking the ROM
+// ahead of time. Generated code only sees this header, so everything it needs from the CPU and
+// JIT is handed over through `AotContext` when the module is loaded
+
+class CPU;
+class JIT;
+
+// Takes the cycles Timer and PPU are owed on entry and returns what they're owed on exit
+using AotBlock = u32 (*)(CPU* cpu, JIT* jit, u32 lagCycles);
+
+struct AotContext {
+  u16* pc;
+  u16* operand;
+  u8* registers[8];    //same encoding as `CPU::reg`, with F as entry 6
+  u16* registers16[4]; //same encoding as `CPU::reg16`
+  // Runs the interpreter's handler for an op with `pc`, `operand` and the registers already set,
+  // catching Timer and PPU up first if it writes memory. Returns the cycles they're owed after it
+  u32 (*runHandler)(JIT* jit, u8 opCode, u32 lagCycles);
+  // A block exits once the cycles Timer and PPU are owed reach this. A handler may move it
+  const u32* deadline;
+};
+
+struct AotBlockEntry {
+  u16 bank; //0 for blocks in 0x0000-0x3FFF
+  u16 address;
+  AotBlock run;
+};
+
+// Modules are matched to cartridges by title and the header checksums
+struct AotModule {
+  char title[17];
+  u8 headerChecksum;
+  u16 globalChecksum;
+  u32 blockCount;
+  const AotBlockEntry* blocks;
+  void (*init)(const AotContext* context);
+};
+
+const char AOT_MODULE_SYMBOL[] = "gbAotModule";
+
+// Returns nullptr if the library can't be opened or doesn't export a module
+const AotModule* loadAotModule(const char* path);
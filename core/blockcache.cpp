@@ -0,0 +1,239 @@
+#include <algorithm>
+#include "./blockcache.hpp"
+#include "./idleloops.hpp"
+#include "./mmu.hpp"
+#include "./opcodes.hpp"
+#include "./romfile.hpp"
+#include "./superinstructions.hpp"
+
+u8 findBulkLoop(const DecodedOp* ops, u16 count, u16 start, u16 end, bool hinted) {
+    const DecodedOp& last = ops[count - 1];
+    bool loops = (last.opCode == 0x20 || isIdleLoopBranch(last.opCode)) && u16(end + (s8)last.operand) == start;
+    if (!loops) {
+        return 0;
+    }
+    if (count <= 7) {
+        u8 opCodes[7] = {};
+        for (u16 i = 0; i < count; i++) {
+            opCodes[i] = ops[i].opCode;
+        }
+        u8 kernel = findLoopKernel(opCodes, count);
+        if (kernel != 0) {
+            return SUPERINSTRUCTION_COUNT + kernel;
+        }
+    }
+    if (!isIdleLoopBranch(last.opCode)) {
+        return 0;
+    }
+    bool polls = hinted || count <= MAX_IDLE_LOOP_OPS;
+    for (u16 i = 0; polls && i + 1 < count; i++) {
+        polls = hinted ? isHintedPollOp(ops[i].opCode, ops[i].operand) : isPollOp(ops[i].opCode, ops[i].operand);
+    }
+    return polls ? IDLE_LOOP_FUSED : 0;
+}
+
+BlockCache::BlockCache(MMU* mmu) : mmu(mmu), image(mmu->getRomImage()) {}
+
+void BlockCache::bankSwitched() {
+    current = nullptr;
+    epoch++;
+}
+
+void BlockCache::flush() {
+    blocks.clear();
+    current = nullptr;
+    epoch++;
+    for (u16 line = 0; line < 0x10000 / CODE_LINE_SIZE; line++) {
+        codeLines[line] = false;
+        lineBlocks[line].clear();
+    }
+}
+
+void BlockCache::setFusion(bool enabled) {
+    fusion = enabled;
+    flush();
+}
+
+void BlockCache::addBreakpoint(u16 bank, u16 address) {
+    breakpoints.push_back(address >= 0x4000 && address <= 0x7FFF ? (u32(bank) << 16) | address : address);
+    breakpointBits[address >> 3] = setBit(breakpointBits[address >> 3], address & 0x7);
+    flush();
+}
+
+void BlockCache::removeBreakpoint(u16 bank, u16 address) {
+    u32 key = address >= 0x4000 && address <= 0x7FFF ? (u32(bank) << 16) | address : address;
+    breakpoints.erase(std::remove(breakpoints.begin(), breakpoints.end(), key), breakpoints.end());
+    bool anyBank = std::any_of(breakpoints.begin(), breakpoints.end(), [address](u32 other) { return u16(other) == address; });
+    if (!anyBank) {
+        breakpointBits[address >> 3] = clearBit(breakpointBits[address >> 3], address & 0x7);
+    }
+    flush();
+}
+
+bool BlockCache::isBreakpointInBank(u16 pc) {
+    return std::find(breakpoints.begin(), breakpoints.end(), getKey(pc)) != breakpoints.end();
+}
+
+// Returns one past the last address a block starting at `pc` may cover, or 0 if code there isn't cached.
+// VRAM, cartridge RAM, echo RAM and OAM are left to the slow path
+u32 BlockCache::getRegionEnd(u16 pc) {
+    if (pc < BOOT_ROM_SIZE && mmu->isBootRomMapped()) {
+        return BOOT_ROM_SIZE;
+    } else if (pc <= 0x3FFF) {
+        return 0x4000;
+    } else if (pc <= 0x7FFF) {
+        return 0x8000;
+    } else if (0xC000 <= pc && pc <= 0xDFFF) {
+        return 0xE000;
+    } else if (0xFF80 <= pc && pc <= 0xFFFE) {
+        return 0xFFFF;
+    }
+    return 0;
+}
+
+u32 BlockCache::getKey(u16 pc) {
+    if (0x4000 <= pc && pc <= 0x7FFF) {
+        return (u32(mmu->getRomBank()) << 16) | pc;
+    }
+    return pc;
+}
+
+const DecodedOp* BlockCache::enter(u16 pc) {
+    current = getBlock(pc);
+    if (current == nullptr) {
+        return nullptr;
+    }
+    index = 1;
+    nextPc = pc + current->ops[0].length;
+    return &current->ops[0];
+}
+
+Block* BlockCache::getBlock(u16 pc) {
+    u32 regionEnd = getRegionEnd(pc);
+    if (regionEnd == 0) {
+        return nullptr;
+    }
+
+    u32 key = getKey(pc);
+    auto found = blocks.find(key);
+    if (found == blocks.end()) {
+        Block block;
+        build(block, pc, regionEnd);
+        if (block.ops.empty()) { //first instruction straddles the region end
+            return nullptr;
+        }
+        if (block.start >= 0xC000) {
+            for (u16 line = block.start / CODE_LINE_SIZE; line <= (block.end - 1) / CODE_LINE_SIZE; line++) {
+                codeLines[line] = true;
+                lineBlocks[line].push_back(key);
+            }
+        }
+        found = blocks.emplace(key, std::move(block)).first;
+    }
+    return &found->second;
+}
+
+void BlockCache::build(Block& block, u16 pc, u32 regionEnd) {
+    // Cartridge ROM comes from the image's decoding of the bank, everything else straight from memory
+    const DecodedBank* bank = nullptr;
+    u32 bankOffset = 0; //of `pc`
+    u32 romOffset = image != nullptr ? mmu->getRomOffset(pc) : NOT_ROM;
+    if (romOffset != NOT_ROM) {
+        bank = image->getDecodedBank(romOffset / 0x4000);
+        bankOffset = romOffset % 0x4000;
+    }
+
+    u32 address = pc;
+    bool split = false; //at a breakpoint
+    block.cycles = 0;
+    while (block.ops.size() < MAX_BLOCK_OPS && address < regionEnd) {
+        if (address != pc && hasBreakpointBit(address)) {
+            split = true;
+            break;
+        }
+        DecodedOp op;
+        if (bank != nullptr) {
+            op = bank->ops[bankOffset + address - pc];
+        } else {
+            op = { mmu->fetch(address), 0, 0, 0 };
+            op.length = OPCODES[op.opCode].length;
+            if (address + op.length <= regionEnd) {
+                if (op.length == 2) {
+                    op.operand = mmu->fetch(address + 1);
+                } else if (op.length == 3) {
+                    op.operand = mmu->fetch16Bit(address + 1);
+                }
+            }
+        }
+        if (address + op.length > regionEnd) {
+            break;
+        }
+        block.ops.push_back(op);
+        block.cycles += getOpcodeInfo(op.opCode, op.operand).cycles;
+        address += op.length;
+
+        if (OPCODES[op.opCode].endsBlock()) {
+            break;
+        }
+    }
+    block.start = pc;
+    block.end = address;
+    if (fusion && !block.ops.empty()) {
+        // A breakpoint at the start must stop every pass, so then the loop is never sped up.
+        // One further in ends the block before any branch back, so it can't loop either
+        u8 loop = 0;
+        if (!hasBreakpointBit(pc) && !split) {
+            loop = bank != nullptr ? bank->loops[bankOffset] : findBulkLoop(block.ops.data(), block.ops.size(), block.start, block.end, false);
+        }
+        fuse(block, loop);
+    }
+}
+
+// Marks where a superinstruction starts. Ops inside one keep their own entry, since the
+// fused handler steps through them with `fetch` like `CPU::exec` would.
+// A block that loops back on itself may be a copy, fill or polling loop (`loop`, from `findBulkLoop`),
+// which takes over the first op; the rest can still be fused for when the loop can't be sped up
+void BlockCache::fuse(Block& block, u8 loop) {
+    size_t i = 0;
+    if (loop != 0) {
+        block.ops[0].fused = loop;
+        block.bulkLoop = true;
+        i = 1;
+    }
+    while (i + 1 < block.ops.size()) {
+        u8 opCodes[3] = {};
+        u8 available = std::min<size_t>(3, block.ops.size() - i);
+        for (u8 j = 0; j < available; j++) {
+            opCodes[j] = block.ops[i + j].opCode;
+        }
+        u8 fused = findSuperinstruction(opCodes, available);
+        block.ops[i].fused = fused;
+        i += fused != 0 ? SUPERINSTRUCTIONS[fused - 1].count : 1;
+    }
+}
+
+// Drop every block covering `address`. Keys in `lineBlocks` can go stale when a block
+// spanning two lines is dropped through the other one, so those are pruned here too
+void BlockCache::invalidate(u16 address) {
+    u16 line = address / CODE_LINE_SIZE;
+    std::vector<u32>& keys = lineBlocks[line];
+    size_t i = 0;
+    while (i < keys.size()) {
+        auto found = blocks.find(keys[i]);
+        if (found != blocks.end()) {
+            Block& block = found->second;
+            if (address < block.start || address >= block.end) {
+                i++;
+                continue;
+            }
+            if (&block == current) {
+                current = nullptr;
+            }
+            blocks.erase(found);
+            epoch++;
+        }
+        keys[i] = keys.back();
+        keys.pop_back();
+    }
+    codeLines[line] = !keys.empty();
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include "./util.hpp"
+
+class MMU;
+class SharedRom;
+
+const u16 MAX_BLOCK_OPS = 64;
+const u16 CODE_LINE_SIZE = 128; //granularity of RAM code tracking
+
+struct DecodedOp {
+  u8 opCode;
+  u8 length;
+  u16 operand; //d8/r8/a8, d16/a16, or the prefixed opcode after 0xCB
+  u8 fused;    //index + 1 into `SUPERINSTRUCTIONS` of the sequence starting here, or past them into `LOOP_KERNELS`, or `IDLE_LOOP_FUSED`. 0 if none
+};
+
+// A straight run of instructions ending at the first control-flow op.
+// `cycles` is the cost of running it start to end with no branch taken
+struct Block {
+  u16 start;
+  u16 end; //one past the last byte
+  u16 cycles;
+  std::vector<DecodedOp> ops;
+
+  // Host code compiled from `ops` by the JIT once the block has been entered often enough
+  void* hostCode = nullptr;
+  u16 entries = 0;
+
+  // The whole block is one of `LOOP_KERNELS` or an idle loop, which the interpreter runs faster than compiled code would
+  bool bulkLoop = false;
+};
+
+// `DecodedOp::fused` value for the first of `count` ops, from `start` to `end`, if they loop back to
+// `start` as one of `LOOP_KERNELS` or an idle loop, else 0. `hinted` if the block is in `IDLE_LOOP_HINTS`
+u8 findBulkLoop(const DecodedOp* ops, u16 count, u16 start, u16 end, bool hinted);
+
+// Pre-decoded basic blocks for the interpreter, keyed by (mapped ROM bank, PC).
+// Covers cartridge ROM, WRAM and HRAM; anything else is decoded from memory every time.
+// ROM ops and loops are copied from the cartridge's `SharedRom`, which decodes each bank once for every CPU.
+// Blocks in switchable ROM are keyed by bank, so a bank switch only drops the block in flight.
+// RAM blocks are dropped when a write lands on them
+class BlockCache {
+public:
+  BlockCache(MMU* mmu);
+
+  // Decoded op at `pc`, or nullptr if `pc` isn't cacheable
+  inline const DecodedOp* fetch(u16 pc) {
+    if (current != nullptr && pc == nextPc && index < current->ops.size()) {
+      const DecodedOp* op = &current->ops[index++];
+      nextPc += op->length;
+      return op;
+    }
+    return enter(pc);
+  }
+
+  // Called by the MMU on every write to WRAM/HRAM
+  inline void written(u16 address) {
+    if (codeLines[address / CODE_LINE_SIZE]) {
+      invalidate(address);
+    }
+  }
+  void written(u16 address, u16 length) {
+    for (u32 line = address / CODE_LINE_SIZE; line <= (address + length - 1u) / CODE_LINE_SIZE; line++) {
+      if (codeLines[line]) {
+        invalidate(line * CODE_LINE_SIZE);
+      }
+    }
+  }
+
+  // Block starting at `pc`, built on first use. nullptr if `pc` isn't cacheable
+  Block* getBlock(u16 pc);
+
+  void bankSwitched();
+  void flush();
+
+  // Superinstructions are matched when blocks are built, so this flushes
+  void setFusion(bool enabled);
+
+  // PC breakpoints, bank-aware for 0x4000-0x7FFF. Blocks are split so every breakpoint starts one,
+  // which keeps breakpoints out of the middle of fused ops and loops. Both flush
+  void addBreakpoint(u16 bank, u16 address);
+  void removeBreakpoint(u16 bank, u16 address);
+  inline bool isBreakpoint(u16 pc) {
+    return checkBit(breakpointBits[pc >> 3], pc & 0x7) && isBreakpointInBank(pc);
+  }
+
+  // Block the last `fetch` came from
+  const Block* getCurrentBlock() { return current; }
+
+  // Bumped whenever a bank switch or write may have changed which code is mapped
+  u32 getEpoch() { return epoch; }
+private:
+  MMU* mmu;
+  SharedRom* image; //nullptr if the cartridge was made from bare bytes, whose ROM is then decoded like RAM
+
+  std::unordered_map<u32, Block> blocks;
+
+  // Block being stepped through, and where the next op in it is expected
+  const Block* current = nullptr;
+  u16 index = 0;
+  u16 nextPc = 0;
+
+  u32 epoch = 0;
+  bool fusion = true;
+
+  std::vector<u32> breakpoints; //keyed like `blocks`
+  u8 breakpointBits[0x10000 / 8] = {}; //set for an address with a breakpoint in any bank
+  bool hasBreakpointBit(u16 pc) { return checkBit(breakpointBits[pc >> 3], pc & 0x7); }
+  bool isBreakpointInBank(u16 pc);
+
+  // Per 128-byte line of the address space: does any RAM block overlap it, and which
+  bool codeLines[0x10000 / CODE_LINE_SIZE] = {};
+  std::vector<u32> lineBlocks[0x10000 / CODE_LINE_SIZE];
+
+  const DecodedOp* enter(u16 pc);
+  void build(Block& block, u16 pc, u32 regionEnd);
+  void fuse(Block& block, u8 loop);
+  void invalidate(u16 address);
+  u32 getRegionEnd(u16 pc);
+  u32 getKey(u16 pc);
+};
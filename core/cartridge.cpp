@@ -1,5 +1,8 @@
 #include "./cartridge.hpp"
+#include "./romfile.hpp"
+#include "./savefile.hpp"
 #include <stdio.h>
+#include <string.h>
 
 MBCType getMBCType(u8 code) {
   switch (code) {
@@ -17,6 +20,17 @@ MBCType getMBCType(u8 code) {
       return OTHER;
   }
 }
+bool hasBattery(u8 code) {
+  switch (code) {
+    case 0x03: case 0x06: case 0x09: case 0x0D: case 0x0F: case 0x10: case 0x13: case 0x1B: case 0x1E: case 0xFF:
+      return true;
+    default:
+      return false;
+  }
+}
+bool hasClock(u8 code) {
+  return code == 0x0F || code == 0x10;
+}
 u32 getRomSize(u8 code) {
   return ROM_BANK_SIZE << code;
 }
@@ -41,23 +55,80 @@ CartridgeInfo getInfo(u8* rom) {
   info.title = std::string((char*)(rom + TITLE_ADDRESS));
   info.type = getMBCType(rom[MBC_TYPE_ADDRESS]);
   info.romSize = getRomSize(rom[ROM_SIZE_ADDRESS]);
-  info.ramSize = getRamSize(rom[RAM_SIZE_ADDRESS]);
+  info.ramSize = info.type == MBC_2 ? 512 : getRamSize(rom[RAM_SIZE_ADDRESS]);
+  info.battery = hasBattery(rom[MBC_TYPE_ADDRESS]);
+  info.clock = hasClock(rom[MBC_TYPE_ADDRESS]);
   return info;
 }
 
 Cartridge::Cartridge(u8* rom, CartridgeInfo cartridgeInfo) : rom(rom), cartridgeInfo(cartridgeInfo) {
-  ram = cartridgeInfo.ramSize ? new u8[cartridgeInfo.ramSize] : NULL;
+  ram = cartridgeInfo.ramSize ? new u8[cartridgeInfo.ramSize]() : NULL;
+}
+Cartridge::~Cartridge() {
+  if (save != nullptr) {
+    delete save;
+  } else {
+    delete[] ram;
+  }
 }
-Cartridge::~Cartridge() {}
 u8 Cartridge::read(u16 address) {
   return rom[address];
 }
 void Cartridge::write(u16 address, u8 value) {
   //Do nothing
 }
+u16 Cartridge::getRomBank() {
+  return 1;
+}
+u8* Cartridge::getRom() {
+  return rom;
+}
+u8* Cartridge::getMappedRom() {
+  return rom + 0x4000;
+}
+u8* Cartridge::getMappedRam(bool writing) {
+  return nullptr;
+}
+bool Cartridge::useSaveFile(const char* path) {
+  if (!hasBattery()) {
+    printf("ERROR :: Cartridge has no battery-backed RAM or clock to save\n");
+    return false;
+  }
+  SaveFile* file = SaveFile::open(path, cartridgeInfo.ramSize + (cartridgeInfo.clock ? RTC_SAVE_SIZE : 0));
+  if (file == nullptr) {
+    return false;
+  }
+  if (save != nullptr) {
+    delete save;
+  } else {
+    delete[] ram;
+  }
+  save = file;
+  ram = save->getData();
+  return true;
+}
+bool Cartridge::hasBattery() {
+  return cartridgeInfo.battery && (cartridgeInfo.ramSize != 0 || cartridgeInfo.clock);
+}
+void Cartridge::setCycleCounter(const u64* cycles) {
+  cycleCounter = cycles;
+}
+void Cartridge::ramWritten() {
+  if (save != nullptr) {
+    save->changed();
+  }
+}
 const char* Cartridge::getTitle() {
   return cartridgeInfo.title.c_str();
 }
+MBCType Cartridge::getType() {
+  switch (cartridgeInfo.type) {
+    case NO_MBC: case MBC_1: case MBC_2: case MBC_3: case MBC_5:
+      return cartridgeInfo.type;
+    default:
+      return OTHER;
+  }
+}
 
 
 
@@ -119,10 +190,29 @@ void MBC1::write(u16 address, u8 value) {
     printf("ERROR :: Attempted cartridge write to illegal address\n");
   }
 }
+u16 MBC1::getRomBank() {
+  return romBank;
+}
+u8* MBC1::getMappedRom() {
+  if (0x4000 * u32(romBank + 1) > cartridgeInfo.romSize) {
+    return nullptr;
+  }
+  return rom + 0x4000 * romBank;
+}
+u8* MBC1::getMappedRam(bool writing) {
+  if (!ramEnabled || 0x2000 * u32(ramBank + 1) > cartridgeInfo.ramSize) {
+    return nullptr;
+  }
+  return ram + 0x2000 * ramBank;
+}
 
 
 
 MBC3::MBC3(u8* rom, CartridgeInfo cartridgeInfo) : Cartridge(rom, cartridgeInfo) {}
+MBC3::~MBC3() {
+  // The clock isn't brought up to date first, as the CPU may already be gone
+  storeClock();
+}
 u8 MBC3::read(u16 address) {
   if (address <= 0x3FFF) {
     return rom[address];
@@ -135,6 +225,8 @@ u8 MBC3::read(u16 address) {
       u32 start_of_ram_bank = 0x2000 * ramBank;
       u16 address_requested = address - 0xA000; //0x0000-0x1FFF
       return ram[start_of_ram_bank + address_requested];
+    } else if (mappedRegister <= 0x0C && cartridgeInfo.clock && ramEnabled) {
+      return latchedClock[mappedRegister - 0x08];
     }
   } else {
     printf("ERROR :: Attempted cartridge read from illegal address\n");
@@ -152,16 +244,19 @@ void MBC3::write(u16 address, u8 value) {
     romBank |= bank;
     if (romBank == 0) { romBank++; }
   } else if (address <= 0x5FFF) {
+    //0x00-0x07 picks a RAM bank, 0x08-0x0C a clock register
     mappedRegister = value;
-    if (ramEnabled) {
+    if (value <= 0x07) {
       ramBank = value & 0x3;
-    } else {
-      u8 bank = (value & 0x3) << 5;
-      romBank |= bank;
     }
   } else if (address <= 0x7FFF) {
-    //TODO: Implement Clock latch
-    // https://gbdev.io/pandocs/MBC3.html#6000-7fff---latch-clock-data-write-only
+    //Writing 0x00 then 0x01 copies the clock to the registers the game reads
+    if (lastLatchWrite == 0x00 && value == 0x01) {
+      updateClock();
+      memcpy(latchedClock, clock, sizeof(clock));
+      storeClock();
+    }
+    lastLatchWrite = value;
   } else if (0xA000 <= address && address <= 0xBFFF) {
     if (0x00 <= mappedRegister && mappedRegister <= 0x07) {
       if (!ramEnabled) { return; }
@@ -169,16 +264,194 @@ void MBC3::write(u16 address, u8 value) {
       u32 start_of_ram_bank = 0x2000 * ramBank;
       u16 address_requested = address - 0xA000; //0x0000-0x1FFF
       ram[start_of_ram_bank + address_requested] = value;
+    } else if (mappedRegister <= 0x0C && cartridgeInfo.clock && ramEnabled) {
+      static const u8 masks[5] = { 0x3F, 0x3F, 0x1F, 0xFF, 0xC1 };
+      updateClock();
+      if (mappedRegister == 0x08) {
+        //Setting the seconds restarts the second in progress
+        clockCycle = cycleCounter != nullptr ? *cycleCounter : 0;
+      }
+      clock[mappedRegister - 0x08] = value & masks[mappedRegister - 0x08];
+      latchedClock[mappedRegister - 0x08] = clock[mappedRegister - 0x08];
+      storeClock();
     }
-    //TODO: Some RTC stuff
   }
 }
+u16 MBC3::getRomBank() {
+  return romBank;
+}
+u8* MBC3::getMappedRom() {
+  if (0x4000 * u32(romBank + 1) > cartridgeInfo.romSize) {
+    return nullptr;
+  }
+  return rom + 0x4000 * romBank;
+}
+u8* MBC3::getMappedRam(bool writing) {
+  if (mappedRegister > 0x07 || (writing && !ramEnabled) || 0x2000 * u32(ramBank + 1) > cartridgeInfo.ramSize) {
+    return nullptr;
+  }
+  return ram + 0x2000 * ramBank;
+}
+bool MBC3::useSaveFile(const char* path) {
+  if (!Cartridge::useSaveFile(path)) {
+    return false;
+  }
+  if (cartridgeInfo.clock) {
+    savedClock = ram + cartridgeInfo.ramSize;
+    loadClock();
+  }
+  return true;
+}
+// Counts whole seconds run since `clockCycle`, carrying into minutes, hours and days. Past day 511 the
+// day wraps to 0 and the carry bit stays set until the game clears it
+void MBC3::updateClock() {
+  u64 now = cycleCounter != nullptr ? *cycleCounter : 0;
+  if (checkBit(clock[4], 6) || now < clockCycle) {
+    clockCycle = now;
+    return;
+  }
+  u64 seconds = (now - clockCycle) / CYCLES_PER_SECOND;
+  if (seconds == 0) {
+    return;
+  }
+  clockCycle += seconds * CYCLES_PER_SECOND;
 
+  u64 days = clock[3] | ((clock[4] & 0x1) << 8);
+  u64 total = clock[0] + 60 * (clock[1] + 60 * (clock[2] + 24 * days)) + seconds;
+  clock[0] = total % 60;
+  clock[1] = (total / 60) % 60;
+  clock[2] = (total / 3600) % 24;
+  days = total / 86400;
+  if (days > 0x1FF) {
+    clock[4] |= 0x80;
+  }
+  clock[3] = days & 0xFF;
+  clock[4] = (clock[4] & 0xFE) | ((days >> 8) & 0x1);
+}
+// Each register as a little-endian u32, the latched ones after them, then a u64 timestamp this ignores
+void MBC3::loadClock() {
+  for (u8 i = 0; i < 5; i++) {
+    clock[i] = savedClock[4 * i];
+    latchedClock[i] = savedClock[20 + 4 * i];
+  }
+  clockCycle = cycleCounter != nullptr ? *cycleCounter : 0;
+}
+void MBC3::storeClock() {
+  if (savedClock == nullptr) {
+    return;
+  }
+  memset(savedClock, 0, RTC_SAVE_SIZE);
+  for (u8 i = 0; i < 5; i++) {
+    savedClock[4 * i] = clock[i];
+    savedClock[20 + 4 * i] = latchedClock[i];
+  }
+}
 
 
 
-Cartridge* createCartridge(u8* rom) {
-  CartridgeInfo cartridgeInfo = getInfo(rom);
+// Bank numbers past the end of the ROM wrap around, as only as many address lines as it needs are wired up
+static u32 getRomBankMask(const CartridgeInfo& cartridgeInfo) {
+  return cartridgeInfo.romSize / 0x4000 - 1;
+}
+
+
+
+MBC5::MBC5(u8* rom, CartridgeInfo cartridgeInfo) : Cartridge(rom, cartridgeInfo) {
+  updateBanks();
+}
+u8 MBC5::read(u16 address) {
+  if (address <= 0x3FFF) {
+    return rom[address];
+  } else if (address <= 0x7FFF) {
+    return romBankData[address - 0x4000];
+  } else if (0xA000 <= address && address <= 0xBFFF) {
+    return ramBankData != nullptr ? ramBankData[address - 0xA000] : 0xFF;
+  }
+  printf("ERROR :: Attempted cartridge read from illegal address\n");
+  return 0xFF;
+}
+void MBC5::write(u16 address, u8 value) {
+  if (address <= 0x1FFF) {
+    ramEnabled = getLowNibble(value) == 0xA;
+  } else if (address <= 0x2FFF) {
+    romBank = (romBank & 0x100) | value;
+  } else if (address <= 0x3FFF) {
+    romBank = (romBank & 0xFF) | ((value & 0x1) << 8);
+  } else if (address <= 0x5FFF) {
+    ramBank = getLowNibble(value);
+  } else if (address <= 0x7FFF) {
+    return;
+  } else if (0xA000 <= address && address <= 0xBFFF) {
+    if (ramBankData != nullptr) {
+      ramBankData[address - 0xA000] = value;
+    }
+    return;
+  } else {
+    printf("ERROR :: Attempted cartridge write to illegal address\n");
+    return;
+  }
+  updateBanks();
+}
+void MBC5::updateBanks() {
+  romBankData = rom + 0x4000 * (romBank & getRomBankMask(cartridgeInfo));
+  bool ramExists = 0x2000 * u32(ramBank + 1) <= cartridgeInfo.ramSize;
+  ramBankData = ramEnabled && ramExists ? ram + 0x2000 * ramBank : nullptr;
+}
+u16 MBC5::getRomBank() {
+  return romBank & getRomBankMask(cartridgeInfo);
+}
+u8* MBC5::getMappedRom() {
+  return romBankData;
+}
+u8* MBC5::getMappedRam(bool writing) {
+  return ramBankData;
+}
+
+
+
+MBC2::MBC2(u8* rom, CartridgeInfo cartridgeInfo) : Cartridge(rom, cartridgeInfo) {
+  romBankData = rom + 0x4000;
+}
+u8 MBC2::read(u16 address) {
+  if (address <= 0x3FFF) {
+    return rom[address];
+  } else if (address <= 0x7FFF) {
+    return romBankData[address - 0x4000];
+  } else if (0xA000 <= address && address <= 0xBFFF) {
+    return ramEnabled ? 0xF0 | ram[address & 0x1FF] : 0xFF;
+  }
+  printf("ERROR :: Attempted cartridge read from illegal address\n");
+  return 0xFF;
+}
+void MBC2::write(u16 address, u8 value) {
+  if (address <= 0x3FFF) {
+    // Bit 8 of the address picks the register
+    if (address & 0x100) {
+      romBank = getLowNibble(value);
+      if (romBank == 0) { romBank++; }
+      romBankData = rom + 0x4000 * (romBank & getRomBankMask(cartridgeInfo));
+    } else {
+      ramEnabled = getLowNibble(value) == 0xA;
+    }
+  } else if (0xA000 <= address && address <= 0xBFFF) {
+    if (ramEnabled) {
+      ram[address & 0x1FF] = getLowNibble(value);
+    }
+  } else if (address > 0x7FFF) {
+    printf("ERROR :: Attempted cartridge write to illegal address\n");
+  }
+}
+u16 MBC2::getRomBank() {
+  return romBank & getRomBankMask(cartridgeInfo);
+}
+u8* MBC2::getMappedRom() {
+  return romBankData;
+}
+
+
+
+
+static Cartridge* createCartridge(u8* rom, CartridgeInfo cartridgeInfo) {
   switch (cartridgeInfo.type) {
     case NO_MBC:
       return new NoMBC(rom, cartridgeInfo);
@@ -186,8 +459,20 @@ Cartridge* createCartridge(u8* rom) {
       return new MBC1(rom, cartridgeInfo);
     case MBC_3:
       return new MBC3(rom, cartridgeInfo);
+    case MBC_5:
+      return new MBC5(rom, cartridgeInfo);
+    case MBC_2:
+      return new MBC2(rom, cartridgeInfo);
     default:
       printf("ERROR :: Cartridge type not currently supported\nERROR :: Program will probably crash\n");
       return new Cartridge(rom, cartridgeInfo);
   }
+}
+Cartridge* createCartridge(u8* rom) {
+  return createCartridge(rom, getInfo(rom));
+}
+Cartridge* createCartridge(std::shared_ptr<SharedRom> image) {
+  Cartridge* cartridge = createCartridge(image->getData(), image->getInfo());
+  cartridge->image = image;
+  return cartridge;
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include "./util.hpp"
 
@@ -8,8 +9,12 @@ const u16 TITLE_ADDRESS = 0x134;
 const u16 MBC_TYPE_ADDRESS = 0x147;
 const u16 ROM_SIZE_ADDRESS = 0x148;
 const u16 RAM_SIZE_ADDRESS = 0x149;
+const u16 HEADER_CHECKSUM_ADDRESS = 0x14D;
+const u16 GLOBAL_CHECKSUM_ADDRESS = 0x14E;
 const u16 ROM_BANK_SIZE = 32768; //32 kB
 const u16 RAM_BANK_SIZE = 8192; //8 bB
+const u32 CYCLES_PER_SECOND = 4194304;
+const u16 RTC_SAVE_SIZE = 48; //after the RAM in the save file, laid out as other emulators do
 
 enum MBCType {
   NO_MBC, //Tetris and Dr. Mario have no MBC at all
@@ -23,6 +28,8 @@ enum MBCType {
 MBCType getMBCType(u8 code);
 u32 getRomSize(u8 code);
 u32 getRamSize(u8 code);
+bool hasBattery(u8 code);
+bool hasClock(u8 code);
 
 class CartridgeInfo { //lazy-man's struct
 public:
@@ -31,10 +38,15 @@ public:
   MBCType type;
   u32 romSize;
   u32 ramSize;
+  bool battery;
+  bool clock; //MBC3 real-time clock
 };
 
 CartridgeInfo getInfo(u8* rom);
 
+class SharedRom;
+class SaveFile;
+
 class Cartridge {
 public:
   Cartridge(u8* rom, CartridgeInfo cartridgeInfo);
@@ -43,19 +55,52 @@ public:
   virtual u8 read(u16 address);
   virtual void write(u16 address, u8 value);
 
+  // Bank currently mapped at 0x4000-0x7FFF
+  virtual u16 getRomBank();
+
+  // Host memory the MMU maps straight into its page table. `getMappedRom` backs 0x4000-0x7FFF;
+  // `getMappedRam` backs 0xA000-0xBFFF. Either is nullptr while accesses there must go through `read`/`write`.
+  // The MMU asks again after every write to 0x0000-0x7FFF
+  u8* getRom();
+  virtual u8* getMappedRom();
+  virtual u8* getMappedRam(bool writing);
+
+  // Battery-backed RAM is kept in the file at `path`, created if it doesn't exist yet, so it lasts between
+  // runs. Call before the cartridge is given to a `GameBoy`. Returns false, after printing why, if it can't be
+  virtual bool useSaveFile(const char* path);
+  bool hasBattery();
+  // The CPU's count of cycles run, which the MBC3 clock keeps time by instead of the host's. Set by `GameBoy`
+  void setCycleCounter(const u64* cycles);
+  // Cartridge RAM may have been written since the last call. Takes a lock, so `GameBoy` calls it at most once a frame
+  void ramWritten();
+
   const char* getTitle();
+  // The image this cartridge was made from, or nullptr if it was made from bare bytes
+  SharedRom* getImage() { return image.get(); }
+  // Which of the classes below `createCartridge` made, so callers can cast to it and call it directly
+  MBCType getType();
 protected:
   u8* rom;
   u8* ram;
+  SaveFile* save = nullptr; //owns `ram` if set
+  const u64* cycleCounter = nullptr;
 
   CartridgeInfo cartridgeInfo;
+private:
+  // Keeps `rom` alive when it belongs to an image other cartridges may be using too
+  std::shared_ptr<SharedRom> image;
+
+  friend Cartridge* createCartridge(std::shared_ptr<SharedRom> image);
 };
 
 Cartridge* createCartridge(u8* rom);
+// Same, for an image shared with other cartridges: its header isn't parsed again, and only this
+// cartridge's bank registers and RAM are allocated
+Cartridge* createCartridge(std::shared_ptr<SharedRom> image);
 
 
 
-class NoMBC: public Cartridge {
+class NoMBC final: public Cartridge {
 public:
   NoMBC(u8* rom, CartridgeInfo cartridgeInfo);
 
@@ -65,12 +110,15 @@ public:
 
 
 
-class MBC1: public Cartridge {
+class MBC1 final: public Cartridge {
 public:
   MBC1(u8* rom, CartridgeInfo cartridgeInfo);
 
   u8 read(u16 address) override;
   void write(u16 address, u8 value) override;
+  u16 getRomBank() override;
+  u8* getMappedRom() override;
+  u8* getMappedRam(bool writing) override;
 private:
   u8 romBank = 0x01;
   u8 ramBank = 0x00;
@@ -80,12 +128,20 @@ private:
 
 
 
-class MBC3: public Cartridge {
+// The clock only moves as the CPU runs cycles, so it keeps game time at any emulation speed and is
+// the same on every run of a replay. It's brought up to date when the game latches or sets it, not
+// on every cycle. Saved with the RAM, it carries on from there next time rather than catching up
+class MBC3 final: public Cartridge {
 public:
   MBC3(u8* rom, CartridgeInfo cartridgeInfo);
+  ~MBC3();
 
   u8 read(u16 address) override;
   void write(u16 address, u8 value) override;
+  u16 getRomBank() override;
+  u8* getMappedRom() override;
+  u8* getMappedRam(bool writing) override;
+  bool useSaveFile(const char* path) override;
 private:
   u8 romBank = 0x01;
   u8 ramBank = 0x00;
@@ -93,4 +149,58 @@ private:
   bool ramOverRTC = true;
   u8 mappedRegister = 0x00;
   bool romBankingMode = true;
+
+  // Registers 0x08-0x0C: seconds, minutes, hours, day bits 0-7, then day bit 8 (bit 0), halt (bit 6) and day carry (bit 7)
+  u8 clock[5] = {};
+  u8 latchedClock[5] = {}; //what the game reads
+  u8 lastLatchWrite = 0xFF;
+  u64 clockCycle = 0; //cycle count `clock` was correct at, not counting a second still in progress
+  u8* savedClock = nullptr; //in the save file, if there is one
+
+  void updateClock();
+  void loadClock();
+  void storeClock();
+};
+
+
+
+// Bank 0 can be mapped at 0x4000-0x7FFF, unlike on MBC1 and MBC3. `romBankData` and `ramBankData` are
+// only recomputed when a bank register changes, so reads just index them
+class MBC5 final: public Cartridge {
+public:
+  MBC5(u8* rom, CartridgeInfo cartridgeInfo);
+
+  u8 read(u16 address) override;
+  void write(u16 address, u8 value) override;
+  u16 getRomBank() override;
+  u8* getMappedRom() override;
+  u8* getMappedRam(bool writing) override;
+private:
+  u16 romBank = 0x001; //9 bits
+  u8 ramBank = 0x00; //4 bits
+  bool ramEnabled = false;
+
+  u8* romBankData;
+  u8* ramBankData = nullptr; //nullptr while RAM is disabled or the bank doesn't exist
+
+  void updateBanks();
+};
+
+
+
+// Up to 16 ROM banks, and 512 half-bytes of RAM built into the chip (its `ramSize`), repeated across 0xA000-0xBFFF.
+// Only the low nibble of each RAM byte exists, so RAM always goes through `read` and `write`
+class MBC2 final: public Cartridge {
+public:
+  MBC2(u8* rom, CartridgeInfo cartridgeInfo);
+
+  u8 read(u16 address) override;
+  void write(u16 address, u8 value) override;
+  u16 getRomBank() override;
+  u8* getMappedRom() override;
+private:
+  u8 romBank = 0x01;
+  bool ramEnabled = false;
+
+  u8* romBankData;
 };
\ No newline at end of file
@@ -1,4 +1,9 @@
 #include "cpu.hpp"
+#include "./opcodes.hpp"
+#include "./ppu.hpp"
+#include "./timer.hpp"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <stdio.h>
 
@@ -10,8 +15,24 @@ const u8 subtraction_flag_index = 6;
 const u8 half_carry_flag_index = 5;
 const u8 carry_flag_index = 4;
 
+constexpr u8 flagBits(bool zero, bool subtraction, bool halfCarry, bool carry) {
+    return (zero << zero_flag_index) | (subtraction << subtraction_flag_index) | (halfCarry << half_carry_flag_index) | (carry << carry_flag_index);
+}
+
+// INC and DEC set Z, N and H purely from their result and leave C alone,
+// so their flags are a lookup on the result byte
+constexpr std::array<u8, 256> makeIncDecFlagTable(bool decrement) {
+    std::array<u8, 256> table = {};
+    for (int result = 0; result < 256; result++) {
+        bool halfCarry = decrement ? (result & 0x0F) == 0x0F : (result & 0x0F) == 0x00;
+        table[result] = flagBits(result == 0, decrement, halfCarry, false);
+    }
+    return table;
+}
+constexpr std::array<u8, 256> incFlagTable = makeIncDecFlagTable(false);
+constexpr std::array<u8, 256> decFlagTable = makeIncDecFlagTable(true);
 
-CPU::CPU(MMU* mmu) : mmu(mmu) {   
+CPU::CPU(MMU* mmu, InterruptController* interrupts) : mmu(mmu), interrupts(interrupts), blockCache(mmu) {   
     //setting the pc to start where the boot rom is located
     this->pc = 0;
 
@@ -21,73 +42,110 @@ CPU::CPU(MMU* mmu) : mmu(mmu) {
     this->de=0x0000;
     this->hl=0x0000;
     this->sp=0x0000;
+
+    mmu->setBlockCache(&blockCache);
+    mmu->setCPU(this);
 }
 
-u8 CPU::step(){
+u8 CPU::step(int cycleBudget){
+    this->cycleBudget = std::clamp(cycleBudget, 0, 0xFFFF);
+    lagCycles = 0;
+    stepStartLag = 0;
+    u8 cycles = stepInBatch();
+    cycleCount += cycles;
+    return cycles;
+}
+
+// `lagCycles` are already owed to Timer and PPU when this is called
+inline u8 CPU::stepInBatch() {
+    instructionPc = pc;
     u8 cyclesFromInterrupts = handleInterrupts();
+    lagCycles += cyclesFromInterrupts;
     if (halted) 
     { 
-        return 4; 
+        return getHaltCycles(); 
+    }
+    if (breakpointsArmed) {
+        if (!(resuming && pc == stoppedPc) && blockCache.isBreakpoint(pc)) {
+            stopped = true;
+            stoppedPc = pc;
+            batchEnded = true;
+            return cyclesFromInterrupts;
+        }
+        resuming = false;
     }
     u8 cyclesFromOpCode = exec();
     return cyclesFromInterrupts + cyclesFromOpCode;
 }
 
-// If an interrupt is handled, it takes an additional 20 clocks
-inline u8 CPU::handleInterrupts() {
-    Interrupt requested_interrupt = checkInterrupts();
-
-    if (requested_interrupt != NONE) {
-        halted = false;
-        acknowledgeInterrupt(requested_interrupt);
-        ime = false;
-        pushToStack(pc);
-        pc = getInterruptVector(requested_interrupt);
-        return 20;
+// Every op that starts before Timer and PPU could change state sees them exactly as it would if
+// they were stepped after each op, so they're only stepped once at the end. Three things end a run
+// early: a HALT, so its fast-forward starts with the devices up to date, a write to an I/O
+// register, which may change what they do next, and an armed breakpoint. `syncDevices` catches
+// the devices up just before the write lands, as stepping after each op would have
+int CPU::run(int cycleBudget) {
+    this->cycleBudget = std::clamp(cycleBudget, 0, 0xFFFF);
+    lagCycles = 0;
+    batchEnded = false;
+    resuming = stopped;
+    stopped = false;
+    u16 deadline = getQuietCycles();
+    int cycles = 0;
+    do {
+        if (halted && lagCycles > 0) {
+            break;
+        }
+        stepStartLag = lagCycles;
+        u8 stepCycles = stepInBatch();
+        cycles += stepCycles;
+        cycleCount += stepCycles;
+        lagCycles = stepStartLag + stepCycles;
+    } while (lagCycles < deadline && !batchEnded);
+
+    if (timer != nullptr && lagCycles > 0) {
+        timer->step(lagCycles);
+        ppu->step(lagCycles);
     }
-    
-    return 0;
+    lagCycles = 0;
+    return cycles;
 }
 
-// Sets associated bit in Interrupt Flag
-void CPU::requestInterrupt(Interrupt interrupt) {
-    if (interrupt != NONE) {
-        u8 bitIndex = static_cast<int>(interrupt);
-        mmu->write(IF_ADDRESS, setBit(mmu->read(IF_ADDRESS), bitIndex));
+void CPU::syncDevices() {
+    if (timer != nullptr && stepStartLag > 0) {
+        timer->step(stepStartLag);
+        ppu->step(stepStartLag);
+        lagCycles -= stepStartLag;
+        stepStartLag = 0;
     }
+    batchEnded = true;
 }
 
-// Clears associated bit in Interrupt Flag
-inline void CPU::acknowledgeInterrupt(Interrupt interrupt) {
-    if (interrupt != NONE) {
-        u8 bitIndex = static_cast<int>(interrupt);
-        mmu->write(IF_ADDRESS, clearBit(mmu->read(IF_ADDRESS), bitIndex));
-    }
+void CPU::addBreakpoint(u16 bank, u16 address) {
+    blockCache.addBreakpoint(bank, address);
 }
 
-// Returns highest priority interrupt, or `NONE` if none requested && enabled
-inline Interrupt CPU::checkInterrupts() {
-    if (!ime) { return NONE; }
-
-    u8 interrupts_enabled = mmu->read(IE_ADDRESS);
-    u8 interrupts_flag = mmu->read(IF_ADDRESS);
-    u8 interrupts_requested = interrupts_enabled & interrupts_flag;
-
-    if (interrupts_requested == 0) { return NONE; }
-
-    if (checkBit(interrupts_requested, static_cast<int>(VBLANK_INT))) {
-        return VBLANK_INT;
-    } else if (checkBit(interrupts_requested, static_cast<int>(LCD_STAT))) {
-        return LCD_STAT;
-    } else if (checkBit(interrupts_requested, static_cast<int>(TIMER))) {
-        return TIMER;
-    } else if (checkBit(interrupts_requested, static_cast<int>(SERIAL))) {
-        return SERIAL;
-    } else if (checkBit(interrupts_requested, static_cast<int>(INPUT))) {
-        return INPUT;
-    } else {
-        return NONE;
+void CPU::removeBreakpoint(u16 bank, u16 address) {
+    blockCache.removeBreakpoint(bank, address);
+}
+
+void CPU::armBreakpoints(bool armed) {
+    breakpointsArmed = armed;
+}
+
+// If an interrupt is handled, it takes an additional 20 clocks
+inline u8 CPU::handleInterrupts() {
+    if (interrupts->getDispatchable() == 0) {
+        return 0;
     }
+
+    Interrupt requested_interrupt = interrupts->getNext();
+    halted = false;
+    interrupts->acknowledge(requested_interrupt);
+    interrupts->setIME(false);
+    pushToStack(pc);
+    pc = getInterruptVector(requested_interrupt);
+    instructionPc = pc;
+    return 20;
 }
 
 inline u16 CPU::getInterruptVector(Interrupt interrupt) {
@@ -103,1179 +161,1100 @@ u8 CPU::exec(){
         std::freopen("output.txt","w",stdout);
     }
     if (logMode) {
-        printf("A: %02X F: %02X B: %02X C: %02X D: %02X E: %02X H: %02X L: %02X SP: %04X PC: 00:%04X ", getHighByte(af), getLowByte(af), getHighByte(bc), getLowByte(bc), getHighByte(de), getLowByte(de), getHighByte(hl), getLowByte(hl), sp, pc);
-        printf("(%02X %02X %02X %02X)\n", mmu->read(pc), mmu->read(pc + 1), mmu->read(pc + 2), mmu->read(pc + 3));
+        printf("A: %02X F: %02X B: %02X C: %02X D: %02X E: %02X H: %02X L: %02X SP: %04X PC: 00:%04X ", getHighByte(af), readFlags(), getHighByte(bc), getLowByte(bc), getHighByte(de), getLowByte(de), getHighByte(hl), getLowByte(hl), sp, pc);
+        printf("(%02X %02X %02X %02X)\n", mmu->fetch(pc), mmu->fetch(pc + 1), mmu->fetch(pc + 2), mmu->fetch(pc + 3));
+        #ifdef LOG_DISASSEMBLY
+        u8 bytes[3] = { mmu->fetch(pc), mmu->fetch(pc + 1), mmu->fetch(pc + 2) };
+        printf("%04X: %s\n", pc, disassemble(bytes, pc).c_str());
+        #endif
     }
     #endif
 
     //read code from wherever program counter is at
-    //increment the program counter so next time we call it we get the next opCode
-    //Anytime the program counter is used to read, it needs to be incremented, such as when reading input for an opCode
-    u8 opCode = mmu->read(pc++);
-    
-    switch(opCode){
-        case 0x00: {
-            //NOP
-            return 4;
-        }
-        case 0x10: {
-            //STOP
-            //TODO: Set some interrupt to pause execution until button press?
-            pc++;
-            return 4;
-        }
-        case 0x20: {
-            //JR NZ, r8 where r8 is signed
-            s8 nn = mmu->read(pc++); //always read r8 to consume entire op code
-            if (!readZeroFlag()) {
-                pc += nn;
-                return 12;
-            }
-            return 8;
+    //the program counter is moved past the opCode and its operand before the handler runs
+    u8 opCode;
+    const DecodedOp* decoded = blockCache.fetch(pc);
+    if (decoded != nullptr) {
+        opCode = decoded->opCode;
+        operand = decoded->operand;
+        if (sequenceProfile != nullptr) {
+            recordSequence(pc, opCode);
+        }
+        pc += decoded->length;
+        if (decoded->fused != 0) {
+            return fusedTable[decoded->fused - 1](this);
         }
-        case 0x30: {
-            //JR NC, r8 where r8 is signed
-            s8 nn = mmu->read(pc++); //always read r8 to consume entire op code
-            if (!readCarryFlag()) {
-                pc += nn;
-                return 12;
-            }
-            return 8;
+    } else {
+        if (sequenceProfile != nullptr) {
+            sequenceProfile->run = 0;
         }
-        case 0x01: case 0x11: case 0x21: case 0x31: {
-            //LD rr,d16
-            u16* rr = get16BitRegisterFromEncoding(getHighNibble(opCode));
-            u16 n = mmu->read16Bit(pc++);
-            pc++; //Incremented twice on 16 bit read
-            *rr = n;
-            return 12;
+        opCode = mmu->fetch(pc++);
+        u8 length = OPCODES[opCode].length;
+        if (length == 2) {
+            operand = mmu->fetch(pc++);
+        } else if (length == 3) {
+            operand = mmu->fetch16Bit(pc);
+            pc += 2;
         }
-        case 0x02: case 0x12: {
-            //LD (rr), A
-            u16* rr = get16BitRegisterFromEncoding(getHighNibble(opCode));
-            u8 a = getHighByte(af);
-            mmu->write(*rr, a);
-            return 8;
+    }
+    return opTable[opCode](this);
+}
+
+inline u8 CPU::execCB() {
+    return cbTable[(u8)operand](this);
+}
+
+// Running an op of a superinstruction before Timer and PPU have caught up with the ones before it
+// is only invisible if neither would have changed state by then, and if the op doesn't write to the
+// I/O registers that control them. Otherwise the sequence stops here and `exec` picks up the rest
+template <u8 opCode>
+inline bool CPU::execFused(u8& cycles, u16 quietCycles) {
+    if (cycles >= quietCycles) {
+        return false;
+    }
+    if constexpr (getWriteRegister16(opCode) >= 0) {
+        u16 address = *reg16<getWriteRegister16(opCode)>();
+        if (address >= 0xFF00 && address < 0xFF80) {
+            return false;
         }
-        case 0x22: {
-            //LD (HL+), A
-            u8 a = getHighByte(af);
-            mmu->write(hl++, a);
-            return 8;
+    }
+    const DecodedOp* decoded = blockCache.fetch(pc);
+    operand = decoded->operand;
+    pc += decoded->length;
+    cycles += op<opCode>();
+    return true;
+}
+
+template <size_t index>
+u8 CPU::dispatchFused(CPU* cpu) {
+    constexpr Superinstruction fused = SUPERINSTRUCTIONS[index];
+    u16 quietCycles = cpu->getQuietCycles();
+    u8 cycles = cpu->op<fused.opCodes[0]>();
+    if (cpu->execFused<fused.opCodes[1]>(cycles, quietCycles) && fused.count == 3) {
+        cpu->execFused<fused.opCodes[2]>(cycles, quietCycles);
+    }
+    return cycles;
+}
+
+template <size_t index>
+u8 CPU::dispatchLoop(CPU* cpu) {
+    constexpr LoopKernel kernel = LOOP_KERNELS[index];
+    u8 cycles = cpu->runLoop<index>();
+    return cycles != 0 ? cycles : cpu->op<kernel.opCodes[0]>();
+}
+
+// Longest run of loop passes in one `step`. Leaves room for an interrupt dispatch in the same step
+const u8 MAX_LOOP_CYCLES = 0xFF - 20;
+
+// Runs as many whole passes of a copy or fill loop as fit in one go, touching memory in bulk and
+// leaving registers, flags and `pc` as the ops would have. `pc` is already past the first op.
+// Returns 0 without doing anything if not even one pass fits, or if the loop reaches memory that
+// isn't plain RAM, so the ops run one at a time instead
+template <size_t index>
+u8 CPU::runLoop() {
+    constexpr LoopKernel kernel = LOOP_KERNELS[index];
+    constexpr u8 first = kernel.opCodes[0];
+    constexpr bool countsBC = kernel.opCodes[kernel.count - 2] == 0xB1;
+    constexpr bool countsB = kernel.opCodes[kernel.count - 2] == 0x05;
+    constexpr bool copies = hasOp(kernel, 0x1A) || hasOp(kernel, 0x2A);
+    constexpr bool fromDE = hasOp(kernel, 0x1A); //otherwise from HL to DE
+    constexpr bool descending = hasOp(kernel, 0x32);
+    constexpr u16 passCycles = getLoopCycles(kernel);
+    constexpr u16 lastPassCycles = passCycles - (OPCODES[0x20].takenCycles - OPCODES[0x20].cycles);
+    u16 start = pc - OPCODES[first].length;
+    u16 source = fromDE ? de : hl;
+    u16 destination = copies && !fromDE ? de : hl;
+
+    u32 passesLeft;
+    if constexpr (countsBC) {
+        passesLeft = bc != 0 ? bc : 0x10000;
+    } else {
+        u8 counter = countsB ? *reg<0>() : *reg<1>();
+        passesLeft = counter != 0 ? counter : 0x100;
+    }
+
+    bool touchesVideoMemory = isVideoMemory(destination) || (copies && isVideoMemory(source));
+    u16 window = std::min<u16>(getLoopWindow(touchesVideoMemory), MAX_LOOP_CYCLES + 1);
+    if (window == 0) {
+        return 0;
+    }
+    u16 limit = window - 1;
+    u32 passes;
+    if ((passesLeft - 1) * passCycles + lastPassCycles <= limit) {
+        passes = passesLeft;
+    } else {
+        passes = std::min<u32>(limit / passCycles, passesLeft - 1);
+    }
+    if (passes == 0) {
+        return 0;
+    }
+    bool finished = passes == passesLeft;
+
+    // A loop writing over its own code has to see the new ops on its next pass
+    u16 length = passes;
+    if constexpr (descending) {
+        if (hl < length - 1) {
+            return 0;
         }
-        case 0x32: {
-            //LD (HL-), A
-            u8 a = getHighByte(af);
-            mmu->write(hl--, a);
-            return 8;
+        destination = hl - (length - 1);
+    }
+    if (!mmu->isBulkDestination(destination, length) || (destination < start + getLoopLength(kernel) && start < destination + length)) {
+        return 0;
+    }
+
+    if constexpr (copies) {
+        if (!mmu->isBulkSource(source, length)) {
+            return 0;
         }
-        case 0x03: case 0x13: case 0x23: case 0x33: {
-            //INC rr
-            u16* rr = get16BitRegisterFromEncoding(getHighNibble(opCode));
-            *rr += 1;
-            return 8;
+        u8 last = mmu->copy(destination, source, length);
+        hl += length;
+        de += length;
+        if constexpr (!countsBC) {
+            *reg<7>() = last;
         }
-        case 0x04: case 0x14: case 0x24: {
-            //INC r
-            u8* r = getRegisterFromEncoding(getHighNibble(opCode) * 2);
-            *r += 1;
+    } else {
+        u8 value = *reg<7>();
+        if constexpr (first == 0x3E) {
+            value = operand;
+        } else if constexpr (first == 0xAF) {
+            value = 0;
+        } else if constexpr (first == 0x7A) {
+            value = *reg<2>();
+        } else if constexpr (first == 0x7B) {
+            value = *reg<3>();
+        }
+        mmu->fill(destination, length, value);
+        hl = descending ? hl - length : hl + length;
+    }
 
-            setHalfCarryFlag((*r & 0x0F) == 0x00);
-            setSubtractFlag(false);
-            setZeroFlag(*r == 0);
+    if constexpr (countsBC) {
+        bc -= length;
+        *reg<7>() = *reg<0>() | *reg<1>();
+        setFlags(flagBits(*reg<7>() == 0, 0, 0, 0));
+    } else {
+        u8* counter = countsB ? reg<0>() : reg<1>();
+        *counter -= length;
+        setFlags(decFlagTable[*counter] | flagBits(0, 0, 0, readCarryFlag()));
+    }
 
-            return 4;
-        }
-        case 0x34: {
-            //INC (HL)
-            u8 value = mmu->read(hl);
-            mmu->write(hl, ++value);
+    pc = finished ? start + getLoopLength(kernel) : start;
+    return passes * passCycles - (finished ? passCycles - lastPassCycles : 0);
+}
 
-            setHalfCarryFlag((value & 0x0F) == 0x00);
-            setSubtractFlag(false);
-            setZeroFlag(value == 0);
+u8 CPU::dispatchIdleLoop(CPU* cpu) {
+    return cpu->runIdleLoop();
+}
 
-            return 12;
-        }
-        case 0x05: case 0x15: case 0x25: {
-            //DEC r
-            u8* r = getRegisterFromEncoding(getHighNibble(opCode) * 2);
-            *r -= 1;
+// Runs one pass of a polling loop like a superinstruction would. If that brought it back to the
+// start with every register as it was, the next passes would read the same memory and do the same,
+// at least until Timer or PPU next change state, so as many as fit before then are skipped
+u8 CPU::runIdleLoop() {
+    const Block* block = blockCache.getCurrentBlock();
+    u16 quietCycles = std::min<u16>(getQuietCycles(), MAX_LOOP_CYCLES + 1);
+    u16 before[] = { u16((af & 0xFF00) | readFlags()), bc, de, hl, sp };
+
+    u8 cycles = opTable[block->ops[0].opCode](this);
+    for (size_t i = 1; i < block->ops.size(); i++) {
+        if (cycles >= quietCycles) {
+            return cycles;
+        }
+        const DecodedOp* decoded = blockCache.fetch(pc);
+        operand = decoded->operand;
+        pc += decoded->length;
+        cycles += opTable[decoded->opCode](this);
+    }
 
-            setHalfCarryFlag((*r & 0x0F) == 0x0F);
-            setSubtractFlag(true);
-            setZeroFlag(*r == 0);
+    u16 after[] = { u16((af & 0xFF00) | readFlags()), bc, de, hl, sp };
+    // Skipped passes would hide their reads from watchpoints
+    if (pc != block->start || memcmp(before, after, sizeof(before)) != 0 || cycles >= quietCycles || mmu->hasWatchpoints()) {
+        return cycles;
+    }
+    u16 passes = (quietCycles - 1) / cycles;
+    return passes * cycles;
+}
 
-            return 4;
-        }
-        case 0x35: {
-            //DEC (HL)
-            u8 value = mmu->read(hl);
-            mmu->write(hl, --value);
+template <size_t... indices, size_t... loops>
+constexpr std::array<CPU::OpHandler, IDLE_LOOP_FUSED> CPU::makeFusedTable(std::index_sequence<indices...>, std::index_sequence<loops...>) {
+    return {{ &CPU::dispatchFused<indices>..., &CPU::dispatchLoop<loops>..., &CPU::dispatchIdleLoop }};
+}
+
+template <u8 opCode>
+u8 CPU::dispatch(CPU* cpu) {
+    return cpu->op<opCode>();
+}
+
+template <u8 opCode>
+u8 CPU::dispatchCB(CPU* cpu) {
+    return cpu->opCB<opCode>();
+}
 
-            setHalfCarryFlag((value & 0x0F) == 0x0F);
-            setSubtractFlag(true);
-            setZeroFlag(value == 0);
+template <bool prefixCB, size_t... opCodes>
+constexpr std::array<CPU::OpHandler, 256> CPU::makeOpTable(std::index_sequence<opCodes...>) {
+    if constexpr (prefixCB) {
+        return {{ &CPU::dispatchCB<opCodes>... }};
+    } else {
+        return {{ &CPU::dispatch<opCodes>... }};
+    }
+}
 
+// Decoding helpers, only ever evaluated at compile time by the opcode templates
+// `r` is the 3-bit register encoding: B, C, D, E, H, L, (HL), A
+constexpr u8 highRegister(u8 opCode) { return (opCode >> 3) & 0x7; }
+constexpr u8 lowRegister(u8 opCode) { return opCode & 0x7; }
+constexpr bool isHLOperand(u8 encoding) { return encoding == 6; }
+
+template <u8 opCode>
+u8 CPU::op() {
+    if constexpr (opCode == 0x00) {
+        //NOP
+        return 4;
+    } else if constexpr (opCode == 0x10) {
+        //STOP
+        //TODO: Set some interrupt to pause execution until button press?
+        return 4;
+    } else if constexpr (opCode == 0x20) {
+        //JR NZ, r8 where r8 is signed
+        s8 nn = operand;
+        if (!readZeroFlag()) {
+            pc += nn;
             return 12;
         }
-        case 0x06: case 0x16: case 0x26: {
-            //LD r,d8
-            u8* r = getRegisterFromEncoding(getHighNibble(opCode) * 2);
-            *r = mmu->read(pc++);
-            return 8;
-        } 
-        case 0x36: {
-            //LD (HL),d8
-            mmu->write(hl, mmu->read(pc++));
+        return 8;
+    } else if constexpr (opCode == 0x30) {
+        //JR NC, r8 where r8 is signed
+        s8 nn = operand;
+        if (!readCarryFlag()) {
+            pc += nn;
             return 12;
         }
-        case 0x07: {
-            //RLCA
-            u8 a = getHighByte(af);
-            setHighByte(&af, op_rlc(a));
-            setZeroFlag(false);
-            return 4;
-        }
-        case 0x17: {
-            //RLA
-            u8 a = getHighByte(af);
-            setHighByte(&af, op_rl(a));
-            setZeroFlag(false);
-            return 4;
-        }
-        case 0x27: {
-            //DAA
-            // I had to read a blog post just so that I could
-            // understand this op code: https://ehaskins.com/2018-01-30%20Z80%20DAA/
-            u8 a = getHighByte(af);
-
-            u16 correction = 0;
-            if (readHalfCarryFlag() || (!readSubtractFlag() && ((a & 0xf) > 9))) {
-                correction |= 0x6;
-            }
-
-            if (readCarryFlag() || (!readSubtractFlag() && (a > 0x99))) {
-                correction |= 0x60;
-            }
-
-            if (readSubtractFlag()) {
-                a -= correction;
-            } else {
-                a += correction;
-            }
-            
-            if (((correction << 2) & 0x100) != 0) {
-                setCarryFlag(true);
-            }
-
-            setZeroFlag(a == 0);
-            setHalfCarryFlag(false);
-
-            setHighByte(&af, a);
-            return 4;
-        }
-        case 0x37: {
-            //SCF
+        return 8;
+    } else if constexpr (opCode == 0x01 || opCode == 0x11 || opCode == 0x21 || opCode == 0x31) {
+        //LD rr,d16
+        u16* rr = reg16<getHighNibble(opCode)>();
+        u16 n = operand;
+        *rr = n;
+        return 12;
+    } else if constexpr (opCode == 0x02 || opCode == 0x12) {
+        //LD (rr), A
+        u16* rr = reg16<getHighNibble(opCode)>();
+        u8 a = getHighByte(af);
+        mmu->write(*rr, a);
+        return 8;
+    } else if constexpr (opCode == 0x22) {
+        //LD (HL+), A
+        u8 a = getHighByte(af);
+        mmu->write(hl++, a);
+        return 8;
+    } else if constexpr (opCode == 0x32) {
+        //LD (HL-), A
+        u8 a = getHighByte(af);
+        mmu->write(hl--, a);
+        return 8;
+    } else if constexpr (opCode == 0x03 || opCode == 0x13 || opCode == 0x23 || opCode == 0x33) {
+        //INC rr
+        u16* rr = reg16<getHighNibble(opCode)>();
+        *rr += 1;
+        return 8;
+    } else if constexpr (opCode == 0x34) {
+        //INC (HL)
+        u8 value = mmu->read(hl);
+        mmu->write(hl, ++value);
+
+        setFlags(incFlagTable[value] | flagBits(false, false, false, readCarryFlag()));
+
+        return 12;
+    } else if constexpr ((opCode & 0xC7) == 0x04) {
+        //INC r
+        u8* r = reg<highRegister(opCode)>();
+        *r += 1;
+
+        setFlags(incFlagTable[*r] | flagBits(false, false, false, readCarryFlag()));
+
+        return 4;
+    } else if constexpr (opCode == 0x35) {
+        //DEC (HL)
+        u8 value = mmu->read(hl);
+        mmu->write(hl, --value);
+
+        setFlags(decFlagTable[value] | flagBits(false, false, false, readCarryFlag()));
+
+        return 12;
+    } else if constexpr ((opCode & 0xC7) == 0x05) {
+        //DEC r
+        u8* r = reg<highRegister(opCode)>();
+        *r -= 1;
+
+        setFlags(decFlagTable[*r] | flagBits(false, false, false, readCarryFlag()));
+
+        return 4;
+    } else if constexpr (opCode == 0x36) {
+        //LD (HL),d8
+        mmu->write(hl, operand);
+        return 12;
+    } else if constexpr ((opCode & 0xC7) == 0x06) {
+        //LD r,d8
+        u8* r = reg<highRegister(opCode)>();
+        *r = operand;
+        return 8;
+    } else if constexpr (opCode == 0x07) {
+        //RLCA
+        u8 a = getHighByte(af);
+        setHighByte(&af, op_rlc(a));
+        setZeroFlag(false);
+        return 4;
+    } else if constexpr (opCode == 0x17) {
+        //RLA
+        u8 a = getHighByte(af);
+        setHighByte(&af, op_rl(a));
+        setZeroFlag(false);
+        return 4;
+    } else if constexpr (opCode == 0x27) {
+        //DAA
+        // I had to read a blog post just so that I could
+        // understand this op code: https://ehaskins.com/2018-01-30%20Z80%20DAA/
+        u8 a = getHighByte(af);
+
+        u16 correction = 0;
+        if (readHalfCarryFlag() || (!readSubtractFlag() && ((a & 0xf) > 9))) {
+            correction |= 0x6;
+        }
+
+        if (readCarryFlag() || (!readSubtractFlag() && (a > 0x99))) {
+            correction |= 0x60;
+        }
+
+        if (readSubtractFlag()) {
+            a -= correction;
+        } else {
+            a += correction;
+        }
+        
+        if (((correction << 2) & 0x100) != 0) {
             setCarryFlag(true);
-            setHalfCarryFlag(false);
-            setSubtractFlag(false);
-
-            return 4;
         }
-        case 0x08: {
-            //LD (a16),SP
-            u16 immediate_address = mmu->read16Bit(pc++);
-            pc++;
-            mmu->write(immediate_address, getLowByte(sp));
-            mmu->write(immediate_address + 1, getHighByte(sp));
 
-            return 20;
-        }
-        case 0x18: {
-            //JR r8 where r8 is signed
-            s8 nn = mmu->read(pc++);
-            pc += nn;
+        setZeroFlag(a == 0);
+        setHalfCarryFlag(false);
+
+        setHighByte(&af, a);
+        return 4;
+    } else if constexpr (opCode == 0x37) {
+        //SCF
+        setFlags(flagBits(readZeroFlag(), false, false, true));
 
+        return 4;
+    } else if constexpr (opCode == 0x08) {
+        //LD (a16),SP
+        u16 immediate_address = operand;
+        mmu->write(immediate_address, getLowByte(sp));
+        mmu->write(immediate_address + 1, getHighByte(sp));
+
+        return 20;
+    } else if constexpr (opCode == 0x18) {
+        //JR r8 where r8 is signed
+        s8 nn = operand;
+        pc += nn;
+
+        return 12;
+    } else if constexpr (opCode == 0x28) {
+        //JR Z, r8 where r8 is signed
+        s8 nn = operand;
+        if (readZeroFlag()) {
+            pc += nn;
             return 12;
         }
-        case 0x28: {
-            //JR Z, r8 where r8 is signed
-            s8 nn = mmu->read(pc++); //always read r8 to consume entire op code
-            if (readZeroFlag()) {
-                pc += nn;
-                return 12;
-            }
-            return 8;
-        }
-        case 0x38: {
-            //JR C, r8 where r8 is signed
-            s8 nn = mmu->read(pc++); //always read r8 to consume entire op code
-            if (readCarryFlag()) {
-                pc += nn;
-                return 12;
-            }
-            return 8;
-        }
-        case 0x09: case 0x19: case 0x29: case 0x39: {
-            //ADD HL, rr
-            u16* rr = get16BitRegisterFromEncoding(getHighNibble(opCode));
-            u32 untruncated_result = hl + *rr;
-            u16 result = (u16) untruncated_result;
-
-            //TODO: Iffy on the 16bit half-carry logic here
-            setCarryFlag(untruncated_result > 0xFFFF);
-            setHalfCarryFlag((hl & 0xFFF) + (*rr & 0xFFF) > 0xFFF);
-            setSubtractFlag(false);
-
-            hl = result;
-            return 8;
-        }
-        case 0x0A: case 0x1A: {
-            //LD A, (rr)
-            u16* rr = get16BitRegisterFromEncoding(getHighNibble(opCode));
-            u8 value = mmu->read(*rr);
-            setHighByte(&af, value);
-            return 8;
-        }
-        case 0x2A: {
-            //LD A, (HL+)
-            u8 value = mmu->read(hl++);
-            setHighByte(&af, value);
-            return 8;
-        }
-        case 0x3A: {
-            //LD A, (HL-)
-            u8 value = mmu->read(hl--);
-            setHighByte(&af, value);
-            return 8;
+        return 8;
+    } else if constexpr (opCode == 0x38) {
+        //JR C, r8 where r8 is signed
+        s8 nn = operand;
+        if (readCarryFlag()) {
+            pc += nn;
+            return 12;
         }
-        case 0x0B: case 0x1B: case 0x2B: case 0x3B: {
-            //DEC rr
-            u16* rr = get16BitRegisterFromEncoding(getHighNibble(opCode));
-            *rr -= 1;
+        return 8;
+    } else if constexpr (opCode == 0x09 || opCode == 0x19 || opCode == 0x29 || opCode == 0x39) {
+        //ADD HL, rr
+        u16* rr = reg16<getHighNibble(opCode)>();
+        u32 untruncated_result = hl + *rr;
+        u16 result = (u16) untruncated_result;
+
+        //TODO: Iffy on the 16bit half-carry logic here
+        setFlags(flagBits(readZeroFlag(), false, (hl & 0xFFF) + (*rr & 0xFFF) > 0xFFF, untruncated_result > 0xFFFF));
+
+        hl = result;
+        return 8;
+    } else if constexpr (opCode == 0x0A || opCode == 0x1A) {
+        //LD A, (rr)
+        u16* rr = reg16<getHighNibble(opCode)>();
+        u8 value = mmu->read(*rr);
+        setHighByte(&af, value);
+        return 8;
+    } else if constexpr (opCode == 0x2A) {
+        //LD A, (HL+)
+        u8 value = mmu->read(hl++);
+        setHighByte(&af, value);
+        return 8;
+    } else if constexpr (opCode == 0x3A) {
+        //LD A, (HL-)
+        u8 value = mmu->read(hl--);
+        setHighByte(&af, value);
+        return 8;
+    } else if constexpr (opCode == 0x0B || opCode == 0x1B || opCode == 0x2B || opCode == 0x3B) {
+        //DEC rr
+        u16* rr = reg16<getHighNibble(opCode)>();
+        *rr -= 1;
+        return 8;
+    } else if constexpr (opCode == 0x0F) {
+        //RRCA
+        u8 a = getHighByte(af);
+        setHighByte(&af, op_rrc(a));
+        setZeroFlag(false);
+        return 4;
+    } else if constexpr (opCode == 0x1F) {
+        //RRA
+        u8 a = getHighByte(af);
+        setHighByte(&af, op_rr(a));
+        setZeroFlag(false);
+        return 4;
+    } else if constexpr (opCode == 0x2F) {
+        //CPL (complement)
+        u8 a = getHighByte(af);
+        setHighByte(&af, ~a);
+        setFlags(flagBits(readZeroFlag(), true, true, readCarryFlag()));
+        return 4;
+    } else if constexpr (opCode == 0x3F) {
+        //CCF
+        setFlags(flagBits(readZeroFlag(), false, false, !readCarryFlag()));
+        return 4;
+    } else if constexpr (opCode == 0x76) {
+        //HALT
+        //TODO: Suspend until an interrupt occurs
+        halted = interrupts->getIME();
+        // halted = ime || There is a flag set for an interrupt and also an interrupt enabled in the register
+        // (i.e. an action is flagged and enabled. This causes the execution to stop to allow for that action
+        // until it is completed and the disable interrupt dude is called...)
+        return 4;
+    } else if constexpr (opCode >= 0x40 && opCode <= 0x7F && isHLOperand(lowRegister(opCode))) {
+        //LD r1, (HL)
+        u8* r1 = reg<highRegister(opCode)>();
+        u8 value = mmu->read(hl);
+        *r1 = value;
+        
+        return 8;
+    } else if constexpr (opCode >= 0x70 && opCode <= 0x77) {
+        //LD (HL), r1
+        u8 *r1 = reg<lowRegister(opCode)>();
+        mmu->write(hl, *r1);
+
+        return 8;
+    } else if constexpr (opCode >= 0x40 && opCode <= 0x7F) {
+        //LD r1,r2
+        u8 *r1 = reg<highRegister(opCode)>();
+        u8 *r2 = reg<lowRegister(opCode)>();
+        *r1 = *r2;
+        
+        return 4;
+    } else if constexpr (opCode >= 0x80 && opCode <= 0xBF) {
+        //ALU A,r / ALU A,(HL): ADD, ADC, SUB, SBC, AND, XOR, OR, CP
+        u8 value;
+        if constexpr (isHLOperand(lowRegister(opCode))) {
+            value = mmu->read(hl);
+        } else {
+            value = *reg<lowRegister(opCode)>();
+        }
+        u8 a = getHighByte(af);
+        constexpr u8 operation = highRegister(opCode);
+        if constexpr (operation == 0) {
+            setHighByte(&af, op_add(a, value));
+        } else if constexpr (operation == 1) {
+            setHighByte(&af, op_adc(a, value));
+        } else if constexpr (operation == 2) {
+            setHighByte(&af, op_sub(a, value));
+        } else if constexpr (operation == 3) {
+            setHighByte(&af, op_sbc(a, value));
+        } else if constexpr (operation == 4) {
+            setHighByte(&af, op_and(a, value));
+        } else if constexpr (operation == 5) {
+            setHighByte(&af, op_xor(a, value));
+        } else if constexpr (operation == 6) {
+            setHighByte(&af, op_or(a, value));
+        } else {
+            op_cp(a, value);
+        }
+        return isHLOperand(lowRegister(opCode)) ? 8 : 4;
+    } else if constexpr (opCode == 0xFE) {
+        //CP d8
+        u8 n = operand;
+        u8 a = getHighByte(af);
+        op_cp(a, n);
+
+        return 8;
+    } else if constexpr (opCode == 0xE2) {
+        //LD (C),A same as LD($FF00+C),A
+        mmu->write(getLowByte(bc) + 0xFF00, getHighByte(af));
+        return 8;
+    } else if constexpr (opCode == 0xC5 || opCode == 0xD5 || opCode == 0xE5) {
+        //PUSH rr
+        u16* rr = reg16<getHighNibble(opCode)>();
+        pushToStack(*rr);
+        return 16;
+    } else if constexpr (opCode == 0xF5) {
+        //PUSH AF
+        resolveFlags();
+        pushToStack(af);
+        return 16;
+    } else if constexpr (opCode == 0xC1 || opCode == 0xD1 || opCode == 0xE1) {
+        //POP rr
+        u16* rr = reg16<getHighNibble(opCode)>();
+        *rr = popFromStack();
+        return 12;
+    } else if constexpr (opCode == 0xF1) {
+        //POP AF
+        // Bottom 4 bits of F are static 0b0000
+        af = popFromStack() & 0xFFF0;
+        flagSource = FLAGS_IN_F;
+        return 12;
+    } else if constexpr (opCode == 0xC0) {
+        //RET NZ
+        if (!readZeroFlag()) {
+            pc = popFromStack();
+            return 20;
+        } else {
             return 8;
         }
-        case 0x0C: case 0x1C: case 0x2C: case 0x3C: {
-            //INC r
-            u8* r = getRegisterFromEncoding(getHighNibble(opCode) * 2 + 1);
-            *r += 1;
+    } else if constexpr (opCode == 0xC2) {
+        //JP NZ, a16
 
-            setHalfCarryFlag((*r & 0x0F) == 0x00);
-            setSubtractFlag(false);
-            setZeroFlag(*r == 0);
+        u16 nn_nn = operand;
 
-            return 4;
+        if (!readZeroFlag()) {
+            pc = nn_nn;
+            return 16;
+        } else {
+            return 12;
         }
-        case 0x0D: case 0x1D: case 0x2D: case 0x3D: {
-            //DEC r
-            u8* r = getRegisterFromEncoding(getHighNibble(opCode) * 2 + 1);
-            *r -= 1;
-
-            setHalfCarryFlag((*r & 0x0F) == 0x0F);
-            setSubtractFlag(true);
-            setZeroFlag(*r == 0);
+    } else if constexpr (opCode == 0xC3) {
+        //JP a16
+        u16 nn_nn = operand;
+        pc = nn_nn;
+        return 16;
+    } else if constexpr (opCode == 0xC4) {
+        //CALL NZ, a16
+        u16 nn_nn = operand;
 
-            return 4;
-        }
-        case 0x0E: case 0x1E: case 0x2E: case 0x3E: {
-            //LD r, d8
-            u8* r = getRegisterFromEncoding(getHighNibble(opCode) * 2 + 1);
-            u8 immediate_value = mmu->read(pc++);
-            *r = immediate_value;
-            return 8;
-        }
-        case 0x0F: {
-            //RRCA
-            u8 a = getHighByte(af);
-            setHighByte(&af, op_rrc(a));
-            setZeroFlag(false);
-            return 4;
-        }
-        case 0x1F: {
-            //RRA
-            u8 a = getHighByte(af);
-            setHighByte(&af, op_rr(a));
-            setZeroFlag(false);
-            return 4;
-        }
-        case 0x2F: {
-            //CPL (complement)
-            u8 a = getHighByte(af);
-            setHighByte(&af, ~a);
-            setSubtractFlag(true);
-            setHalfCarryFlag(true);
-            return 4;
-        }
-        case 0x3F: {
-            //CCF
-            setCarryFlag(!readCarryFlag());
-            setHalfCarryFlag(false);
-            setSubtractFlag(false);
-            return 4;
+        if (!readZeroFlag()) {
+            pushToStack(pc);
+            pc = nn_nn;
+            return 24;
+        } else {
+            return 12;
         }
-        case 0xFE: {
-            //CP d8
-            u8 n = mmu->read(pc++);
-            u8 a = getHighByte(af);
-            op_cp(a, n);
+    } else if constexpr (opCode == 0xC6) {
+        //ADD A, d8
+        u8 n = operand;
+        u8 a = getHighByte(af);
+        u8 result = op_add(a, n);
+        setHighByte(&af, result);
 
+        return 8;
+    } else if constexpr ((opCode & 0xC7) == 0xC7) {
+        //RST 00H, 08H, 10H, 18H, 20H, 28H, 30H, 38H
+        pushToStack(pc);
+
+        u8 call_value = (opCode-0xC7);
+        pc = call_value;
+        return 16;
+    } else if constexpr (opCode == 0xC8) {
+        //RET Z
+        if (readZeroFlag()) {
+            pc = popFromStack();
+            return 20;
+        } else {
             return 8;
         }
-        case 0xE2: {
-            //LD (C),A same as LD($FF00+C),A
-            mmu->write(getLowByte(bc) + 0xFF00, getHighByte(af));
-            return 8;
-        }
-        case 0xC5: case 0xD5: case 0xE5: {
-            //PUSH rr
-            u16* rr = get16BitRegisterFromEncoding(getHighNibble(opCode));
-            pushToStack(*rr);
-            return 16;
-        }
-        case 0xF5: {
-            //PUSH AF
-            pushToStack(af);
+    } else if constexpr (opCode == 0xC9) {
+        //RET
+        pc = popFromStack();
+        return 16;
+    } else if constexpr (opCode == 0xCA) {
+        //JP Z, a16
+        u16 nn_nn = operand;
+
+        if (readZeroFlag()) {
+            pc = nn_nn;
             return 16;
-        }
-        case 0xC1: case 0xD1: case 0xE1: {
-            //POP rr
-            u16* rr = get16BitRegisterFromEncoding(getHighNibble(opCode));
-            *rr = popFromStack();
-            return 12;
-        } 
-        case 0xF1: {
-            //POP AF
-            // Bottom 4 bits of F are static 0b0000
-            af = popFromStack() & 0xFFF0;
+        } else {
             return 12;
         }
-        case 0x76: {
-            //HALT
-            //TODO: Suspend until an interrupt occurs
-            halted = ime;
-            // halted = ime || There is a flag set for an interrupt and also an interrupt enabled in the register
-            // (i.e. an action is flagged and enabled. This causes the execution to stop to allow for that action
-            // until it is completed and the disable interrupt dude is called...)
-            return 4;
-        }
-        case 0x46: case 0x4E: case 0x56: case 0x5E: 
-        case 0x66: case 0x6E: case 0x7E: {
-            //LD r1, (HL)
-            u8 encodedRegister = (opCode - 0x40) / 8;
-            u8* r1 = getRegisterFromEncoding(encodedRegister);
-            u8 value = mmu->read(hl);
-            *r1 = value;
-            
-            return 8;
-        }
-        case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x47:
-        case 0x48: case 0x49: case 0x4A: case 0x4B: case 0x4C: case 0x4D: case 0x4F:
-        case 0x50: case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x57:
-        case 0x58: case 0x59: case 0x5A: case 0x5B: case 0x5C: case 0x5D: case 0x5F:
-        case 0x60: case 0x61: case 0x62: case 0x63: case 0x64: case 0x65: case 0x67:
-        case 0x68: case 0x69: case 0x6A: case 0x6B: case 0x6C: case 0x6D: case 0x6F:
-        case 0x78: case 0x79: case 0x7A: case 0x7B: case 0x7C: case 0x7D: case 0x7F: {
-            //LD r1,r2
-            u8 *r1 = getRegisterFromEncoding((opCode - 0x40) / 8);
-            u8 *r2 = getRegisterFromEncoding(getLowNibble(opCode));
-            *r1 = *r2;
-            
-            return 4;
-        }
-        case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x77: {
-            //LD (HL), r1
-            u8 *r1 = getRegisterFromEncoding(getLowNibble(opCode));
-            mmu->write(hl, *r1);
+    } else if constexpr (opCode == 0xCB) {
+        //It's a prefix function
+        return execCB();
+    } else if constexpr (opCode == 0xCC) {
+        //CALL Z, a16
+        //check if zero flag is set
 
-            return 8;
-        }
-        case 0x86: {
-            //ADD A,(HL)
-            u8 value_at_hl = mmu->read(hl);
-            u8 a = getHighByte(af);
-            u8 result = op_add(a, value_at_hl);
-            setHighByte(&af, result);
-            return 8; 
-        }
-        case 0x80: case 0x81: case 0x82: case 0x83: case 0x84: case 0x85: case 0x87: {
-            //ADD A,r1
-            u8 *r1 = getRegisterFromEncoding(getLowNibble(opCode));
-            u8 a = getHighByte(af);
-            u8 result = op_add(a, *r1);
-            setHighByte(&af, result);
-            return 4;
-        }
-        case 0x8E: {
-            //ADC A, (HL)
-            u8 value_at_hl = mmu->read(hl);
-            u8 a = getHighByte(af);
-            u8 result = op_adc(a, value_at_hl);
-            setHighByte(&af, result);
-            return 8; 
-        }
-        case 0x88: case 0x89: case 0x8A: case 0x8B: case 0x8C: case 0x8D: case 0x8F: {
-            //ADC A, r1
-            u8 *r1 = getRegisterFromEncoding(getLowNibble(opCode));
-            u8 a = getHighByte(af);
-            u8 result = op_adc(a, *r1);
-            setHighByte(&af, result);
-            return 4;
-        }
-        case 0x96: {
-            //SUB (HL)
-            u8 value = mmu->read(hl);
-            u8 a = getHighByte(af);
-            u8 result = op_sub(a, value);
-            setHighByte(&af, result);
-            return 8;
-        }
-        case 0x90: case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x97: {
-            //SUB r
-            u8 *r = getRegisterFromEncoding(getLowNibble(opCode));
-            u8 a = getHighByte(af);
-            u8 result = op_sub(a, *r);
-            setHighByte(&af, result);
-            return 4;
-        }
-        case 0x9E: {
-            //SBC A,(HL)
-            u8 value = mmu->read(hl);
-            u8 a = getHighByte(af);
-            u8 result = op_sbc(a, value);
-            setHighByte(&af, result);
-            return 8;
-        }
-        case 0x98: case 0x99: case 0x9A: case 0x9B: case 0x9C: case 0x9D: case 0x9F: {
-            //SBC A,r
-            u8 *r = getRegisterFromEncoding(getLowNibble(opCode));
-            u8 a = getHighByte(af);
-            u8 result = op_sbc(a, *r);
-            setHighByte(&af, result);
-            return 4;
-        }
-        case 0xA6: {
-            //AND (HL)
-            u8 value = mmu->read(hl);
-            u8 a = getHighByte(af);
-            u8 result = op_and(a, value);
-            setHighByte(&af, result);
-            return 8;
-        }
-        case 0xA0: case 0xA1: case 0xA2: case 0xA3: case 0xA4: case 0xA5: case 0xA7: {
-            //AND r
-            u8 *r = getRegisterFromEncoding(getLowNibble(opCode));
-            u8 a = getHighByte(af);
-            u8 result = op_and(a, *r);
-            setHighByte(&af, result);
-            return 4;
-        }
-        case 0xAE: {
-            //XOR (HL)
-            u8 value = mmu->read(hl);
-            u8 a = getHighByte(af);
-            u8 result = op_xor(a, value);
-            setHighByte(&af, result);
-            return 8;
-        }
-        case 0xA8: case 0xA9: case 0xAA: case 0xAB: case 0xAC: case 0xAD: case 0xAF: {
-            //XOR r
-            u8 *r = getRegisterFromEncoding(getLowNibble(opCode));
-            u8 a = getHighByte(af);
-            u8 result = op_xor(a, *r);
-            setHighByte(&af, result);
-            return 4;
-        }
-        case 0xB6: {
-            //OR (HL)
-            u8 value = mmu->read(hl);
-            u8 a = getHighByte(af);
-            u8 result = op_or(a, value);
-            setHighByte(&af, result);
-            return 8;
-        }
-        case 0xB0: case 0xB1: case 0xB2: case 0xB3: case 0xB4: case 0xB5: case 0xB7: {
-            //OR r
-            u8 *r = getRegisterFromEncoding(getLowNibble(opCode));
-            u8 a = getHighByte(af);
-            u8 result = op_or(a, *r);
-            setHighByte(&af, result);
-            return 4;
+        u16 nn_nn = operand;
+
+        if (readZeroFlag()) {
+            pushToStack(pc);
+
+            pc = nn_nn;
+            return 24;
+        } else {
+            return 12;
         }
-        case 0xBE: {
-            //CP (HL)
-            u8 valueAtHL = mmu->read(hl);
-            u8 a = getHighByte(af);
-            op_cp(a, valueAtHL);
+    } else if constexpr (opCode == 0xCD) {
+        //CALL a16
+        u16 nn_nn = operand;
+        pushToStack(pc);
+        pc = nn_nn;
+        return 24; 
+    } else if constexpr (opCode == 0xCE) {
+        //ADC A, d8
+        u8 n = operand;
+        u8 a = getHighByte(af);
+        u8 result = op_adc(a, n);
+        setHighByte(&af, result);
+        return 4;
+    } else if constexpr (opCode == 0xD0) {
+        //RET NC
+        if (!readCarryFlag()){
+            pc = popFromStack();
+            return 20;
+        } else {
             return 8;
         }
-        case 0xB8: case 0xB9: case 0xBA: case 0xBB: case 0xBC: case 0xBD: case 0xBF: {
-            //CP r
-            u8 *r = getRegisterFromEncoding(getLowNibble(opCode));
-            u8 a = getHighByte(af);
-            op_cp(a, *r);
-            return 4;
-        }
-        case 0xC0: {
-            //RET NZ
-            if (!readZeroFlag()) {
-                pc = popFromStack();
-                return 20;
-            } else {
-                return 8;
-            }
-        }
-        case 0xC2: {
-            //JP NZ, a16
-
-            //PC NEEDS TO BE INCREMENTED TWICE ON 16 BIT READ
-            u16 nn_nn = mmu->read16Bit(pc++);
-            pc++;
-
-            if (!readZeroFlag()) {
-                pc = nn_nn;
-                return 16;
-            } else {
-                return 12;
-            }
-        }
-        case 0xC3: {
-            //JP a16
-            //PC NEEDS TO BE INCREMENTED TWICE ON 16 BIT READ
-            u16 nn_nn = mmu->read16Bit(pc++);
-            pc++;
+    } else if constexpr (opCode == 0xD2) {
+        //JP NC, a16
+        u16 nn_nn = operand;
+
+        if (!readCarryFlag()) {
             pc = nn_nn;
             return 16;
+        } else {
+            return 12;
         }
-        case 0xC4: {
-            //CALL NZ, a16
-            //PC NEEDS TO BE INCREMENTED TWICE ON 16 BIT READ
-            u16 nn_nn = mmu->read16Bit(pc++);
-            pc++;
-
-            if (!readZeroFlag()) {
-                pushToStack(pc);
-                pc = nn_nn;
-                return 24;
-            } else {
-                return 12;
-            }
-        }
-        case 0xC6: {
-            //ADD A, d8
-            u8 n = mmu->read(pc++);
-            u8 a = getHighByte(af);
-            u8 result = op_add(a, n);
-            setHighByte(&af, result);
+    } else if constexpr (opCode == 0xD4) {
+        //CALL NC, a16
+        u16 nn_nn = operand;
 
-            return 8;
-        }
-        case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: {
-            //RST 00H, 08H, 10H, 18H, 20H, 28H, 30H, 38H
+        if (!readCarryFlag()) {
             pushToStack(pc);
 
-            u8 call_value = (opCode-0xC7);
-            pc = call_value;
-            return 16;
-        }
-        case 0xC8: {
-            //RET Z
-            if (readZeroFlag()) {
-                pc = popFromStack();
-                return 20;
-            } else {
-                return 8;
-            }
-        }
-        case 0xC9: {
-            //RET
-            pc = popFromStack();
-            return 16;
-        }
-        case 0xCA: {
-            //JP Z, a16
-            //PC NEEDS TO BE INCREMENTED TWICE ON 16 BIT READ
-            u16 nn_nn = mmu->read16Bit(pc++);
-            pc++;
-
-            if (readZeroFlag()) {
-                pc = nn_nn;
-                return 16;
-            } else {
-                return 12;
-            }
-        }
-        case 0xCB: {
-            //It's a prefix function
-            return execCB();
-        }
-        case 0xCC: {
-            //CALL Z, a16
-            //check if zero flag is set
-
-            //PC NEEDS TO BE INCREMENTED TWICE ON 16 BIT READ
-            u16 nn_nn = mmu->read16Bit(pc++);
-            pc++;
-
-            if (readZeroFlag()) {
-                pushToStack(pc);
-
-                pc = nn_nn;
-                return 24;
-            } else {
-                return 12;
-            }
-        }
-        case 0xCD: {
-            //CALL a16
-            u16 nn_nn = mmu->read16Bit(pc++);
-            pc++;
-            pushToStack(pc);
             pc = nn_nn;
-            return 24; 
-        }
-        case 0xCE: {
-            //ADC A, d8
-            u8 n = mmu->read(pc++);
-            u8 a = getHighByte(af);
-            u8 result = op_adc(a, n);
-            setHighByte(&af, result);
-            return 4;
-        }
-        case 0xD0: {
-            //RET NC
-            if (!readCarryFlag()){
-                pc = popFromStack();
-                return 20;
-            } else {
-                return 8;
-            }
-        }
-        case 0xD2: {
-            //JP NC, a16
-            //PC NEEDS TO BE INCREMENTED TWICE ON 16 BIT READ
-            u16 nn_nn = mmu->read16Bit(pc++);
-            pc++;
-
-            if (!readCarryFlag()) {
-                pc = nn_nn;
-                return 16;
-            } else {
-                return 12;
-            }
-        }
-        case 0xD4: {
-            //CALL NC, a16
-            //PC NEEDS TO BE INCREMENTED TWICE ON 16 BIT READ
-            u16 nn_nn = mmu->read16Bit(pc++);
-            pc++;
-
-            if (!readCarryFlag()) {
-                pushToStack(pc);
-
-                pc = nn_nn;
-                return 24;
-            } else {
-                return 12;
-            }
-        }
-        case 0xD6: {
-            //SUB d8
-            u8 n = mmu->read(pc++);
-            u8 a = getHighByte(af);
-            u8 result = op_sub(a, n);
-            setHighByte(&af, result);
-            return 4;
-        }
-        case 0xD8: {
-            //RET C
-            if (readCarryFlag()) {
-                pc = popFromStack();
-                return 20;
-            } else {
-                return 8;
-            }
+            return 24;
+        } else {
+            return 12;
         }
-        case 0xD9: {
-            //RETI
-            //return, PC=(SP), SP=SP+2
+    } else if constexpr (opCode == 0xD6) {
+        //SUB d8
+        u8 n = operand;
+        u8 a = getHighByte(af);
+        u8 result = op_sub(a, n);
+        setHighByte(&af, result);
+        return 4;
+    } else if constexpr (opCode == 0xD8) {
+        //RET C
+        if (readCarryFlag()) {
             pc = popFromStack();
-            ime = true;
-            return 16;
-        }
-        case 0xDA: {
-            //JP C, a16
-            //PC NEEDS TO BE INCREMENTED TWICE ON 16 BIT READ
-            u16 nn_nn = mmu->read16Bit(pc++);
-            pc++;
-
-            if (readCarryFlag()) {
-                pc = nn_nn;
-                return 16;
-            } else {
-                return 12;
-            }
-        }
-        case 0xDC: {
-            //CALL C, a16
-            //check if carry flag is set and jump if so
-
-            //PC NEEDS TO BE INCREMENTED TWICE ON 16 BIT READ
-            u16 nn_nn = mmu->read16Bit(pc++);
-            pc++;
-
-            if (readCarryFlag()) {
-                pushToStack(pc);
-                pc = nn_nn;
-                return 24;
-            } else {
-                return 12;
-            }
-        }
-        case 0xDE: {
-            //SBC A, d8
-            //A=A-n-cy
-            u8 value = mmu->read(pc++);
-            u8 a = getHighByte(af);
-            u8 result = op_sbc(a, value);
-            setHighByte(&af, result);
+            return 20;
+        } else {
             return 8;
         }
-        case 0xE0: {
-            //LDH (a8), A aka LD ($FF00+a8), A
-            u8 input = mmu->read(pc++);
-            mmu->write(0xFF00 + input, getHighByte(af));
+    } else if constexpr (opCode == 0xD9) {
+        //RETI
+        //return, PC=(SP), SP=SP+2
+        pc = popFromStack();
+        interrupts->setIME(true);
+        return 16;
+    } else if constexpr (opCode == 0xDA) {
+        //JP C, a16
+        u16 nn_nn = operand;
+
+        if (readCarryFlag()) {
+            pc = nn_nn;
+            return 16;
+        } else {
             return 12;
         }
-        case 0xE6: {
-            //AND d8
-            u8 n = mmu->read(pc++);
-            u8 a = getHighByte(af);
-            setHighByte(&af, op_and(a, n));
-            return 8;
-        }
-        case 0xE8: {
-            //ADD SP, r8 (16bit addition!)
-            u16 old_sp = sp;
-            s8 num = mmu->read(pc++);
-            sp = sp + num;
-
-            setZeroFlag(false);
-            setSubtractFlag(false);
-            setCarryFlag((bool)(((sp &  0xFF) < (old_sp & 0xFF) | (sp &  0xFF) < num) << 4));
-            setHalfCarryFlag((bool)((((old_sp & 0x0F) + (num & 0x0F)) > 0x0F) << 5));
+    } else if constexpr (opCode == 0xDC) {
+        //CALL C, a16
+        //check if carry flag is set and jump if so
 
-            return 16;
-        }
-        case 0xE9: {
-            //JP HL
-            //jump to HL, PC=HL
-            pc = hl;
-            return 4;
-        }
-        case 0xEA: {
-            //LD (a16), A
-            u16 addressToWrite = mmu->read16Bit(pc++);
-            pc++;
+        u16 nn_nn = operand;
 
-            mmu->write(addressToWrite, getHighByte(af));
-            return 16;
-        }
-        case 0xEE: {
-            //XOR d8
-            //A=A xor n
-            u8 n = mmu->read(pc++);
-            setHighByte(&af, op_xor(getHighByte(af), n));
-            return 8;
-        }
-        case 0xF0: {
-            //LDH A, (a8) aka LD A, ($FF00+a8)
-            u8 input = mmu->read(pc++);
-            setHighByte(&af, (mmu->read(0xFF00+input)));
+        if (readCarryFlag()) {
+            pushToStack(pc);
+            pc = nn_nn;
+            return 24;
+        } else {
             return 12;
         }
-        case 0xF2: {
-            //ld A,(FF00+C)
-            u8 c = getLowByte(bc);
-            setHighByte(&af, (mmu->read(0xFF00+c)));
-            return 8;
-        }
-        case 0xF3: {
-            //DI
-            ime = false;
-            return 4;
-        }
-        case 0xF6: {
-            //OR d8
-            u8 valueToOr = mmu->read(pc++);
+    } else if constexpr (opCode == 0xDE) {
+        //SBC A, d8
+        //A=A-n-cy
+        u8 value = operand;
+        u8 a = getHighByte(af);
+        u8 result = op_sbc(a, value);
+        setHighByte(&af, result);
+        return 8;
+    } else if constexpr (opCode == 0xE0) {
+        //LDH (a8), A aka LD ($FF00+a8), A
+        u8 input = operand;
+        mmu->write(0xFF00 + input, getHighByte(af));
+        return 12;
+    } else if constexpr (opCode == 0xE6) {
+        //AND d8
+        u8 n = operand;
+        u8 a = getHighByte(af);
+        setHighByte(&af, op_and(a, n));
+        return 8;
+    } else if constexpr (opCode == 0xE8) {
+        //ADD SP, r8 (16bit addition!)
+        u16 old_sp = sp;
+        s8 num = operand;
+        sp = sp + num;
+
+        bool carry = (bool)(((sp &  0xFF) < (old_sp & 0xFF) | (sp &  0xFF) < num) << 4);
+        bool halfCarry = (bool)((((old_sp & 0x0F) + (num & 0x0F)) > 0x0F) << 5);
+        setFlags(flagBits(false, false, halfCarry, carry));
+
+        return 16;
+    } else if constexpr (opCode == 0xE9) {
+        //JP HL
+        //jump to HL, PC=HL
+        pc = hl;
+        return 4;
+    } else if constexpr (opCode == 0xEA) {
+        //LD (a16), A
+        u16 addressToWrite = operand;
+
+        mmu->write(addressToWrite, getHighByte(af));
+        return 16;
+    } else if constexpr (opCode == 0xEE) {
+        //XOR d8
+        //A=A xor n
+        u8 n = operand;
+        setHighByte(&af, op_xor(getHighByte(af), n));
+        return 8;
+    } else if constexpr (opCode == 0xF0) {
+        //LDH A, (a8) aka LD A, ($FF00+a8)
+        u8 input = operand;
+        setHighByte(&af, (mmu->read(0xFF00+input)));
+        return 12;
+    } else if constexpr (opCode == 0xF2) {
+        //ld A,(FF00+C)
+        u8 c = getLowByte(bc);
+        setHighByte(&af, (mmu->read(0xFF00+c)));
+        return 8;
+    } else if constexpr (opCode == 0xF3) {
+        //DI
+        interrupts->setIME(false);
+        return 4;
+    } else if constexpr (opCode == 0xF6) {
+        //OR d8
+        u8 valueToOr = operand;
+
+        u8 a = getHighByte(af);
+        a = op_or(a, valueToOr);
+        setHighByte(&af, a);
+        return 8;
+    } else if constexpr (opCode == 0xF8) {
+        //LD HL, SP + r8, 16bit addition!
+        s8 num = operand;
+        hl = sp + num;
+
+        bool carry = (bool)(((hl &  0xFF) < (sp & 0xFF) | (hl &  0xFF) < num) << 4);
+        bool halfCarry = (bool)((((sp & 0x0F) + (num & 0x0F)) > 0x0F) << 5);
+        setFlags(flagBits(false, false, halfCarry, carry));
+        return 12;
+    } else if constexpr (opCode == 0xF9) {
+        //LD SP, HL
+        sp = hl;
+        return 8;
+    } else if constexpr (opCode == 0xFA) {
+        //LD A, (a16)
+        u16 address = operand;
+
+        u8 a = getHighByte(af);
+        a = mmu->read(address);
+        setHighByte(&af, a);
+        return 16;
+    } else if constexpr (opCode == 0xFB) {
+        //EI
+        interrupts->setIME(true);
+        return 4;
+    } else {
+        //D3, DB, DD, E3, E4, EB, EC, ED, F4, FC, FD
+        std::cout << "Attempted to execute illegal opcode: " << opCode << std::endl;
+        return 4;
+    }
+}
 
-            u8 a = getHighByte(af);
-            a = op_or(a, valueToOr);
-            setHighByte(&af, a);
-            return 8;
-        }
-        case 0xF8: {
-            //LD HL, SP + r8, 16bit addition!
-            s8 num = mmu->read(pc++);
-            hl = sp + num;
-
-            setZeroFlag(false);
-            setSubtractFlag(false);
-            setCarryFlag((bool)(((hl &  0xFF) < (sp & 0xFF) | (hl &  0xFF) < num) << 4));
-            setHalfCarryFlag((bool)((((sp & 0x0F) + (num & 0x0F)) > 0x0F) << 5));
-            return 12;
-        }
-        case 0xF9: {
-            //LD SP, HL
-            sp = hl;
-            return 8;
-        }
-        case 0xFA: {
-            //LD A, (a16)
-            //PC NEEDS TO BE INCREMENTED TWICE ON 16 BIT READ
-            u16 address = mmu->read16Bit(pc++);
-            pc++;
-
-            u8 a = getHighByte(af);
-            a = mmu->read(address);
-            setHighByte(&af, a);
-            return 16;
-        }
-        case 0xFB: {
-            //EI
-            ime = true;
-            return 4;
-        }
-        default: {
-            std::cout << "Attempted to execute illegal opcode: " << opCode << std::endl;
-        }
+template <u8 opCode>
+u8 CPU::opCB() {
+    // Every CB op is (operation, register). Only (HL) touches memory, and costs 16 instead of 8
+    constexpr u8 encoding = lowRegister(opCode);
+    u8 value;
+    if constexpr (isHLOperand(encoding)) {
+        value = mmu->read(hl);
+    } else {
+        value = *reg<encoding>();
     }
 
-    //return the number of cycles used. 
-    return 4;
+    if constexpr (opCode <= 0x07) {
+        //RLC r
+        value = op_rlc(value);
+    } else if constexpr (opCode <= 0x0F) {
+        //RRC r
+        value = op_rrc(value);
+    } else if constexpr (opCode <= 0x17) {
+        //RL r
+        value = op_rl(value);
+    } else if constexpr (opCode <= 0x1F) {
+        //RR r
+        value = op_rr(value);
+    } else if constexpr (opCode <= 0x27) {
+        //SLA r
+        u8 high_bit = readBit(value, 7);
+        value = (value << 1);
+
+        setFlags(flagBits(value == 0, false, false, high_bit));
+    } else if constexpr (opCode <= 0x2F) {
+        //SRA r
+        u8 low_bit = readBit(value, 0);
+        u8 high_bit = readBit(value, 7);
+        value = (value >> 1) | (high_bit << 7);
+
+        setFlags(flagBits(value == 0, false, false, low_bit));
+    } else if constexpr (opCode <= 0x37) {
+        //SWAP r
+        value = ((value & 0x0F) << 4 | (value & 0xF0) >> 4);
+
+        setFlags(flagBits(value == 0, false, false, false));
+    } else if constexpr (opCode <= 0x3F) {
+        //SRL r
+        u8 low_bit = readBit(value, 0);
+        value = value >> 1;
+
+        setFlags(flagBits(value == 0, false, false, low_bit));
+    } else if constexpr (opCode <= 0x7F) {
+        //BIT n, r
+        constexpr u8 index = (opCode - 0x40) / 8;
+
+        setFlags(flagBits(readBit(value, index) == 0, false, true, readCarryFlag()));
+        // BIT only reads its operand
+        return isHLOperand(encoding) ? 16 : 8;
+    } else if constexpr (opCode <= 0xBF) {
+        //RES n, r
+        constexpr u8 index = (opCode - 0x80) / 8;
+        value = clearBit(value, index);
+    } else {
+        //SET n, r
+        constexpr u8 index = (opCode - 0xC0) / 8;
+        value = setBit(value, index);
+    }
+
+    if constexpr (isHLOperand(encoding)) {
+        mmu->write(hl, value);
+        return 16;
+    } else {
+        *reg<encoding>() = value;
+        return 8;
+    }
 }
 
-// Helpers
-inline u8 CPU::execCB() {
-    u8 opCode = mmu->read(pc++);
-    switch (opCode) {
-        case 0x06: {
-            //RLC (HL)
-            u8 value = mmu->read(hl);
-            value = op_rlc(value);
-            mmu->write(hl, value);
-            return 16;
-        }
-        case 0x00: case 0x01: case 0x02: case 0x03: case 0x04: case 0x05: case 0x07: {
-            //RLC r
-            u8* r = getRegisterFromEncoding(getLowNibble(opCode));
-            *r = op_rlc(*r);
-            return 8;
-        }
-        case 0x0E: {
-            //RRC (HL)
-            u8 value = mmu->read(hl);
-            value = op_rrc(value);
-            mmu->write(hl, value);
-            return 16;
-        }
-        case 0x08: case 0x09: case 0x0A: case 0x0B: case 0x0C: case 0x0D: case 0x0F: {
-            //RRC r
-            u8* r = getRegisterFromEncoding(getLowNibble(opCode));
-            *r = op_rrc(*r);
-            return 8;
-        }
-        case 0x16: {
-            //RL (HL)
-            u8 value = mmu->read(hl);
-            value = op_rl(value);
-            mmu->write(hl, value);
-            return 16;
-        }
-        case 0x10: case 0x11: case 0x12: case 0x13: case 0x14: case 0x15: case 0x17: {
-            //RL r
-            u8* r = getRegisterFromEncoding(getLowNibble(opCode));
-            *r = op_rl(*r);
-            return 8;
-        }
-        case 0x1E: {
-            //RR (HL)
-            u8 value = mmu->read(hl);
-            value = op_rr(value);
-            mmu->write(hl, value);
-            return 16;
-        }
-        case 0x18: case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D: case 0x1F: {
-            //RR r
-            u8* r = getRegisterFromEncoding(getLowNibble(opCode));
-            *r = op_rr(*r);
-            return 8;
-        }
-        case 0x26: {
-            //SLA (HL)
-            u8 value = mmu->read(hl);
-            u8 high_bit = readBit(value, 7);
-            value = (value << 1);
-            mmu->write(hl, value);
-
-            setCarryFlag(high_bit);
-            setHalfCarryFlag(false);
-            setSubtractFlag(false);
-            setZeroFlag(value == 0);
-            return 16;
-        }
-        case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25: case 0x27: {
-            //SLA r
-            u8* r = getRegisterFromEncoding(getLowNibble(opCode));
-            u8 high_bit = readBit(*r, 7);
-            *r = *r << 1;
-            
-            setCarryFlag(high_bit);
-            setHalfCarryFlag(false);
-            setSubtractFlag(false);
-            setZeroFlag(*r == 0);
-            return 8;
-        }
-        case 0x2E: {
-            //SRA (HL)
-            u8 value = mmu->read(hl);
-            u8 low_bit = readBit(value, 0);
-            u8 high_bit = readBit(value, 7);
-            value = (value >> 1) | (high_bit << 7);
-            mmu->write(hl, value);
-
-            setCarryFlag(low_bit);
-            setHalfCarryFlag(false);
-            setSubtractFlag(false);
-            setZeroFlag(value == 0);
-            return 16;
-        }
-        case 0x28: case 0x29: case 0x2A: case 0x2B: case 0x2C: case 0x2D: case 0x2F: {
-            //SRA r
-            u8* r = getRegisterFromEncoding(getLowNibble(opCode));
-            u8 low_bit = readBit(*r, 0);
-            u8 high_bit = readBit(*r, 7);
-            *r = (*r >> 1) | (high_bit << 7);
-            
-            setCarryFlag(low_bit);
-            setHalfCarryFlag(false);
-            setSubtractFlag(false);
-            setZeroFlag(*r == 0);
-            return 8;
-        }
-        case 0x36: {
-            //SWAP (HL)
-            u8 value = mmu->read(hl);
-            value = ((value & 0x0F) << 4 | (value & 0xF0) >> 4);
-            mmu->write(hl, value);
-
-            setCarryFlag(false);
-            setHalfCarryFlag(false);
-            setSubtractFlag(false);
-            setZeroFlag(value == 0);
-            return 16;
-        }
-        case 0x30: case 0x31: case 0x32: case 0x33: case 0x34: case 0x35: case 0x37: {
-            //SWAP r
-            u8* r = getRegisterFromEncoding(getLowNibble(opCode));
-            *r = ((*r & 0x0F) << 4 | (*r & 0xF0) >> 4);
-
-            setCarryFlag(false);
-            setHalfCarryFlag(false);
-            setSubtractFlag(false);
-            setZeroFlag(*r == 0);
-            return 8;
-        }
-        case 0x3E: {
-            //SRL (HL)
-            u8 value = mmu->read(hl);
-            u8 low_bit = readBit(value, 0);
-            value = value >> 1;
-            mmu->write(hl, value);
-
-            setCarryFlag(low_bit);
-            setHalfCarryFlag(false);
-            setSubtractFlag(false);
-            setZeroFlag(value == 0);
-            return 16;
-        }
-        case 0x38: case 0x39: case 0x3A: case 0x3B: case 0x3C: case 0x3D: case 0x3F: {
-            //SRL r
-            u8* r = getRegisterFromEncoding(getLowNibble(opCode));
-            u8 low_bit = readBit(*r, 0);
-            *r = *r >> 1;
-            
-            setCarryFlag(low_bit);
-            setHalfCarryFlag(false);
-            setSubtractFlag(false);
-            setZeroFlag(*r == 0);
-            return 8;
-        }
-        case 0x46: case 0x4E: case 0x56: case 0x5E: 
-        case 0x66: case 0x6E: case 0x76: case 0x7E: {
-            //BIT n, (HL)
-            u8 index = (opCode - 0x40) / 8;
-            u8 value = mmu->read(hl);
-
-            setHalfCarryFlag(true);
-            setSubtractFlag(false);
-            setZeroFlag(readBit(value, index) == 0);
-            return 16;
-        }
-        case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x47:
-        case 0x48: case 0x49: case 0x4A: case 0x4B: case 0x4C: case 0x4D: case 0x4F:
-        case 0x50: case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x57:
-        case 0x58: case 0x59: case 0x5A: case 0x5B: case 0x5C: case 0x5D: case 0x5F:
-        case 0x60: case 0x61: case 0x62: case 0x63: case 0x64: case 0x65: case 0x67:
-        case 0x68: case 0x69: case 0x6A: case 0x6B: case 0x6C: case 0x6D: case 0x6F:
-        case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x77:
-        case 0x78: case 0x79: case 0x7A: case 0x7B: case 0x7C: case 0x7D: case 0x7F: {
-            //BIT n, r
-            u8 index = (opCode - 0x40) / 8;
-            u8* r = getRegisterFromEncoding(getLowNibble(opCode));
-
-            setHalfCarryFlag(true);
-            setSubtractFlag(false);
-            setZeroFlag(readBit(*r, index) == 0);
-            return 8;
-        }
-        case 0x86: case 0x8E: case 0x96: case 0x9E: 
-        case 0xA6: case 0xAE: case 0xB6: case 0xBE: {
-            //RES n, (HL)
-            u8 index = (opCode - 0x80) / 8;
-            u8 value = mmu->read(hl);
-            value = clearBit(value, index);
-            mmu->write(hl, value);
-            return 16;
-        }
-        case 0x80: case 0x81: case 0x82: case 0x83: case 0x84: case 0x85: case 0x87:
-        case 0x88: case 0x89: case 0x8A: case 0x8B: case 0x8C: case 0x8D: case 0x8F:
-        case 0x90: case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x97:
-        case 0x98: case 0x99: case 0x9A: case 0x9B: case 0x9C: case 0x9D: case 0x9F:
-        case 0xA0: case 0xA1: case 0xA2: case 0xA3: case 0xA4: case 0xA5: case 0xA7:
-        case 0xA8: case 0xA9: case 0xAA: case 0xAB: case 0xAC: case 0xAD: case 0xAF:
-        case 0xB0: case 0xB1: case 0xB2: case 0xB3: case 0xB4: case 0xB5: case 0xB7:
-        case 0xB8: case 0xB9: case 0xBA: case 0xBB: case 0xBC: case 0xBD: case 0xBF: {
-            //RES n, r
-            u8 index = (opCode - 0x80) / 8;
-            u8* r = getRegisterFromEncoding(getLowNibble(opCode));
-            *r = clearBit(*r, index);
-            return 8;
-        }
-        case 0xC6: case 0xCE: case 0xD6: case 0xDE: 
-        case 0xE6: case 0xEE: case 0xF6: case 0xFE: {
-            //SET n, (HL)
-            u8 index = (opCode - 0xC0) / 8;
-            u8 value = mmu->read(hl);
-            value = setBit(value, index);
-            mmu->write(hl, value);
-            return 16;
+const std::array<CPU::OpHandler, 256> CPU::opTable = CPU::makeOpTable<false>(std::make_index_sequence<256>());
+const std::array<CPU::OpHandler, 256> CPU::cbTable = CPU::makeOpTable<true>(std::make_index_sequence<256>());
+const std::array<CPU::OpHandler, IDLE_LOOP_FUSED> CPU::fusedTable = CPU::makeFusedTable(std::make_index_sequence<SUPERINSTRUCTION_COUNT>(), std::make_index_sequence<LOOP_KERNEL_COUNT>());
+
+void CPU::setDevices(Timer* timer, PPU* ppu) {
+    this->timer = timer;
+    this->ppu = ppu;
+}
+
+u16 CPU::getQuietCycles() {
+    if (timer == nullptr || ppu == nullptr) {
+        return 0;
+    }
+    u16 cycles = std::min({ timer->getCyclesUntilChange(), ppu->getCyclesUntilChange(), cycleBudget });
+    return cycles > lagCycles ? cycles - lagCycles : 0;
+}
+
+// How long a copy or fill loop can run ahead of Timer and PPU without being able to tell. They may
+// change state meanwhile, as long as no interrupt the CPU would take gets requested and, if the loop
+// touches VRAM or OAM, the PPU stays in the same mode. `PPU::step` makes at most one mode change per
+// call, so no more than one may be crossed: every mode lasts at least `OAM_CLOCKS`
+u16 CPU::getLoopWindow(bool touchesVideoMemory) {
+    if (timer == nullptr || ppu == nullptr) {
+        return 0;
+    }
+    u8 enabled = interrupts->getIME() ? interrupts->readIE() : 0;
+    u32 cycles = ppu->getCyclesUntilChange();
+    bool ppuInterrupts = enabled & ((1 << VBLANK_INT) | (1 << LCD_STAT));
+    if (cycles > 0 && !touchesVideoMemory && !ppuInterrupts) {
+        cycles += OAM_CLOCKS - 1;
+    }
+    if (enabled & (1 << TIMER)) {
+        cycles = std::min<u32>(cycles, timer->getCyclesUntilOverflow());
+    }
+    cycles = std::min<u32>(cycles, cycleBudget + 1u);
+    return cycles > lagCycles ? cycles - lagCycles : 0;
+}
+
+// Longest HALT in one `step`, a multiple of 4
+const u8 MAX_HALT_CYCLES = 0xFC;
+
+// Only an interrupt ends a HALT, and only Timer and PPU can request one meanwhile. Skip ahead to the
+// 4-cycle step in which the first one the CPU would take gets requested, or the budget runs out.
+// Like loop kernels, at most one PPU mode change may be crossed
+u8 CPU::getHaltCycles() {
+    u16 ppuCycles = ppu != nullptr ? ppu->getCyclesUntilChange() : 0;
+    if (timer == nullptr || ppuCycles == 0) {
+        return 4;
+    }
+    u8 enabled = interrupts->readIE();
+    u32 wake = cycleBudget;
+    if (enabled & ((1 << VBLANK_INT) | (1 << LCD_STAT))) {
+        wake = std::min<u32>(wake, ppuCycles);
+    }
+    if (enabled & (1 << TIMER)) {
+        wake = std::min<u32>(wake, timer->getCyclesUntilOverflow());
+    }
+    u32 cycles = std::min<u32>((wake + 3) & ~3u, (ppuCycles + OAM_CLOCKS - 1) & ~3u);
+    return std::clamp<u32>(cycles, 4, MAX_HALT_CYCLES);
+}
+
+bool CPU::isVideoMemory(u16 address) {
+    return (address >= 0x8000 && address <= 0x9FFF) || (address >= 0xFE00 && address <= 0xFE9F);
+}
+
+void CPU::enableSequenceProfile() {
+    if (sequenceProfile == nullptr) {
+        sequenceProfile = new SequenceProfile();
+    }
+    blockCache.setFusion(false);
+}
+
+// Only cached ops in one block can be fused, so a run is broken by anything that ends a block,
+// by a jump or interrupt landing elsewhere, and by code the block cache doesn't cover
+void CPU::recordSequence(u16 start, u8 opCode) {
+    SequenceProfile& profile = *sequenceProfile;
+    profile.instructions++;
+    if (start != profile.nextPc) {
+        profile.run = 0;
+    }
+    bool follows = canFollowInSuperinstruction(opCode);
+    if (follows && profile.run >= 1) {
+        profile.counts[(2 << 24) | (opCode << 8) | profile.previous[1]]++;
+    }
+    if (follows && profile.run >= 2) {
+        profile.counts[(3 << 24) | (opCode << 16) | (profile.previous[1] << 8) | profile.previous[0]]++;
+    }
+
+    if (canLeadSuperinstruction(opCode)) {
+        profile.previous[0] = profile.previous[1];
+        profile.previous[1] = opCode;
+        profile.run = follows ? std::min(profile.run + 1, 2) : 1;
+    } else {
+        profile.run = 0;
+    }
+    profile.nextPc = start + OPCODES[opCode].length;
+}
+
+void CPU::printSequenceProfile() {
+    if (sequenceProfile == nullptr || sequenceProfile->instructions == 0) {
+        return;
+    }
+    // A sequence of n ops run as one saves n - 1 dispatches each time
+    std::vector<std::pair<u64, u32>> ranked;
+    for (auto& [key, count] : sequenceProfile->counts) {
+        ranked.push_back({ count * ((key >> 24) - 1), key });
+    }
+    std::sort(ranked.begin(), ranked.end(), std::greater<>());
+
+    printf("%llu instructions. Sequences by dispatches saved if fused:\n", (unsigned long long)sequenceProfile->instructions);
+    for (size_t i = 0; i < ranked.size() && i < 20; i++) {
+        u32 key = ranked[i].second;
+        u8 count = key >> 24;
+        printf("  { %d, { ", count);
+        for (u8 j = 0; j < count; j++) {
+            printf(j + 1 < count ? "0x%02X, " : "0x%02X } }, //", (key >> (8 * j)) & 0xFF);
         }
-        case 0xC0: case 0xC1: case 0xC2: case 0xC3: case 0xC4: case 0xC5: case 0xC7:
-        case 0xC8: case 0xC9: case 0xCA: case 0xCB: case 0xCC: case 0xCD: case 0xCF:
-        case 0xD0: case 0xD1: case 0xD2: case 0xD3: case 0xD4: case 0xD5: case 0xD7:
-        case 0xD8: case 0xD9: case 0xDA: case 0xDB: case 0xDC: case 0xDD: case 0xDF:
-        case 0xE0: case 0xE1: case 0xE2: case 0xE3: case 0xE4: case 0xE5: case 0xE7:
-        case 0xE8: case 0xE9: case 0xEA: case 0xEB: case 0xEC: case 0xED: case 0xEF:
-        case 0xF0: case 0xF1: case 0xF2: case 0xF3: case 0xF4: case 0xF5: case 0xF7:
-        case 0xF8: case 0xF9: case 0xFA: case 0xFB: case 0xFC: case 0xFD: case 0xFF: {
-            //SET n, r
-            u8 index = (opCode - 0xC0) / 8;
-            u8* r = getRegisterFromEncoding(getLowNibble(opCode));
-            *r = setBit(*r, index);
-            return 8;
+        for (u8 j = 0; j < count; j++) {
+            printf(j + 1 < count ? "%s ; " : "%s", OPCODES[(key >> (8 * j)) & 0xFF].mnemonic);
         }
+        printf("  %.1f%%\n", 100.0 * ranked[i].first / sequenceProfile->instructions);
     }
-    return -1; // should be unreachable
 }
 
+// Helpers
+// ADD/ADC/SUB/SBC/CP only record their operands. Most of the time the flags are
+// overwritten before anything looks at them, so they're computed on demand instead
 inline u8 CPU::op_add(u8 reg, u8 value) {
-    u16 untruncated_result = reg + value;
-    u8 result = (u8) untruncated_result;
-    
-    setCarryFlag(untruncated_result > 0xFF);
-    setHalfCarryFlag(((reg & 0xF) + (value & 0xF)) & 0x10);
-    setSubtractFlag(false);
-    setZeroFlag(result == 0);
+    flagSource = FLAGS_ADD;
+    flagLhs = reg;
+    flagRhs = value;
+    flagCarryIn = 0;
 
-    return result;
+    return reg + value;
 }
 inline u8 CPU::op_adc(u8 reg, u8 value) {
-    u16 untruncated_result = reg + value + readCarryFlag();
-    u8 result = (u8) untruncated_result;
+    u8 carry = readCarryFlag();
+    flagSource = FLAGS_ADD;
+    flagLhs = reg;
+    flagRhs = value;
+    flagCarryIn = carry;
 
-    setHalfCarryFlag(((reg & 0xF) + (value & 0xF) + readCarryFlag()) & 0x10);
-    setCarryFlag(untruncated_result > 0xFF);
-    setSubtractFlag(false);
-    setZeroFlag(result == 0);
-
-    return result;
+    return reg + value + carry;
 }
 inline u8 CPU::op_sub(u8 reg, u8 value) {
-    u8 result = reg - value;
+    flagSource = FLAGS_SUB;
+    flagLhs = reg;
+    flagRhs = value;
+    flagCarryIn = 0;
 
-    setCarryFlag(reg < value); //went negative
-    setHalfCarryFlag(((reg & 0xF) - (value & 0xF)) & 0x10);
-    setSubtractFlag(true);
-    setZeroFlag(result == 0);
-
-    return result;
+    return reg - value;
 }
 inline u8 CPU::op_sbc(u8 reg, u8 value) {
-    u8 result = reg - value - readCarryFlag();
-
-    setHalfCarryFlag(((reg & 0xF) - (value & 0xF) - readCarryFlag()) & 0x10);
-    setCarryFlag(reg < value + readCarryFlag()); //went negative
-    setSubtractFlag(true);
-    setZeroFlag(result == 0);
+    u8 carry = readCarryFlag();
+    flagSource = FLAGS_SUB;
+    flagLhs = reg;
+    flagRhs = value;
+    flagCarryIn = carry;
 
-    return result;
+    return reg - value - carry;
 }
 inline u8 CPU::op_and(u8 reg, u8 value) {
     u8 result = reg & value;
 
-    setCarryFlag(false);
-    setHalfCarryFlag(true);
-    setSubtractFlag(false);
-    setZeroFlag(result == 0);
+    setFlags(flagBits(result == 0, false, true, false));
 
     return result;
 }
 inline u8 CPU::op_xor(u8 reg, u8 value) {
     u8 result = reg ^ value;
 
-    setCarryFlag(false);
-    setHalfCarryFlag(false);
-    setSubtractFlag(false);
-    setZeroFlag(result == 0);
+    setFlags(flagBits(result == 0, false, false, false));
 
     return result;
 }
 inline u8 CPU::op_or(u8 reg, u8 value) {
     u8 result = reg | value;
 
-    setCarryFlag(false);
-    setHalfCarryFlag(false);
-    setSubtractFlag(false);
-    setZeroFlag(result == 0);
+    setFlags(flagBits(result == 0, false, false, false));
 
     return result;
 }
 inline void CPU::op_cp(u8 reg, u8 value) {
-    setSubtractFlag(true);
-    setZeroFlag(reg == value);
-    setHalfCarryFlag(((reg & 0xF) - (value & 0xF)) & 0x10);
-    setCarryFlag(reg < value);
+    op_sub(reg, value);
 }
 
 inline u8 CPU::op_rlc(u8 reg) {
     u8 high_bit = readBit(reg, 7);
     u8 result = (reg << 1) | high_bit;
     
-    setCarryFlag(high_bit);
-    setHalfCarryFlag(false);
-    setSubtractFlag(false);
-    setZeroFlag(result == 0);
+    setFlags(flagBits(result == 0, false, false, high_bit));
     
     return result;
 }
@@ -1284,10 +1263,7 @@ inline u8 CPU::op_rl(u8 reg) {
     u8 high_bit = readBit(reg, 7);
     u8 result = (reg << 1) | carry_flag;
     
-    setCarryFlag(high_bit);
-    setHalfCarryFlag(false);
-    setSubtractFlag(false);
-    setZeroFlag(result == 0);
+    setFlags(flagBits(result == 0, false, false, high_bit));
 
     return result;
 }
@@ -1295,10 +1271,7 @@ inline u8 CPU::op_rrc(u8 reg) {
     u8 low_bit = readBit(reg, 0);
     u8 result = (reg >> 1) | (low_bit << 7);
     
-    setCarryFlag(low_bit);
-    setHalfCarryFlag(false);
-    setSubtractFlag(false);
-    setZeroFlag(result == 0);
+    setFlags(flagBits(result == 0, false, false, low_bit));
 
     return result;
 }
@@ -1307,10 +1280,7 @@ inline u8 CPU::op_rr(u8 reg) {
     u8 low_bit = readBit(reg, 0);
     u8 result = (reg >> 1) | (carry_flag << 7);
     
-    setCarryFlag(low_bit);
-    setHalfCarryFlag(false);
-    setSubtractFlag(false);
-    setZeroFlag(result == 0);
+    setFlags(flagBits(result == 0, false, false, low_bit));
 
     return result;
 }
@@ -1326,63 +1296,117 @@ inline u16 CPU::popFromStack() {
     return value;
 }
 
+// F as it would be if every flag had been written eagerly
+inline u8 CPU::readFlags() {
+    switch (flagSource) {
+        case FLAGS_ADD: {
+            u16 untruncated_result = flagLhs + flagRhs + flagCarryIn;
+            bool halfCarry = ((flagLhs & 0xF) + (flagRhs & 0xF) + flagCarryIn) & 0x10;
+            return flagBits((u8)untruncated_result == 0, false, halfCarry, untruncated_result > 0xFF);
+        }
+        case FLAGS_SUB: {
+            u8 result = flagLhs - flagRhs - flagCarryIn;
+            bool halfCarry = ((flagLhs & 0xF) - (flagRhs & 0xF) - flagCarryIn) & 0x10;
+            return flagBits(result == 0, true, halfCarry, flagLhs < flagRhs + flagCarryIn);
+        }
+        default:
+            return getLowByte(af);
+    }
+}
+// Fold a pending lazy result into `af` before F is modified or read directly
+inline void CPU::resolveFlags() {
+    if (flagSource != FLAGS_IN_F) {
+        setFlags(readFlags());
+    }
+}
+void CPU::resolveFlagsOf(CPU* cpu) {
+    cpu->resolveFlags();
+}
+// Replaces all of F in one store
+inline void CPU::setFlags(u8 flags) {
+    af = (af & 0xFF00) | flags;
+    flagSource = FLAGS_IN_F;
+}
+
 inline void CPU::setCarryFlag(bool value) {
+    resolveFlags();
     af = changeIthBitToX(af, carry_flag_index, value);
 }
 inline void CPU::setHalfCarryFlag(bool value) {
+    resolveFlags();
     af = changeIthBitToX(af, half_carry_flag_index, value);
 }
 inline void CPU::setSubtractFlag(bool value) {
+    resolveFlags();
     af = changeIthBitToX(af, subtraction_flag_index, value);
 }
 inline void CPU::setZeroFlag(bool value) {
+    resolveFlags();
     af = changeIthBitToX(af, zero_flag_index, value);
 }
 
 inline bool CPU::readCarryFlag() {
-    return readBit(af, carry_flag_index);
+    switch (flagSource) {
+        case FLAGS_ADD:
+            return flagLhs + flagRhs + flagCarryIn > 0xFF;
+        case FLAGS_SUB:
+            return flagLhs < flagRhs + flagCarryIn;
+        default:
+            return readBit(af, carry_flag_index);
+    }
 }
 inline bool CPU::readHalfCarryFlag() {
-    return readBit(af, half_carry_flag_index);
+    return readBit(readFlags(), half_carry_flag_index);
 }
 inline bool CPU::readSubtractFlag() {
-    return readBit(af, subtraction_flag_index);
+    switch (flagSource) {
+        case FLAGS_ADD:
+            return false;
+        case FLAGS_SUB:
+            return true;
+        default:
+            return readBit(af, subtraction_flag_index);
+    }
 }
 inline bool CPU::readZeroFlag() {
-    return readBit(af, zero_flag_index);
+    switch (flagSource) {
+        case FLAGS_ADD:
+            return (u8)(flagLhs + flagRhs + flagCarryIn) == 0;
+        case FLAGS_SUB:
+            return (u8)(flagLhs - flagRhs - flagCarryIn) == 0;
+        default:
+            return readBit(af, zero_flag_index);
+    }
 }
 
-inline u8* CPU::getRegisterFromEncoding(u8 nibble) {
-    switch (nibble % 8) {
-        case 0: // b
-            return ((u8*)&bc) + 1;
-        case 1: // c
-            return ((u8*)&bc);
-        case 2: // d
-            return ((u8*)&de) + 1;
-        case 3: // e
-            return ((u8*)&de);
-        case 4: // h
-            return ((u8*)&hl) + 1;
-        case 5: // l
-        case 6: // hl
-            return ((u8*)&hl);
-        case 7: // a
-            return ((u8*)&af) + 1;
+template <u8 encoding>
+inline u8* CPU::reg() {
+    if constexpr (encoding % 8 == 0) { // b
+        return ((u8*)&bc) + 1;
+    } else if constexpr (encoding % 8 == 1) { // c
+        return ((u8*)&bc);
+    } else if constexpr (encoding % 8 == 2) { // d
+        return ((u8*)&de) + 1;
+    } else if constexpr (encoding % 8 == 3) { // e
+        return ((u8*)&de);
+    } else if constexpr (encoding % 8 == 4) { // h
+        return ((u8*)&hl) + 1;
+    } else if constexpr (encoding % 8 == 5 || encoding % 8 == 6) { // l, hl
+        return ((u8*)&hl);
+    } else { // a
+        return ((u8*)&af) + 1;
     }
-    return 0; // should be unreachable
 }
 
-inline u16* CPU::get16BitRegisterFromEncoding(u8 nibble) {
-    switch (nibble % 4) {
-        case 0: // BC
-            return &bc;
-        case 1: // DE
-            return &de;
-        case 2: // HL
-            return &hl;
-        case 3: // SP
-            return &sp;
+template <u8 encoding>
+inline u16* CPU::reg16() {
+    if constexpr (encoding % 4 == 0) { // BC
+        return &bc;
+    } else if constexpr (encoding % 4 == 1) { // DE
+        return &de;
+    } else if constexpr (encoding % 4 == 2) { // HL
+        return &hl;
+    } else { // SP
+        return &sp;
     }
-    return 0; // should be unreachable
-}
\ No newline at end of file
+}
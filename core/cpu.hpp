@@ -1,21 +1,22 @@
 #pragma once
 
+#include <array>
+#include <unordered_map>
+#include <utility>
 #include "./mmu.hpp"
+#include "./blockcache.hpp"
+#include "./idleloops.hpp"
+#include "./interrupts.hpp"
+#include "./superinstructions.hpp"
 #include "./util.hpp"
 
-enum Interrupt {
-  VBLANK_INT   = 0, //avoid conflict with Mode::VBLANK
-  LCD_STAT = 1,
-  TIMER    = 2,
-  SERIAL   = 3,
-  INPUT    = 4, //ie JOYPAD
-  NONE     = -1,
-};
+class Timer;
+class PPU;
 
 class CPU {
 public: 
   // At construction time, `exec` the boot rom
-  CPU(MMU* mmu);
+  CPU(MMU* mmu, InterruptController* interrupts);
   
   // Ultimately, `step()` should return the number of cycles required to completely execute the op code
   // that we processed this step. But timing is not mission critical at the moment, so you can just 
@@ -25,16 +26,47 @@ public:
   // CPU's 4Mhz clock as a reference and some use cycles based on the MMU's 1MHz clock. For our purposes, 
   // we're using cycles based the MMU's lower clock (which is what the above link uses), so some instructions take as many
   // as 24 cycles to complete
-  u8 step();
+  // `cycleBudget` is how many more cycles the caller means to run before it stops stepping. Work the CPU
+  // batches up (superinstructions, copy loops, HALT) never runs past where single steps would have stopped
+  u8 step(int cycleBudget = 0xFFFF);
+
+  // Steps until `cycleBudget` runs out or Timer or PPU could next change state, then brings them up
+  // to date in one go. Returns the cycles run. Same result as `step` followed by stepping both devices
+  int run(int cycleBudget);
+  // Called by the MMU before an I/O register is written in the middle of `run`
+  void syncDevices();
+
+  // Breakpoints are kept in `blockCache`. While armed, `run` stops just before the instruction at one,
+  // and the next armed `run` starts by executing it. Unarmed they cost one branch per instruction
+  void addBreakpoint(u16 bank, u16 address);
+  void removeBreakpoint(u16 bank, u16 address);
+  void armBreakpoints(bool armed);
+  bool stoppedAtBreakpoint() { return stopped; }
 
   // Rely on the `pc` for the exec location
   u8 exec();
 
   u8 handleInterrupts();
-  void requestInterrupt(Interrupt interrupt);
-  void acknowledgeInterrupt(Interrupt interrupt);
+
+  // Where the instruction being run starts, and how many cycles had been run before it. For watchpoints
+  u16 getInstructionPc() { return instructionPc; }
+  u64 getCycleCount() { return cycleCount; }
+  const u64* getCycleCounter() { return &cycleCount; }
+
+  // Superinstructions only run ahead of the Timer and PPU while neither would notice. Until this is called they never do
+  void setDevices(Timer* timer, PPU* ppu);
+
+  // Count the op sequences that could be fused, with superinstructions turned off so every op is seen
+  void enableSequenceProfile();
+  // Lists the sequences that would save the most dispatches, ready to paste into `SUPERINSTRUCTIONS`
+  void printSequenceProfile();
  private:
+  // The JIT compiles blocks against the registers and opcode handlers directly
+  friend class JIT;
+
   MMU* mmu;
+  // Holds IME along with IE and IF
+  InterruptController* interrupts;
   // Registers
 
   // Registers are sometimes combined into 16-bit registers. First register is the high-byte.
@@ -46,16 +78,90 @@ public:
   // `sp` is stack pointer, `pc` is program counter
   u16 sp, pc;
 
-  // IME is the Interrupt Master Enable flag
-  bool ime = false;
   bool halted = false;
-  Interrupt checkInterrupts();
+  u16 instructionPc = 0;
+  u64 cycleCount = 0;
+
+  bool breakpointsArmed = false;
+  bool stopped = false;
+  bool resuming = false; //the CPU may go on past the breakpoint at `stoppedPc`
+  u16 stoppedPc = 0;
   u16 getInterruptVector(Interrupt interrupt);
 
   bool logMode = false;
 
   u8 execCB();
 
+  // Decoded ahead of time by `blockCache` where possible; the operand of the op being executed
+  BlockCache blockCache;
+  u16 operand = 0;
+
+  // One handler per opcode, generated from the `op`/`opCB` templates with all register
+  // operands resolved at compile time. `exec` and `execCB` dispatch through these tables.
+  using OpHandler = u8 (*)(CPU* cpu);
+  static const std::array<OpHandler, 256> opTable;
+  static const std::array<OpHandler, 256> cbTable;
+
+  template <bool prefixCB, size_t... opCodes>
+  static constexpr std::array<OpHandler, 256> makeOpTable(std::index_sequence<opCodes...>);
+  template <u8 opCode> static u8 dispatch(CPU* cpu);
+  template <u8 opCode> static u8 dispatchCB(CPU* cpu);
+  template <u8 opCode> u8 op();
+  template <u8 opCode> u8 opCB();
+
+  // One handler per entry in `SUPERINSTRUCTIONS`, running its ops back to back,
+  // followed by one per entry in `LOOP_KERNELS`, running whole passes of the loop, and the idle loop handler
+  static const std::array<OpHandler, IDLE_LOOP_FUSED> fusedTable;
+  template <size_t... indices, size_t... loops>
+  static constexpr std::array<OpHandler, IDLE_LOOP_FUSED> makeFusedTable(std::index_sequence<indices...>, std::index_sequence<loops...>);
+  template <size_t index> static u8 dispatchFused(CPU* cpu);
+  template <u8 opCode> bool execFused(u8& cycles, u16 quietCycles);
+  template <size_t index> static u8 dispatchLoop(CPU* cpu);
+  template <size_t index> u8 runLoop();
+  static u8 dispatchIdleLoop(CPU* cpu);
+  u8 runIdleLoop();
+  u16 getQuietCycles();
+  u16 getLoopWindow(bool touchesVideoMemory);
+  bool isVideoMemory(u16 address);
+  Timer* timer = nullptr;
+  PPU* ppu = nullptr;
+  // Cycles run that Timer and PPU haven't seen yet, and the part of them from before the current step
+  u16 lagCycles = 0;
+  u16 stepStartLag = 0;
+  bool batchEnded = false; //by `syncDevices` or a breakpoint
+  // The caller's budget, counted from where Timer and PPU are
+  u16 cycleBudget = 0xFFFF;
+  u8 stepInBatch();
+  u8 getHaltCycles();
+
+  struct SequenceProfile {
+    u64 instructions = 0;
+    u8 previous[2] = {};
+    u8 run = 0; //how many of `previous` lead straight into the current op
+    u16 nextPc = 0;
+    std::unordered_map<u32, u64> counts; //keyed by the op codes, first one in the lowest byte, and the length in the top byte
+  };
+  SequenceProfile* sequenceProfile = nullptr;
+  void recordSequence(u16 start, u8 opCode);
+
+  // Flags are evaluated lazily: ADD/ADC/SUB/SBC/CP just record their operands, and
+  // Z/N/H/C are derived from them when read. `af` only holds F when `FLAGS_IN_F`
+  enum FlagSource : u8 {
+    FLAGS_IN_F,
+    FLAGS_ADD,
+    FLAGS_SUB,
+  };
+  FlagSource flagSource = FLAGS_IN_F;
+  u8 flagLhs = 0;
+  u8 flagRhs = 0;
+  u8 flagCarryIn = 0;
+
+  u8 readFlags();
+  void resolveFlags();
+  void setFlags(u8 flags);
+  // Out of line for the JIT, which keeps F resolved in a host register
+  static void resolveFlagsOf(CPU* cpu);
+
   void setCarryFlag(bool value);
   void setHalfCarryFlag(bool value);
   void setSubtractFlag(bool value);
@@ -83,8 +189,8 @@ public:
   bool readSubtractFlag();
   bool readZeroFlag();
 
-  u8* getRegisterFromEncoding(u8 nibble);
-  u16* get16BitRegisterFromEncoding(u8 nibble);
+  template <u8 encoding> u8* reg();
+  template <u8 encoding> u16* reg16();
 
   // TODO: Like 200 op-codes and stack management functions, too
   // Op codes: pg. 65, http://marc.rawer.de/Gameboy/Docs/GBCPUman.pdf
@@ -1,27 +1,104 @@
 #include "./gameboy.hpp"
 
-const int CYCLES_PER_STEP = 69905;
-
 
 GameBoy::GameBoy(u8* boot_rom, Cartridge* cartridge) : 
   cartridge(cartridge),
   input(new Input()), 
-  mmu(new MMU(cartridge, input, boot_rom)),
-  cpu(new CPU(mmu)),
-  timer(new Timer(mmu, cpu)) {
+  interrupts(new InterruptController()),
+  mmu(new MMU(cartridge, input, interrupts, boot_rom)),
+  cpu(new CPU(mmu, interrupts)),
+  timer(new Timer(mmu, interrupts)) {
     paletteSwapper = new PaletteSwapper();
-    ppu = new PPU(mmu, cpu, paletteSwapper->getNextPalette());
+    ppu = new PPU(mmu, interrupts, paletteSwapper->getNextPalette());
+    cpu->setDevices(timer, ppu);
+    cartridge->setCycleCounter(cpu->getCycleCounter());
+    ramGeneration = mmu->nextGeneration();
   }
 
 void GameBoy::step() {
-  int cyclesThisStep = 0;
+  if (jit != nullptr) {
+    jit->run(CYCLES_PER_STEP);
+  } else {
+    int cyclesThisStep = 0;
+
+    while (cyclesThisStep < CYCLES_PER_STEP) {
+      cyclesThisStep += cpu->run(CYCLES_PER_STEP - cyclesThisStep);
+    }
+  }
+  checkRamWritten();
+}
+
+// Once a frame rather than on every write, so the save file's lock stays off the write path. Switching
+// RAM banks or enabling RAM stamps the RAM pages too, which at worst saves unchanged RAM
+void GameBoy::checkRamWritten() {
+  for (u16 page = 0xA0; page <= 0xBF; page++) {
+    if (mmu->getPageGeneration(page) >= ramGeneration) {
+      cartridge->ramWritten();
+      break;
+    }
+  }
+  ramGeneration = mmu->nextGeneration();
+}
 
-  while (cyclesThisStep < CYCLES_PER_STEP) {
-    int cycles = cpu->step();
-    cyclesThisStep += cycles;
-    timer->step(cycles);
-    ppu->step(cycles);
+bool GameBoy::enableJit() {
+  if (!JIT::isSupported()) {
+    printf("ERROR :: JIT is not supported on this platform, using the interpreter\n");
+    return false;
   }
+  if (jit == nullptr) {
+    jit = new JIT(cpu, timer, ppu);
+  }
+  return jit->enableCompiler();
+}
+
+bool GameBoy::loadRecompiledModule(const char* path) {
+  const AotModule* module = loadAotModule(path);
+  if (module == nullptr) {
+    return false;
+  }
+  if (jit == nullptr) {
+    jit = new JIT(cpu, timer, ppu);
+  }
+  return jit->useModule(module);
+}
+
+void GameBoy::enableSequenceProfile() {
+  cpu->enableSequenceProfile();
+}
+
+void GameBoy::printSequenceProfile() {
+  cpu->printSequenceProfile();
+}
+
+u32 GameBoy::addWatchpoint(Watchpoint watchpoint) {
+  return mmu->addWatchpoint(watchpoint);
+}
+
+void GameBoy::removeWatchpoint(u32 id) {
+  mmu->removeWatchpoint(id);
+}
+
+void GameBoy::addBreakpoint(u16 bank, u16 address) {
+  cpu->addBreakpoint(bank, address);
+}
+
+void GameBoy::removeBreakpoint(u16 bank, u16 address) {
+  cpu->removeBreakpoint(bank, address);
+}
+
+u64 GameBoy::runUntilBreakpoint(u64 maxCycles) {
+  u64 cycles = 0;
+  cpu->armBreakpoints(true);
+  do {
+    cycles += cpu->run(std::min<u64>(maxCycles - cycles, CYCLES_PER_STEP));
+    checkRamWritten();
+  } while (cycles < maxCycles && !cpu->stoppedAtBreakpoint());
+  cpu->armBreakpoints(false);
+  return cycles;
+}
+
+bool GameBoy::stoppedAtBreakpoint() {
+  return cpu->stoppedAtBreakpoint();
 }
 
 u8* GameBoy::getFrameBuffer() {
@@ -3,10 +3,14 @@
 #include "./util.hpp"
 #include "./cartridge.hpp"
 #include "./input.hpp"
+#include "./interrupts.hpp"
 #include "./mmu.hpp"
 #include "./cpu.hpp"
 #include "./timer.hpp"
 #include "./ppu.hpp"
+#include "./jit.hpp"
+
+const int CYCLES_PER_STEP = 69905; //one frame
 
 class GameBoy {
 public:
@@ -14,6 +18,26 @@ public:
 
   void step();
 
+  // Run the CPU through the JIT instead of the interpreter. Returns false if the host can't
+  bool enableJit();
+  // Run blocks from a module built by tools/recompile for this cartridge. Returns false if it can't be used
+  bool loadRecompiledModule(const char* path);
+  // Count which opcode sequences the interpreter runs, for choosing superinstructions. Printed by `printSequenceProfile`
+  void enableSequenceProfile();
+  void printSequenceProfile();
+  // See `MMU::addWatchpoint`
+  u32 addWatchpoint(Watchpoint watchpoint);
+  void removeWatchpoint(u32 id);
+
+  // Stop `runUntilBreakpoint` just before the instruction at `address` runs with `bank` mapped (bank only
+  // matters for 0x4000-0x7FFF). `step` ignores them
+  void addBreakpoint(u16 bank, u16 address);
+  void removeBreakpoint(u16 bank, u16 address);
+  // Runs the interpreter, even with the JIT enabled, until a breakpoint or `maxCycles`. Returns the cycles run.
+  // Calling it again after a breakpoint carries on from there
+  u64 runUntilBreakpoint(u64 maxCycles);
+  bool stoppedAtBreakpoint();
+
   u8* getFrameBuffer();
   const char* getTitle(); 
 
@@ -24,9 +48,14 @@ public:
 private:
   Cartridge* cartridge;
   Input* input;
+  InterruptController* interrupts;
 	MMU* mmu;
 	CPU* cpu;
 	Timer* timer;
 	PPU* ppu;
   PaletteSwapper* paletteSwapper;
+  JIT* jit = nullptr;
+
+  u32 ramGeneration;
+  void checkRamWritten();
 };
\ No newline at end of file
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "./opcodes.hpp"
+#include "./superinstructions.hpp"
+#include "./util.hpp"
+
+// Busy-wait loops, like `LDH A,(LY) ; CP $90 ; JR NZ`, that poll memory until Timer, PPU or an
+// interrupt handler changes it. A block is one if it ends in a conditional JR back to its start and
+// every other op only loads A from memory or tests A. The CPU runs a pass, and if that left every
+// register as it found them it skips the passes that would follow until Timer or PPU next change state.
+// Reads have no side effects and nothing else writes memory meanwhile, so those passes are all alike
+inline constexpr u8 MAX_IDLE_LOOP_OPS = 8;
+
+// `DecodedOp::fused` value marking the first op of an idle loop, after the superinstructions and loop kernels
+inline constexpr u8 IDLE_LOOP_FUSED = SUPERINSTRUCTION_COUNT + LOOP_KERNEL_COUNT + 1;
+
+// Loops the detector doesn't recognise, by cartridge title. The block starting at `address` (in
+// `bank`, for 0x4000-0x7FFF) may then contain any op that doesn't write memory or change IME.
+// Only list loops whose reads are free of side effects; the CPU still checks every pass is alike
+struct IdleLoopHint {
+  const char* title;
+  u16 bank;
+  u16 address;
+};
+
+inline constexpr IdleLoopHint IDLE_LOOP_HINTS[] = {
+  //{ "TITLE", 1, 0x4123 }, //what the loop waits for
+  { nullptr, 0, 0 },
+};
+
+// `operand` is the prefixed opcode for 0xCB
+constexpr bool isPollOp(u8 opCode, u16 operand) {
+  switch (opCode) {
+    case 0xF0: //LDH A,(a8)
+    case 0xF2: //LD A,(C)
+    case 0xFA: //LD A,(a16)
+    case 0x0A: //LD A,(BC)
+    case 0x1A: //LD A,(DE)
+    case 0x7E: //LD A,(HL)
+    case 0xFE: //CP d8
+    case 0xE6: //AND d8
+    case 0xF6: //OR d8
+    case 0xEE: //XOR d8
+    case 0xA7: //AND A
+    case 0xB7: //OR A
+      return true;
+    case 0xCB: //BIT n,A
+      return operand >= 0x40 && operand <= 0x7F && (operand & 0x7) == 0x7;
+    default:
+      return opCode >= 0xB8 && opCode <= 0xBF && opCode != 0xBE; //CP r
+  }
+}
+
+// What a hinted loop may contain besides its final JR. Ops that move SP or change other registers
+// pass this, but then no pass leaves the registers as it found them, so nothing is ever skipped
+constexpr bool isHintedPollOp(u8 opCode, u16 operand) {
+  const OpcodeInfo& info = getOpcodeInfo(opCode, operand);
+  return !(info.flags & (OP_WRITES_MEMORY | OP_HALT | OP_ILLEGAL)) && !info.endsBlock() && opCode != 0xF3 && opCode != 0xFB;
+}
+
+constexpr bool isIdleLoopBranch(u8 opCode) {
+  return opCode == 0x20 || opCode == 0x28 || opCode == 0x30 || opCode == 0x38; //JR NZ/Z/NC/C
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "./util.hpp"
+
+enum Interrupt {
+  VBLANK_INT   = 0, //avoid conflict with Mode::VBLANK
+  LCD_STAT = 1,
+  TIMER    = 2,
+  SERIAL   = 3,
+  INPUT    = 4, //ie JOYPAD
+  NONE     = -1,
+};
+
+// Owns IE (0xFFFF), IF (0xFF0F) and IME. The MMU routes reads and writes of IE and IF here, and
+// Timer and PPU request interrupts directly. `pending` and `dispatchable` are kept up to date on
+// every change, so the CPU tests one byte before each instruction instead of reading both registers
+class InterruptController {
+public:
+  u8 readIE() { return enabled; }
+  u8 readIF() { return requested; }
+  void writeIE(u8 value) { enabled = value; update(); }
+  void writeIF(u8 value) { requested = value; update(); }
+
+  void request(Interrupt interrupt) { requested |= 1 << interrupt; update(); }
+  void acknowledge(Interrupt interrupt) { requested &= ~(1 << interrupt); update(); }
+
+  bool getIME() { return ime; }
+  void setIME(bool value) { ime = value; update(); }
+
+  // Requested and enabled, whether or not IME lets the CPU take them
+  u8 getPending() { return pending; }
+  // What the CPU takes before its next instruction: `pending` while IME is set, otherwise 0
+  u8 getDispatchable() { return dispatchable; }
+
+  // Highest priority interrupt in `getDispatchable()`, or NONE
+  Interrupt getNext() {
+    for (u8 bit = VBLANK_INT; bit <= INPUT; bit++) {
+      if (checkBit(dispatchable, bit)) {
+        return static_cast<Interrupt>(bit);
+      }
+    }
+    return NONE;
+  }
+private:
+  u8 enabled = 0;
+  u8 requested = 0;
+  bool ime = false;
+
+  u8 pending = 0;
+  u8 dispatchable = 0;
+
+  void update() {
+    pending = enabled & requested & 0x1F;
+    dispatchable = ime ? pending : 0;
+  }
+};
@@ -0,0 +1,638 @@
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include "./jit.hpp"
+#include "./opcodes.hpp"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <sys/mman.h>
+#define JIT_X86_64
+#endif
+
+// x86 register encodings
+enum HostRegister : u8 { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// `jcc` condition codes, and `JUMP` for an unconditional jmp
+enum JumpCondition : u8 { JUMP_B = 0x2, JUMP_AE = 0x3, JUMP_E = 0x4, JUMP_NE = 0x5, JUMP = 0xFF };
+
+// Where compiled code keeps the guest registers, indexed like `CPU::reg` with F in the place of (HL).
+// The CPU is in rbx, the JIT in r12, the cycles owed to Timer and PPU in r13 and the deadline in r14
+const u8 GUEST_REGISTERS[8] = { R8, R9, R10, R11, R15, RBP, RSI, RDI };
+const u8 GUEST_F = 6;
+const u8 GUEST_A = 7;
+
+// Appends raw x86-64 machine code at `at`
+class CodeWriter {
+public:
+  u8* at;
+
+  CodeWriter(u8* at) : at(at) {}
+
+  void byte(u8 value) { *at++ = value; }
+  void word(u16 value) { byte(value); byte(value >> 8); }
+  void dword(u32 value) { word(value); word(value >> 16); }
+  void qword(u64 value) { dword(value); dword(value >> 32); }
+
+  // mov rax, imm64 ; call rax
+  void call(void* function) {
+    byte(0x48); byte(0xB8); qword((u64)function);
+    byte(0xFF); byte(0xD0);
+  }
+  // mov word [rbx + offset], imm16
+  void storeWord(int offset, u16 value) {
+    byte(0x66); byte(0xC7); byte(0x83); dword(offset); word(value);
+  }
+  // mov byte [rbx + offset], imm8
+  void storeByte(int offset, u8 value) {
+    byte(0xC6); byte(0x83); dword(offset); byte(value);
+  }
+
+  // A REX prefix where one is needed. Byte instructions always take one, so encodings 4-7 mean
+  // SPL/BPL/SIL/DIL rather than AH/CH/DH/BH
+  void rex(u8 reg, u8 rm, bool bytes) {
+    u8 prefix = 0x40 | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+    if (prefix != 0x40 || bytes) {
+      byte(prefix);
+    }
+  }
+  // `op r/m8, r8` on two registers: ADD 00, OR 08, ADC 10, SBB 18, AND 20, SUB 28, XOR 30, CMP 38, MOV 88
+  void byteOp(u8 opcode, u8 to, u8 from) {
+    rex(from, to, true); byte(opcode); byte(0xC0 | (from & 7) << 3 | (to & 7));
+  }
+  // `op r/m8, imm8`, 0x80 /extension: ADD 0, OR 1, ADC 2, SBB 3, AND 4, SUB 5, XOR 6, CMP 7
+  void byteOpImmediate(u8 extension, u8 to, u8 value) {
+    rex(0, to, true); byte(0x80); byte(0xC0 | extension << 3 | (to & 7)); byte(value);
+  }
+  // One-operand byte ops: 0xD0 /extension rotates by one, 0xF6 /2 is NOT, 0xFE /0 and /1 are INC and DEC
+  void byteUnary(u8 opcode, u8 extension, u8 to) {
+    rex(0, to, true); byte(opcode); byte(0xC0 | extension << 3 | (to & 7));
+  }
+  // mov r8, imm8
+  void moveByte(u8 to, u8 value) {
+    rex(0, to, true); byte(0xB0 | (to & 7)); byte(value);
+  }
+  // movzx r32, byte [rbx + offset]
+  void loadRegister(u8 to, int offset) {
+    rex(to, RBX, false); byte(0x0F); byte(0xB6); byte(0x80 | (to & 7) << 3 | RBX); dword(offset);
+  }
+  // mov byte [rbx + offset], r8
+  void storeRegister(int offset, u8 from) {
+    rex(from, RBX, true); byte(0x88); byte(0x80 | (from & 7) << 3 | RBX); dword(offset);
+  }
+  // lahf ; movzx eax, ah ; movzx `to`, byte [r12 + rax + offset]
+  void loadHostFlags(u8 to, int offset) {
+    byte(0x9F);
+    byte(0x0F); byte(0xB6); byte(0xC4);
+    rex(to, R12, false); byte(0x0F); byte(0xB6); byte(0x84 | (to & 7) << 3); byte(0x04); dword(offset);
+  }
+  // add r13d, imm8
+  void addCycles(u8 cycles) {
+    byte(0x41); byte(0x83); byte(0xC5); byte(cycles);
+  }
+  // cmp r13d, r14d
+  void compareDeadline() {
+    byte(0x45); byte(0x39); byte(0xF5);
+  }
+  // Jump with the displacement left for `patch`, which takes the returned end of the instruction
+  u8* jump(u8 condition) {
+    if (condition == JUMP) {
+      byte(0xE9);
+    } else {
+      byte(0x0F); byte(0x80 | condition);
+    }
+    dword(0);
+    return at;
+  }
+  static void patch(u8* jumpEnd, u8* target) {
+    CodeWriter(jumpEnd - 4).dword(target - jumpEnd);
+  }
+};
+
+// LAHF puts ZF in bit 6, AF (carry out of bit 3) in bit 4 and CF in bit 0, which after the
+// matching x86 op are exactly the guest's Z, H and C
+JIT::JIT(CPU* cpu, Timer* timer, PPU* ppu) : cpu(cpu), timer(timer), ppu(ppu) {
+    for (u16 host = 0; host < 256; host++) {
+        u8 zero = checkBit(host, 6) ? 0x80 : 0;
+        u8 halfCarry = checkBit(host, 4) ? 0x20 : 0;
+        u8 carry = checkBit(host, 0) ? 0x10 : 0;
+        flagTables[JIT_FLAGS_ADD][host] = zero | halfCarry | carry;
+        flagTables[JIT_FLAGS_SUB][host] = zero | 0x40 | halfCarry | carry;
+        flagTables[JIT_FLAGS_AND][host] = zero | 0x20;
+        flagTables[JIT_FLAGS_LOGIC][host] = zero;
+        flagTables[JIT_FLAGS_INC][host] = zero | halfCarry;
+        flagTables[JIT_FLAGS_DEC][host] = zero | 0x40 | halfCarry;
+    }
+}
+
+JIT::~JIT() {
+    #ifdef JIT_X86_64
+    if (code != nullptr) {
+        munmap(code, JIT_CODE_SIZE);
+    }
+    #endif
+}
+
+bool JIT::isSupported() {
+    #ifdef JIT_X86_64
+    return true;
+    #else
+    return false;
+    #endif
+}
+
+bool JIT::enableCompiler() {
+    #ifdef JIT_X86_64
+    if (code != nullptr) {
+        return true;
+    }
+    void* memory = mmap(nullptr, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        printf("ERROR :: Could not map memory for the JIT, falling back to the interpreter\n");
+        return false;
+    }
+    code = (u8*)memory;
+    return true;
+    #else
+    return false;
+    #endif
+}
+
+bool JIT::useModule(const AotModule* module) {
+    MMU* mmu = cpu->mmu;
+    char title[17] = {};
+    for (u16 i = 0; i < 16; i++) {
+        title[i] = mmu->read(TITLE_ADDRESS + i);
+    }
+    u16 globalChecksum = (mmu->read(GLOBAL_CHECKSUM_ADDRESS) << 8) | mmu->read(GLOBAL_CHECKSUM_ADDRESS + 1);
+    if (strcmp(title, module->title) != 0 || mmu->read(HEADER_CHECKSUM_ADDRESS) != module->headerChecksum || globalChecksum != module->globalChecksum) {
+        printf("ERROR :: Recompiled module was built from a different cartridge, ignoring it\n");
+        return false;
+    }
+
+    moduleContext.pc = &cpu->pc;
+    moduleContext.operand = &cpu->operand;
+    for (u8 encoding = 0; encoding < 8; encoding++) {
+        moduleContext.registers[encoding] = (u8*)cpu + getGuestOffset(encoding);
+    }
+    for (u8 encoding = 0; encoding < 4; encoding++) {
+        moduleContext.registers16[encoding] = (u16*)((u8*)cpu + getRegister16Offset(encoding));
+    }
+    moduleContext.runHandler = &JIT::runHandler;
+    moduleContext.deadline = &deadline;
+    module->init(&moduleContext);
+
+    for (u32 i = 0; i < module->blockCount; i++) {
+        const AotBlockEntry& entry = module->blocks[i];
+        u32 key = entry.address >= 0x4000 ? (u32(entry.bank) << 16) | entry.address : entry.address;
+        moduleBlocks[key] = entry.run;
+    }
+    return true;
+}
+
+void JIT::run(int cycles) {
+    cyclesThisStep = 0;
+    cycleBudget = cycles;
+
+    while (cyclesThisStep < cycleBudget) {
+        if (cpu->halted) {
+            // Nothing to compile until an interrupt wakes the CPU
+            interpret(JIT_UNCACHED_STEPS);
+            continue;
+        }
+        if (interruptPending()) {
+            interpret(1);
+            continue;
+        }
+
+        // Old blocks are never freed individually, so start over once the buffer is full
+        if (codeUsed + JIT_MAX_BLOCK_SIZE > JIT_CODE_SIZE) {
+            cpu->blockCache.flush();
+            codeUsed = 0;
+        }
+
+        Block* block = cpu->blockCache.getBlock(cpu->pc);
+        if (block == nullptr) {
+            // Likely running from VRAM or cartridge RAM, so don't look for a block after every step
+            interpret(JIT_UNCACHED_STEPS);
+            continue;
+        }
+
+        if (block->bulkLoop) {
+            // Copy and fill loops run many passes per step in the interpreter
+            interpret(1);
+            continue;
+        }
+
+        if (block->hostCode == nullptr) {
+            block->entries++;
+            if (block->entries == 1) {
+                block->hostCode = (void*)findModuleBlock(cpu->pc);
+            } else if (code != nullptr && block->entries >= JIT_HOT_ENTRIES) {
+                block->hostCode = compile(block);
+            }
+        }
+
+        if (block->hostCode != nullptr) {
+            runHostCode(block->hostCode);
+        } else {
+            // Code that is rarely run, or rewritten often, isn't worth compiling
+            interpret(block->ops.size());
+        }
+    }
+    syncDevices();
+}
+
+// Host code may run several blocks in a row without Timer and PPU being stepped. They're caught
+// up once the cycles it ran reach the deadline, which is set when the first block starts
+void JIT::runHostCode(void* hostCode) {
+    if (lagCycles == 0) {
+        deadline = getDeadline();
+    }
+    epoch = cpu->blockCache.getEpoch();
+    CPU::resolveFlagsOf(cpu);
+    advance(((HostBlock)hostCode)(cpu, this, lagCycles));
+    if (lagCycles >= deadline) {
+        syncDevices();
+    }
+}
+
+// Module blocks only cover cartridge ROM, never the boot ROM or RAM
+JIT::HostBlock JIT::findModuleBlock(u16 pc) {
+    if (moduleBlocks.empty() || pc > 0x7FFF || (pc < BOOT_ROM_SIZE && cpu->mmu->isBootRomMapped())) {
+        return nullptr;
+    }
+    u32 key = pc >= 0x4000 ? (u32(cpu->mmu->getRomBank()) << 16) | pc : pc;
+    auto found = moduleBlocks.find(key);
+    return found == moduleBlocks.end() ? nullptr : found->second;
+}
+
+// Run up to `steps` instructions exactly as `GameBoy::step` would
+void JIT::interpret(u16 steps) {
+    syncDevices();
+    for (u16 i = 0; i < steps && cyclesThisStep < cycleBudget; i++) {
+        u8 cycles = cpu->step(cycleBudget - cyclesThisStep);
+        cyclesThisStep += cycles;
+        timer->step(cycles);
+        ppu->step(cycles);
+    }
+}
+
+// Takes the lag compiled code reports, counting what it ran since it last reported
+void JIT::advance(u32 lag) {
+    cyclesThisStep += lag - lagCycles;
+    cpu->cycleCount += lag - lagCycles;
+    lagCycles = lag;
+}
+
+void JIT::syncDevices() {
+    if (lagCycles > 0) {
+        timer->step(lagCycles);
+        ppu->step(lagCycles);
+        lagCycles = 0;
+    }
+}
+
+// Timer and PPU report how far they are from changing state as of their last step, which is
+// `lagCycles` behind. The budget left is counted from now
+u32 JIT::getDeadline() {
+    u32 quiet = std::min(timer->getCyclesUntilChange(), ppu->getCyclesUntilChange());
+    u32 budgetLeft = std::max(cycleBudget - cyclesThisStep, 0);
+    return std::min(quiet, lagCycles + budgetLeft);
+}
+
+// Mirrors the check at the top of `CPU::handleInterrupts`
+inline bool JIT::interruptPending() {
+    return cpu->interrupts->getDispatchable() != 0;
+}
+
+// Called from compiled code for every op it doesn't inline, with `pc`, `operand` and the guest
+// registers already in the CPU. Only these ops touch memory, so only they need `instructionPc`
+// for watchpoints. A write may change what Timer, PPU or the CPU do next, so the
+// devices are caught up before it, and the deadline drops to 0 if it let an interrupt through
+// or made the block stale. Returns the cycles Timer and PPU are owed
+u32 JIT::runHandler(JIT* jit, u8 opCode, u32 lag) {
+    CPU* cpu = jit->cpu;
+    jit->advance(lag);
+    cpu->instructionPc = cpu->pc - OPCODES[opCode].length;
+    bool writes = getOpcodeInfo(opCode, cpu->operand).flags & OP_WRITES_MEMORY;
+    if (writes) {
+        jit->syncDevices();
+    }
+    u8 cycles = CPU::opTable[opCode](cpu);
+    CPU::resolveFlagsOf(cpu);
+    jit->advance(jit->lagCycles + cycles);
+    if (writes) {
+        jit->deadline = jit->getDeadline();
+        if (jit->interruptPending() || jit->epoch != cpu->blockCache.getEpoch()) {
+            jit->deadline = 0;
+        }
+    }
+    return jit->lagCycles;
+}
+
+int JIT::getOffset(void* member) {
+    return (u8*)member - (u8*)cpu;
+}
+
+int JIT::getJitOffset(void* member) {
+    return (u8*)member - (u8*)this;
+}
+
+// Same encoding as `CPU::reg`, as an offset from the CPU
+int JIT::getRegisterOffset(u8 encoding) {
+    switch (encoding) {
+        case 0: return getOffset(&cpu->bc) + 1;
+        case 1: return getOffset(&cpu->bc);
+        case 2: return getOffset(&cpu->de) + 1;
+        case 3: return getOffset(&cpu->de);
+        case 4: return getOffset(&cpu->hl) + 1;
+        case 5: return getOffset(&cpu->hl);
+        default: return getOffset(&cpu->af) + 1;
+    }
+}
+
+// Like `getRegisterOffset`, with F for 6
+int JIT::getGuestOffset(u8 guest) {
+    return guest == GUEST_F ? getOffset(&cpu->af) : getRegisterOffset(guest);
+}
+
+// Same encoding as `CPU::reg16`, as an offset from the CPU
+int JIT::getRegister16Offset(u8 encoding) {
+    switch (encoding) {
+        case 0: return getOffset(&cpu->bc);
+        case 1: return getOffset(&cpu->de);
+        case 2: return getOffset(&cpu->hl);
+        default: return getOffset(&cpu->sp);
+    }
+}
+
+// Emits a `HostBlock`. Guest registers are loaded into host registers on entry and written back
+// on exit and around `runHandler` calls, which also get `pc` and `operand`. Every op adds its cycles
+// to r13 and leaves the block once that reaches the deadline in r14, which `runHandler` may move
+void* JIT::compile(Block* block) {
+    u8* start = code + codeUsed;
+    CodeWriter out(start);
+    std::vector<std::pair<u8*, int>> exits; //jumps to patch, and the pc to store first, or -1 if it's set
+
+    int pcOffset = getOffset(&cpu->pc);
+    int operandOffset = getOffset(&cpu->operand);
+
+    auto spill = [&](u8 guests) {
+        for (u8 guest = 0; guest < 8; guest++) {
+            if (checkBit(guests, guest)) {
+                out.storeRegister(getGuestOffset(guest), GUEST_REGISTERS[guest]);
+            }
+        }
+    };
+    auto reload = [&]() {
+        for (u8 guest = 0; guest < 8; guest++) {
+            out.loadRegister(GUEST_REGISTERS[guest], getGuestOffset(guest));
+        }
+    };
+    auto setFlags = [&](JitFlagTable table) {
+        out.loadHostFlags(GUEST_REGISTERS[GUEST_F], getJitOffset(flagTables[table]));
+    };
+    // Z and N from F, H and C from the host flags, for ADD HL,rr
+    auto setWordFlags = [&]() {
+        out.loadHostFlags(RAX, getJitOffset(flagTables[JIT_FLAGS_ADD]));
+        out.byte(0x83); out.byte(0xE0); out.byte(0x30);                  //and eax, 30h
+        out.byte(0x83); out.byte(0xE6); out.byte(0x80);                  //and esi, 80h
+        out.byte(0x09); out.byte(0xC6);                                  //or esi, eax
+    };
+    // Z N H from the host flags, C kept, for INC r and DEC r
+    auto setIncDecFlags = [&](JitFlagTable table) {
+        out.loadHostFlags(RAX, getJitOffset(flagTables[table]));
+        out.byte(0x83); out.byte(0xE6); out.byte(0x10);                  //and esi, 10h
+        out.byte(0x09); out.byte(0xC6);                                  //or esi, eax
+    };
+    auto carryIn = [&]() {
+        out.byte(0x0F); out.byte(0xBA); out.byte(0xE6); out.byte(0x04);  //bt esi, 4
+    };
+    // C from the host carry, everything else clear, for the rotates of A
+    auto setRotateFlags = [&]() {
+        out.byte(0x0F); out.byte(0x92); out.byte(0xC0);                  //setc al
+        out.byte(0x0F); out.byte(0xB6); out.byte(0xF0);                  //movzx esi, al
+        out.byte(0xC1); out.byte(0xE6); out.byte(0x04);                  //shl esi, 4
+    };
+
+    const DecodedOp& lastOp = block->ops.back();
+    u16 end = block->end;
+    bool loops = (lastOp.opCode == 0x18 || (lastOp.opCode & 0xE7) == 0x20) && u16(end + (s8)lastOp.operand) == block->start;
+    loops = loops || ((lastOp.opCode == 0xC3 || (lastOp.opCode & 0xE7) == 0xC2) && lastOp.operand == block->start);
+
+    out.byte(0x53);                                  //push rbx
+    out.byte(0x55);                                  //push rbp
+    out.byte(0x41); out.byte(0x54);                  //push r12
+    out.byte(0x41); out.byte(0x55);                  //push r13
+    out.byte(0x41); out.byte(0x56);                  //push r14
+    out.byte(0x41); out.byte(0x57);                  //push r15
+    out.byte(0x48); out.byte(0x83); out.byte(0xEC); out.byte(0x08); //sub rsp, 8
+    out.byte(0x48); out.byte(0x89); out.byte(0xFB);  //mov rbx, rdi
+    out.byte(0x49); out.byte(0x89); out.byte(0xF4);  //mov r12, rsi
+    out.byte(0x41); out.byte(0x89); out.byte(0xD5);  //mov r13d, edx
+    out.byte(0x45); out.byte(0x8B); out.byte(0xB4); out.byte(0x24); out.dword(getJitOffset(&deadline)); //mov r14d, [r12 + deadline]
+    reload();
+    u8* body = out.at;
+
+    // Guest registers changed since they were last written back. A loop comes back around with any of them changed
+    u8 dirty = loops ? 0xFF : 0x00;
+    u16 pc = block->start;
+    for (size_t i = 0; i < block->ops.size(); i++) {
+        const DecodedOp& op = block->ops[i];
+        u8 opCode = op.opCode;
+        u8 high = (opCode >> 3) & 0x7;
+        u8 low = opCode & 0x7;
+        u16 next = pc + op.length;
+        bool last = i + 1 == block->ops.size();
+        const OpcodeInfo& info = OPCODES[opCode];
+        pc = next;
+
+        // Direct branches end the block: to its start without leaving, anywhere else by returning to `run`
+        bool conditional = (opCode & 0xE7) == 0x20 || (opCode & 0xE7) == 0xC2;
+        if (opCode == 0x18 || opCode == 0xC3 || conditional) {
+            u16 target = opCode == 0x18 || opCode == 0x20 || opCode == 0x28 || opCode == 0x30 || opCode == 0x38 ? u16(next + (s8)op.operand) : op.operand;
+            u8* notTaken = nullptr;
+            if (conditional) {
+                u8 condition = (opCode >> 3) & 0x3; //NZ, Z, NC, C
+                out.byte(0xF7); out.byte(0xC6); out.dword(condition < 2 ? 0x80 : 0x10); //test esi, mask
+                notTaken = out.jump(condition & 1 ? JUMP_E : JUMP_NE);
+            }
+            out.addCycles(info.takenCycles);
+            if (target == block->start) {
+                out.compareDeadline();
+                exits.push_back({ out.jump(JUMP_AE), target });
+                CodeWriter::patch(out.jump(JUMP), body);
+            } else {
+                exits.push_back({ out.jump(JUMP), target });
+            }
+            if (conditional) {
+                CodeWriter::patch(notTaken, out.at);
+                out.addCycles(info.cycles);
+                exits.push_back({ out.jump(JUMP), next });
+            }
+            continue;
+        }
+
+        bool inlined = true;
+        u8 written = 0; //guest registers the inlined op changes
+        if (opCode == 0x00) {
+            //NOP
+        } else if ((opCode & 0xC7) == 0x06 && opCode != 0x36) {
+            //LD r,d8
+            out.moveByte(GUEST_REGISTERS[high], op.operand);
+            written = 1 << high;
+        } else if (opCode >= 0x40 && opCode <= 0x7F && high != 6 && low != 6) {
+            //LD r1,r2
+            if (high != low) {
+                out.byteOp(0x88, GUEST_REGISTERS[high], GUEST_REGISTERS[low]);
+                written = 1 << high;
+            }
+        } else if (opCode >= 0x80 && opCode <= 0xBF && low != 6) {
+            //ALU A,r
+            const u8 HOST_OPS[8] = { 0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38 };
+            const JitFlagTable TABLES[8] = { JIT_FLAGS_ADD, JIT_FLAGS_ADD, JIT_FLAGS_SUB, JIT_FLAGS_SUB, JIT_FLAGS_AND, JIT_FLAGS_LOGIC, JIT_FLAGS_LOGIC, JIT_FLAGS_SUB };
+            if (high == 1 || high == 3) {
+                carryIn();
+            }
+            out.byteOp(HOST_OPS[high], GUEST_REGISTERS[GUEST_A], GUEST_REGISTERS[low]);
+            setFlags(TABLES[high]);
+            written = (high == 7 ? 0 : 1 << GUEST_A) | 1 << GUEST_F;
+        } else if ((opCode & 0xC7) == 0xC6) {
+            //ALU A,d8
+            const u8 EXTENSIONS[8] = { 0, 2, 5, 3, 4, 6, 1, 7 };
+            const JitFlagTable TABLES[8] = { JIT_FLAGS_ADD, JIT_FLAGS_ADD, JIT_FLAGS_SUB, JIT_FLAGS_SUB, JIT_FLAGS_AND, JIT_FLAGS_LOGIC, JIT_FLAGS_LOGIC, JIT_FLAGS_SUB };
+            if (high == 1 || high == 3) {
+                carryIn();
+            }
+            out.byteOpImmediate(EXTENSIONS[high], GUEST_REGISTERS[GUEST_A], op.operand);
+            setFlags(TABLES[high]);
+            written = (high == 7 ? 0 : 1 << GUEST_A) | 1 << GUEST_F;
+        } else if ((opCode & 0xC6) == 0x04 && high != 6) {
+            //INC r, DEC r
+            bool decrement = opCode & 1;
+            out.byteUnary(0xFE, decrement, GUEST_REGISTERS[high]);
+            setIncDecFlags(decrement ? JIT_FLAGS_DEC : JIT_FLAGS_INC);
+            written = 1 << high | 1 << GUEST_F;
+        } else if ((opCode & 0xCF) == 0x01) {
+            //LD rr,d16
+            u8 pair = opCode >> 4;
+            if (pair == 3) {
+                out.storeWord(getRegister16Offset(pair), op.operand);
+            } else {
+                out.moveByte(GUEST_REGISTERS[pair * 2], op.operand >> 8);
+                out.moveByte(GUEST_REGISTERS[pair * 2 + 1], op.operand);
+                written = 3 << (pair * 2);
+            }
+        } else if ((opCode & 0xC7) == 0x03) {
+            //INC rr, DEC rr. The host flags they change aren't the guest's
+            u8 pair = opCode >> 4;
+            bool decrement = opCode & 0x8;
+            if (pair == 3) {
+                //inc/dec word [rbx + sp]
+                out.byte(0x66); out.byte(0xFF); out.byte(decrement ? 0x8B : 0x83); out.dword(getRegister16Offset(pair));
+            } else {
+                out.byteOpImmediate(decrement ? 5 : 0, GUEST_REGISTERS[pair * 2 + 1], 1);
+                out.byteOpImmediate(decrement ? 3 : 2, GUEST_REGISTERS[pair * 2], 0);
+                written = 3 << (pair * 2);
+            }
+        } else if ((opCode & 0xCF) == 0x09 && opCode != 0x39) {
+            //ADD HL,rr
+            u8 pair = opCode >> 4;
+            out.byteOp(0x00, GUEST_REGISTERS[5], GUEST_REGISTERS[pair * 2 + 1]);
+            out.byteOp(0x10, GUEST_REGISTERS[4], GUEST_REGISTERS[pair * 2]);
+            setWordFlags();
+            written = 3 << 4 | 1 << GUEST_F;
+        } else if (opCode == 0x07 || opCode == 0x0F || opCode == 0x17 || opCode == 0x1F) {
+            //RLCA, RRCA, RLA, RRA: rol, ror, rcl, rcr
+            if (opCode >= 0x17) {
+                carryIn();
+            }
+            out.byteUnary(0xD0, high, GUEST_REGISTERS[GUEST_A]);
+            setRotateFlags();
+            written = 1 << GUEST_A | 1 << GUEST_F;
+        } else if (opCode == 0x2F) {
+            //CPL
+            out.byteUnary(0xF6, 2, GUEST_REGISTERS[GUEST_A]);
+            out.byte(0x83); out.byte(0xE6); out.byte(0x90);              //and esi, 90h
+            out.byte(0x83); out.byte(0xCE); out.byte(0x60);              //or esi, 60h
+            written = 1 << GUEST_A | 1 << GUEST_F;
+        } else if (opCode == 0x37) {
+            //SCF
+            out.byte(0x83); out.byte(0xE6); out.byte(0x80);              //and esi, 80h
+            out.byte(0x83); out.byte(0xCE); out.byte(0x10);              //or esi, 10h
+            written = 1 << GUEST_F;
+        } else if (opCode == 0x3F) {
+            //CCF
+            out.byte(0x83); out.byte(0xE6); out.byte(0x90);              //and esi, 90h
+            out.byte(0x83); out.byte(0xF6); out.byte(0x10);              //xor esi, 10h
+            written = 1 << GUEST_F;
+        } else {
+            inlined = false;
+        }
+
+        if (inlined) {
+            dirty |= written;
+            out.addCycles(info.cycles);
+            out.compareDeadline();
+            exits.push_back({ out.jump(last ? JUMP : JUMP_AE), next });
+            continue;
+        }
+
+        // Everything else goes through `runHandler`, which runs it exactly as `CPU::exec` would
+        spill(dirty);
+        dirty = 0;
+        out.storeWord(pcOffset, next);
+        if (op.length > 1) {
+            out.storeWord(operandOffset, op.operand);
+        }
+        out.byte(0x4C); out.byte(0x89); out.byte(0xE7);                  //mov rdi, r12
+        out.byte(0xBE); out.dword(opCode);                               //mov esi, opCode
+        out.byte(0x44); out.byte(0x89); out.byte(0xEA);                  //mov edx, r13d
+        out.call((void*)&JIT::runHandler);
+        out.byte(0x41); out.byte(0x89); out.byte(0xC5);                  //mov r13d, eax
+        out.byte(0x45); out.byte(0x8B); out.byte(0xB4); out.byte(0x24); out.dword(getJitOffset(&deadline)); //mov r14d, [r12 + deadline]
+        reload();
+
+        // EI may let an interrupt through, which `run` takes before the next op
+        if (last || opCode == 0xFB) {
+            exits.push_back({ out.jump(JUMP), -1 });
+            continue;
+        }
+        out.compareDeadline();
+        exits.push_back({ out.jump(JUMP_AE), -1 });
+    }
+
+    // Exits that still have to set `pc` do so on the way out
+    u8* epilogue = nullptr;
+    std::vector<std::pair<u8*, int>> stubs;
+    for (const auto& exit : exits) {
+        if (exit.second >= 0) {
+            CodeWriter::patch(exit.first, out.at);
+            out.storeWord(pcOffset, exit.second);
+            stubs.push_back({ out.jump(JUMP), -1 });
+        }
+    }
+    epilogue = out.at;
+    spill(0xFF);
+    out.byte(0x44); out.byte(0x89); out.byte(0xE8);  //mov eax, r13d
+    out.byte(0x48); out.byte(0x83); out.byte(0xC4); out.byte(0x08); //add rsp, 8
+    out.byte(0x41); out.byte(0x5F);                  //pop r15
+    out.byte(0x41); out.byte(0x5E);                  //pop r14
+    out.byte(0x41); out.byte(0x5D);                  //pop r13
+    out.byte(0x41); out.byte(0x5C);                  //pop r12
+    out.byte(0x5D);                                  //pop rbp
+    out.byte(0x5B);                                  //pop rbx
+    out.byte(0xC3);                                  //ret
+
+    for (const auto& exit : exits) {
+        if (exit.second < 0) {
+            CodeWriter::patch(exit.first, epilogue);
+        }
+    }
+    for (const auto& stub : stubs) {
+        CodeWriter::patch(stub.first, epilogue);
+    }
+
+    codeUsed = out.at - code;
+    return start;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <unordered_map>
+#include "./aot.hpp"
+#include "./cpu.hpp"
+#include "./timer.hpp"
+#include "./ppu.hpp"
+#include "./util.hpp"
+
+const u32 JIT_CODE_SIZE = 8 * 1024 * 1024;
+const u32 JIT_MAX_BLOCK_SIZE = 32 * 1024; //generous upper bound for one compiled block
+const u16 JIT_HOT_ENTRIES = 32; //blocks are interpreted until entered this many times
+const u16 JIT_UNCACHED_STEPS = 16; //steps interpreted before looking for a block again, outside cacheable code
+
+// Which of `JIT::flagTables` turns the host flags after an x86 op into F for the matching guest op
+enum JitFlagTable : u8 {
+  JIT_FLAGS_ADD,   //Z H C, for ADD and ADC
+  JIT_FLAGS_SUB,   //Z N H C, for SUB, SBC and CP
+  JIT_FLAGS_AND,   //Z, H set
+  JIT_FLAGS_LOGIC, //Z, for XOR and OR
+  JIT_FLAGS_INC,   //Z H, C is kept from F
+  JIT_FLAGS_DEC,   //Z N H, C is kept from F
+  JIT_FLAG_TABLES,
+};
+
+// Optional x86-64 backend for the CPU. Blocks from the CPU's block cache are compiled into host
+// code that keeps A, F, BC, DE and HL in host registers and runs register loads, 8-bit ALU ops,
+// INC/DEC, rotates of A, ADD HL,rr and direct branches inline, with F taken from the host flags
+// through a lookup table. Anything touching memory calls the interpreter's handler for its opcode.
+// Compiled code only counts the cycles it runs; Timer and PPU are stepped with all of them at once
+// when the deadline passes at which either could next change state, or just before a handler
+// writes memory. Every op still sees them as it would if they were stepped after each op, so
+// `GameBoy::step` timing is unchanged. A block that branches back to its own start loops without
+// leaving compiled code. Compiled code returns to `run` at the deadline, on a pending interrupt,
+// or when code may have been overwritten. Blocks from a module built by `tools/recompile` are run
+// the same way, without waiting to get hot.
+// Cold blocks, HALT, interrupts and code outside the cacheable regions are left to `CPU::step`
+class JIT {
+public:
+  JIT(CPU* cpu, Timer* timer, PPU* ppu);
+  ~JIT();
+
+  // Only x86-64 hosts with System V calling conventions are supported
+  static bool isSupported();
+
+  // Start compiling hot blocks. Without this only module blocks run natively
+  bool enableCompiler();
+  // Use the blocks of a recompiled module, if it was built from the running cartridge
+  bool useModule(const AotModule* module);
+
+  // Equivalent to calling cpu->step(), timer->step() and ppu->step() until `cycles` have passed
+  void run(int cycles);
+private:
+  CPU* cpu;
+  Timer* timer;
+  PPU* ppu;
+
+  using HostBlock = AotBlock;
+
+  u8* code = nullptr;
+  u32 codeUsed = 0;
+
+  // Module blocks keyed like the block cache: (bank << 16) | address for switchable ROM
+  std::unordered_map<u32, HostBlock> moduleBlocks;
+  AotContext moduleContext;
+
+  // Both include `lagCycles`
+  int cyclesThisStep = 0;
+  int cycleBudget = 0;
+  // Cycles run but not yet given to Timer and PPU, as last reported by compiled code
+  u32 lagCycles = 0;
+  // `lagCycles` at which Timer or PPU could next change state or the budget runs out
+  u32 deadline = 0;
+  u32 epoch = 0;
+
+  // Indexed by what LAHF leaves in AH: SF ZF - AF - PF - CF
+  u8 flagTables[JIT_FLAG_TABLES][256];
+
+  bool interruptPending();
+  void interpret(u16 steps);
+  void runHostCode(void* hostCode);
+  void advance(u32 lag);
+  void syncDevices();
+  u32 getDeadline();
+  static u32 runHandler(JIT* jit, u8 opCode, u32 lag);
+
+  HostBlock findModuleBlock(u16 pc);
+  void* compile(Block* block);
+  int getRegisterOffset(u8 encoding);
+  int getRegister16Offset(u8 encoding);
+  int getGuestOffset(u8 guest);
+  int getOffset(void* member);
+  int getJitOffset(void* member);
+};
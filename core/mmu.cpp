@@ -2,33 +2,75 @@
 #include <cstring>
 #include <stdio.h>
 #include "./mmu.hpp"
+#include "./cpu.hpp"
 
-MMU::MMU(Cartridge* cartridge, Input* input, u8* bootRom) : cartridge(cartridge), input(input), bootRom(bootRom) {
+MMU::MMU(Cartridge* cartridge, Input* input, InterruptController* interrupts, u8* bootRom) : cartridge(cartridge), mapper(cartridge->getType()), input(input), interrupts(interrupts), bootRom(bootRom) {
     memory[INPUT_ADDRESS] = 0xFF; // Input starts high, since high = unpressed
     memory[DIV_ADDRESS] = 0x00;
     memory[TIMA_ADDRESS] = 0x00;
+
+    mapMemory();
+
+    mapIORegister(INPUT_ADDRESS, input,
+        [](void* input, u16) { return ((Input*)input)->readInput(); },
+        [](void* input, u16, u8 value) { ((Input*)input)->writeInput(value); });
+    mapIORegister(IF_ADDRESS, interrupts,
+        [](void* interrupts, u16) { return ((InterruptController*)interrupts)->readIF(); },
+        [](void* interrupts, u16, u8 value) { ((InterruptController*)interrupts)->writeIF(value); });
+    for (u16 address : { DISABLE_BOOT_ROM, SC_ADDRESS, DMA_TRSFR_ADDRESS }) {
+        mapIORegister(address, this, nullptr, [](void* mmu, u16 address, u8 value) { ((MMU*)mmu)->writeRegister(address, value); });
+    }
 }
 
 MMU::~MMU() {}
 
+template <typename Function>
+inline auto MMU::withMapper(Function function) {
+    switch (mapper) {
+        case NO_MBC: return function(static_cast<NoMBC*>(cartridge));
+        case MBC_1: return function(static_cast<MBC1*>(cartridge));
+        case MBC_3: return function(static_cast<MBC3*>(cartridge));
+        case MBC_5: return function(static_cast<MBC5*>(cartridge));
+        case MBC_2: return function(static_cast<MBC2*>(cartridge));
+        default: return function(cartridge);
+    }
+}
+
 // During mode OAM: CPU cannot access OAM
 // During mode VRAM: CPU cannot access VRAM or OAM
 // During restricted modes, any attempt to read returns $FF, any attempt to write are ignored
 bool MMU::blockedByPPU(u16 address) {
-    u8 stat = memory[STAT_ADDRESS];
-    stat &= 0x3;
     // OAM
-    if (stat == 2) {
+    if (videoMode == 2) {
         return (address >= 0xFE00 && address <= 0xFE9F);
     }
     // VRAM
-    if (stat == 3) {
+    if (videoMode == 3) {
         return (address >= 0xFE00 && address <= 0xFE9F) || (address >= 0x8000 && address <= 0x97FF);
     }
     return false;
 }
 
-u8 MMU::read(u16 address) {
+u8 MMU::readSlow(u16 address) {
+    u8 value = readMemory(address);
+    if (watchedPages[address >> 8] & WATCH_READ) {
+        checkWatchpoints(WATCH_READ, address, value);
+    }
+    return value;
+}
+
+void MMU::writeSlow(u16 address, u8 value) {
+    if (watchedPages[address >> 8] & WATCH_WRITE) {
+        checkWatchpoints(WATCH_WRITE, address, value);
+    }
+    writeMemory(address, value);
+}
+
+u8 MMU::readMemory(u16 address) {
+    if (address >= 0xFF00 && address <= 0xFF7F) {
+        const IORegister& reg = ioRegisters[address - 0xFF00];
+        return reg.read != nullptr ? reg.read(reg.owner, address) : memory[address];
+    }
     if (blockedByPPU(address)) {
         return 0xFF;
     }
@@ -36,55 +78,297 @@ u8 MMU::read(u16 address) {
         if (address < BOOT_ROM_SIZE && !bootRomDisabled) {
             return bootRom[address];
         }
-        return cartridge->read(address);
+        return withMapper([&](auto* mbc) { return mbc->read(address); });
     } else if (0xA000 <= address && address <= 0xBFFF) { //cartridge ram
-        return cartridge->read(address);
-    } else if (address == INPUT_ADDRESS) {
-        return input->readInput();
+        return withMapper([&](auto* mbc) { return mbc->read(address); });
+    } else if (address == IE_ADDRESS) {
+        return interrupts->readIE();
     }
     return memory[address];
 }
 
-u16 MMU::read16Bit(u16 address) {
-    return (u16(read(address + 1)) << 8) + read(address);
-}
-
-void MMU::write(u16 address, u8 value) {
+void MMU::writeMemory(u16 address, u8 value) {
+    if (address >= 0xFF00 && address <= 0xFF7F) {
+        if (cpu) { cpu->syncDevices(); }
+        const IORegister& reg = ioRegisters[address - 0xFF00];
+        if (reg.write != nullptr) {
+            reg.write(reg.owner, address, value);
+        } else {
+            memory[address] = value;
+        }
+        markWritten(address);
+        return;
+    }
     if (blockedByPPU(address)) {
         return;
     }
+    markWritten(address);
     if (address <= 0x7FFF) { //cartridge rom
-        cartridge->write(address, value);
+        withMapper([&](auto* mbc) { mbc->write(address, value); });
+        mapCartridge();
+        if (blockCache) { blockCache->bankSwitched(); }
     } else if (0xA000 <= address && address <= 0xBFFF) { //cartridge ram
-        cartridge->write(address, value);
-    } else if (address == INPUT_ADDRESS) {
-        input->writeInput(value);
-    } else if (address == DIV_ADDRESS) {
-        memory[address] = 0;
-    } else if (address == DISABLE_BOOT_ROM) {
-        bootRomDisabled = value; //non-zero disables 
-        memory[address] = value;
-    } else if (address == SB_ADDRESS) { //Serial port used for debugging
-        memory[address] = value;
-    } else if (address == SC_ADDRESS) { //Serial port control
-        if (value == 0x81) {
-            std::cout << (char)memory[SB_ADDRESS] << std::flush;
-        }
-    } else if (address == DMA_TRSFR_ADDRESS) { // DMA transfer
-        u16 startAddress = value << 8;
-        memcpy(memory + 0xFE00, memory + startAddress, 160);
-        memory[address] = value;
+        withMapper([&](auto* mbc) { mbc->write(address, value); });
+    } else if (address == IE_ADDRESS) {
+        interrupts->writeIE(value);
     } else {
         memory[address] = value;
+        if (blockCache) { blockCache->written(address); }
+    }
+}
+
+// The I/O registers the MMU owns itself
+void MMU::writeRegister(u16 address, u8 value) {
+    switch (address) {
+        case DISABLE_BOOT_ROM:
+            bootRomDisabled = value; //non-zero disables 
+            memory[address] = value;
+            mapCartridge();
+            if (blockCache) { blockCache->flush(); }
+            break;
+        case SC_ADDRESS: //Serial port control, SB is used for debugging
+            if (value == 0x81) {
+                std::cout << (char)memory[SB_ADDRESS] << std::flush;
+            }
+            break;
+        case DMA_TRSFR_ADDRESS: { // DMA transfer
+            u16 startAddress = value << 8;
+            memcpy(memory + 0xFE00, memory + startAddress, 160);
+            memory[address] = value;
+            markWritten(0xFE00, 160);
+            break;
+        }
     }
 }
 
+void MMU::mapIORegister(u16 address, void* owner, IOReadHandler read, IOWriteHandler write) {
+    IORegister& reg = ioRegisters[address - 0xFF00];
+    reg.owner = owner;
+    reg.read = read;
+    reg.write = write;
+}
+
+// One past the end of the stretch of plain memory `address` is in, or 0 if it isn't plain memory.
+// Stretches are split where `blockedByPPU` changes its answer
+static u32 getPlainMemoryEnd(u16 address) {
+    if (0x8000 <= address && address <= 0x97FF) { return 0x9800; } //tile data
+    if (0x9800 <= address && address <= 0x9FFF) { return 0xA000; } //tile maps
+    if (0xC000 <= address && address <= 0xFDFF) { return 0xFE00; } //work ram and echo
+    if (0xFE00 <= address && address <= 0xFE9F) { return 0xFEA0; } //oam
+    if (0xFEA0 <= address && address <= 0xFEFF) { return 0xFF00; }
+    if (0xFF80 <= address && address <= 0xFFFE) { return 0xFFFF; } //high ram
+    return 0;
+}
+
+bool MMU::isBulkDestination(u16 address, u16 length) {
+    return u32(address) + length <= getPlainMemoryEnd(address) && !isWatched(address, length);
+}
+
+bool MMU::isBulkSource(u16 address, u16 length) {
+    if (address <= 0x7FFF) {
+        return u32(address) + length <= 0x8000 && !isWatched(address, length);
+    }
+    return isBulkDestination(address, length);
+}
+
+void MMU::fill(u16 address, u16 length, u8 value) {
+    if (blockedByPPU(address)) {
+        return;
+    }
+    memset(memory + address, value, length);
+    markWritten(address, length);
+    if (blockCache) { blockCache->written(address, length); }
+}
+
+// Byte by byte, so an overlapping copy repeats bytes the way the guest loop would
+u8 MMU::copy(u16 destination, u16 source, u16 length) {
+    bool readBlocked = blockedByPPU(source);
+    bool writeBlocked = blockedByPPU(destination);
+    u8 value = 0;
+    for (u16 i = 0; i < length; i++) {
+        if (source <= 0x7FFF) {
+            value = read(source + i);
+        } else {
+            value = readBlocked ? 0xFF : memory[source + i];
+        }
+        if (!writeBlocked) {
+            memory[destination + i] = value;
+        }
+    }
+    if (!writeBlocked) {
+        markWritten(destination, length);
+        if (blockCache) { blockCache->written(destination, length); }
+    }
+    return value;
+}
+
+void MMU::setBlockCache(BlockCache* blockCache) {
+    this->blockCache = blockCache;
+}
+
+void MMU::setCPU(CPU* cpu) {
+    this->cpu = cpu;
+}
+
+bool MMU::isBootRomMapped() {
+    return !bootRomDisabled;
+}
+
+u16 MMU::getRomBank() {
+    return withMapper([](auto* mbc) { return mbc->getRomBank(); });
+}
+
+u32 MMU::getRomOffset(u16 address) {
+    if (address < BOOT_ROM_SIZE && !bootRomDisabled) {
+        return NOT_ROM;
+    } else if (address <= 0x3FFF) {
+        return address;
+    } else if (address <= 0x7FFF && mappedRom != nullptr) {
+        return mappedRom - cartridge->getRom() + (address - 0x4000);
+    }
+    return NOT_ROM;
+}
+
 //Only use if you know what you're doing
 void MMU::writeDirectly(u16 address, u8 value) {
     memory[address] = value;
+    markWritten(address);
 }
 
 //Only use if you know what you're doing
 u8 MMU::readDirectly(u16 address) {
     return memory[address];
+}
+
+u32 MMU::addWatchpoint(Watchpoint watchpoint) {
+    watchpoint.id = nextWatchpointId++;
+    watchpoints.push_back(watchpoint);
+    for (u16 page = watchpoint.first >> 8; page <= watchpoint.last >> 8; page++) {
+        watchedPages[page] |= watchpoint.access;
+    }
+    mapMemory();
+    return watchpoint.id;
+}
+
+void MMU::removeWatchpoint(u32 id) {
+    for (size_t i = 0; i < watchpoints.size(); i++) {
+        if (watchpoints[i].id == id) {
+            watchpoints.erase(watchpoints.begin() + i);
+            break;
+        }
+    }
+    memset(watchedPages, 0, sizeof(watchedPages));
+    for (const Watchpoint& watchpoint : watchpoints) {
+        for (u16 page = watchpoint.first >> 8; page <= watchpoint.last >> 8; page++) {
+            watchedPages[page] |= watchpoint.access;
+        }
+    }
+    mapMemory();
+}
+
+void MMU::checkWatchpoints(WatchAccess access, u16 address, u8 value) {
+    for (const Watchpoint& watchpoint : watchpoints) {
+        if ((watchpoint.access & access) && watchpoint.first <= address && address <= watchpoint.last && (watchpoint.value < 0 || watchpoint.value == value)) {
+            WatchHit hit = { address, value, access, 0, getRomBank(), 0 };
+            if (cpu) {
+                hit.pc = cpu->getInstructionPc();
+                hit.cycle = cpu->getCycleCount();
+            }
+            watchpoint.handler(watchpoint.owner, hit);
+        }
+    }
+}
+
+bool MMU::isWatched(u16 address, u16 length) {
+    for (u32 page = address >> 8; page <= (address + length - 1u) >> 8 && page < 0x100; page++) {
+        if (watchedPages[page]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// `read` and `write` are the host memory for address `first << 8`, or nullptr to send the pages to the slow path
+void MMU::mapPages(u8 first, u8 last, const u8* read, u8* write) {
+    for (u16 page = first; page <= last; page++) {
+        u16 offset = (page - first) << 8;
+        readPages[page] = read != nullptr && !(watchedPages[page] & WATCH_READ) ? read + offset : nullptr;
+        writePages[page] = write != nullptr && !(watchedPages[page] & WATCH_WRITE) ? write + offset : nullptr;
+    }
+}
+
+void MMU::mapMemory() {
+    mapPages(0x80, 0x9F, memory + 0x8000, memory + 0x8000);
+    mapPages(0xC0, 0xFE, memory + 0xC000, memory + 0xC000);
+    mapCartridge();
+    mapVideoMemory();
+}
+
+// Only ranges whose mapping changed are stamped as written, so a write that selects the bank
+// already selected doesn't look like new ROM or RAM to `getPagesChangedSince`
+void MMU::mapCartridge() {
+    if (bootRomMapped == bootRomDisabled) {
+        markWritten(0x0000, BOOT_ROM_SIZE);
+        bootRomMapped = !bootRomDisabled;
+    }
+    mapPages(0x00, 0x3F, cartridge->getRom(), nullptr);
+    if (!bootRomDisabled) {
+        readPages[0x00] = bootRom;
+    }
+    withMapper([this](auto* mbc) {
+        u8* rom = mbc->getMappedRom();
+        if (rom != mappedRom) {
+            markWritten(0x4000, 0x4000);
+            mappedRom = rom;
+        }
+        u8* ramRead = mbc->getMappedRam(false);
+        u8* ramWrite = mbc->getMappedRam(true);
+        if (ramRead != mappedRamRead || ramWrite != mappedRamWrite) {
+            markWritten(0xA000, 0x2000);
+            mappedRamRead = ramRead;
+            mappedRamWrite = ramWrite;
+        }
+        mapPages(0x40, 0x7F, rom, nullptr);
+        mapPages(0xA0, 0xBF, ramRead, ramWrite);
+    });
+}
+
+// Same rules as `blockedByPPU`
+void MMU::setVideoMode(u8 mode) {
+    if (mode != videoMode) {
+        videoMode = mode;
+        mapVideoMemory();
+    }
+}
+
+void MMU::mapVideoMemory() {
+    u8* vram = videoMode == 3 ? nullptr : memory + 0x8000;
+    u8* oam = videoMode >= 2 ? nullptr : memory + 0xFE00;
+    mapPages(0x80, 0x97, vram, vram);
+    mapPages(0xFE, 0xFE, oam, oam);
+}
+
+u16 MMU::getPagesChangedSince(u32 since, u8* pages) {
+    u16 count = 0;
+    for (u16 page = 0; page < 0x100; page++) {
+        if (pageGenerations[page] >= since) {
+            pages[count++] = page;
+        }
+    }
+    return count;
+}
+
+void MMU::markWritten(u16 address, u16 length) {
+    if (length == 0) {
+        return;
+    }
+    u32 end = u32(address) + length - 1;
+    for (u32 page = address >> 8; page <= end >> 8; page++) {
+        pageGenerations[page] = generation;
+    }
+    u32 videoStart = address > 0x8000 ? address : 0x8000;
+    u32 videoEnd = end < 0x9FFF ? end : 0x9FFF;
+    for (u32 line = videoStart >> 4; line <= videoEnd >> 4; line++) {
+        videoGenerations[line & 0x1FF] = generation;
+    }
 }
\ No newline at end of file
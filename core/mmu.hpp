@@ -1,8 +1,14 @@
 #pragma once
 
+#include <vector>
 #include "./util.hpp"
+#include "./blockcache.hpp"
 #include "./cartridge.hpp"
 #include "./input.hpp"
+#include "./interrupts.hpp"
+#include "./watchpoints.hpp"
+
+class CPU;
 
 const u16 INPUT_ADDRESS = 0xFF00;
 const u16 DIV_ADDRESS = 0xFF04;
@@ -16,27 +22,188 @@ const u16 SB_ADDRESS = 0xFF01;
 const u16 SC_ADDRESS = 0xFF02;
 const u16 STAT_ADDRESS = 0xFF41;
 const u16 DMA_TRSFR_ADDRESS = 0xFF46;
+const u32 NOT_ROM = 0xFFFFFFFF;
+
+// Callbacks for one register in 0xFF00-0xFF7F, called with the `owner` they were registered with.
+// A register with no read (write) handler is read (written) as plain memory
+typedef u8 (*IOReadHandler)(void* owner, u16 address);
+typedef void (*IOWriteHandler)(void* owner, u16 address, u8 value);
+
+struct IORegister {
+  void* owner = nullptr;
+  IOReadHandler read = nullptr;
+  IOWriteHandler write = nullptr;
+};
 
 class MMU {
 public: 
-  MMU(Cartridge* cartridge, Input* input, u8* bootRom);
+  MMU(Cartridge* cartridge, Input* input, InterruptController* interrupts, u8* bootRom);
   ~MMU();
 
-  u8 read(u16 address);
-  u16 read16Bit(u16 address);
+  // Pages backed by plain memory are read and written through `readPages`/`writePages`; everything
+  // else (I/O, VRAM and OAM while the PPU holds them, unmapped cartridge RAM, watched pages) goes the slow way.
+  // High RAM shares its page with the I/O registers, so it gets its own check ahead of the slow path
+  inline u8 read(u16 address) {
+    const u8* page = readPages[address >> 8];
+    if (page != nullptr) {
+      return page[address & 0xFF];
+    }
+    if (isHighRam(address) && !(watchedPages[0xFF] & WATCH_READ)) {
+      return memory[address];
+    }
+    return readSlow(address);
+  }
+  inline u16 read16Bit(u16 address) {
+    const u8* page = readPages[address >> 8];
+    if (page != nullptr && (address & 0xFF) != 0xFF) {
+      return page[address & 0xFF] | (page[(address & 0xFF) + 1] << 8);
+    }
+    return (u16(read(address + 1)) << 8) + read(address);
+  }
+  // Instruction fetch: `read` without the watchpoints. Those watch the data a program reads, and
+  // firing them on fetches would make them depend on when the block cache decodes ahead of the PC
+  inline u8 fetch(u16 address) {
+    const u8* page = readPages[address >> 8];
+    if (page != nullptr) {
+      return page[address & 0xFF];
+    }
+    if (isHighRam(address)) {
+      return memory[address];
+    }
+    return readMemory(address);
+  }
+  inline u16 fetch16Bit(u16 address) {
+    return (u16(fetch(address + 1)) << 8) + fetch(address);
+  }
 
-  void write(u16 address, u8 value);
+  inline void write(u16 address, u8 value) {
+    u8* page = writePages[address >> 8];
+    if (page != nullptr) {
+      page[address & 0xFF] = value;
+      markWritten(address);
+      if (blockCache) { blockCache->written(address); }
+      return;
+    }
+    if (isHighRam(address) && !(watchedPages[0xFF] & WATCH_WRITE)) {
+      memory[address] = value;
+      markWritten(address);
+      if (blockCache) { blockCache->written(address); }
+      return;
+    }
+    writeSlow(address, value);
+  }
   void writeDirectly(u16 address, u8 value);
   u8 readDirectly(u16 address);
 
   bool blockedByPPU(u16 address);
+
+  // Bulk access for the CPU's copy and fill loops. A range qualifies if `write` would store every
+  // byte of it straight into `memory` under one PPU access rule; sources may also be cartridge ROM.
+  // Both act exactly like writing (and reading) the bytes one at a time from the lowest address up
+  bool isBulkDestination(u16 address, u16 length);
+  bool isBulkSource(u16 address, u16 length);
+  void fill(u16 address, u16 length, u8 value);
+  // Returns the last byte read
+  u8 copy(u16 destination, u16 source, u16 length);
+
+  // Write generations, for consumers that only want to redo work for memory that changed. Every
+  // write stamps its 256-byte page, and in 0x8000-0x9FFF its 16-byte video line (one tile, or half a
+  // tile map row), with the current generation. A consumer calls `nextGeneration` when it takes a
+  // snapshot, then anything stamped with that number or later was written after it. Bank switches
+  // stamp the pages they remap
+  u32 nextGeneration() { return ++generation; }
+  u32 getPageGeneration(u8 page) { return pageGenerations[page]; }
+  u32 getVideoGeneration(u16 address) { return videoGenerations[(address & 0x1FFF) >> 4]; }
+  // Writes the numbers of the pages written at or after `since` to `pages`, in order, and returns how many there were
+  u16 getPagesChangedSince(u32 since, u8* pages);
+
+  // Watched pages are left out of the page table, so they go the slow way where the watchpoints are
+  // checked, and everything else runs as fast as with none set. Bulk copies and fills refuse watched
+  // ranges. Instruction fetches, OAM DMA and device accesses aren't watched. Returns an id for `removeWatchpoint`
+  u32 addWatchpoint(Watchpoint watchpoint);
+  void removeWatchpoint(u32 id);
+  bool hasWatchpoints() { return !watchpoints.empty(); }
+
+  // Devices claim their I/O registers with this at construction. Write handlers run after
+  // Timer and PPU have been brought up to date, and store the value themselves if it should read back
+  void mapIORegister(u16 address, void* owner, IOReadHandler read, IOWriteHandler write);
+  // The PPU reports every change to the mode bits of STAT, which decide whether the CPU can reach VRAM and OAM
+  void setVideoMode(u8 mode);
+
+  // Lets the MMU tell the CPU's block cache about bank switches and writes over code
+  void setBlockCache(BlockCache* blockCache);
+  // Lets the MMU have Timer and PPU brought up to date before an I/O register is written
+  void setCPU(CPU* cpu);
+  bool isBootRomMapped();
+  u16 getRomBank();
+  // Offset into the cartridge ROM of the byte fetched from `address`, or NOT_ROM if that doesn't come straight from it
+  u32 getRomOffset(u16 address);
+  SharedRom* getRomImage() { return cartridge->getImage(); }
 private:
   Cartridge* cartridge;
+  MBCType mapper; //`cartridge->getType()`, read once
   Input* input; 
+  InterruptController* interrupts;
   // Array of size 0x10000 (Addresses 0x0 - 0xFFFF)
   // Some access rules: https://gbdev.io/pandocs/Memory_Map.html
   u8 memory[0x10000] = {}; 
 
   u8* bootRom;
   bool bootRomDisabled = false;
+
+  // What `mapCartridge` last mapped, to tell which ranges a cartridge register write changed
+  bool bootRomMapped = false;
+  u8* mappedRom = nullptr;
+  u8* mappedRamRead = nullptr;
+  u8* mappedRamWrite = nullptr;
+
+  BlockCache* blockCache = nullptr;
+  CPU* cpu = nullptr;
+
+  // Host memory backing each 256-byte page, offset so `page[address & 0xFF]` is the byte at `address`.
+  // nullptr sends the access to `readSlow`/`writeSlow`
+  const u8* readPages[0x100] = {};
+  u8* writePages[0x100] = {};
+  u8 videoMode = 0; //mode bits of STAT, as last reported to `setVideoMode`
+
+  IORegister ioRegisters[0x80];
+
+  std::vector<Watchpoint> watchpoints;
+  u32 nextWatchpointId = 1;
+  u8 watchedPages[0x100] = {}; //`WatchAccess` bits of the watchpoints overlapping each page
+
+  void checkWatchpoints(WatchAccess access, u16 address, u8 value);
+  bool isWatched(u16 address, u16 length);
+
+  u32 generation = 0;
+  u32 pageGenerations[0x100] = {};
+  u32 videoGenerations[0x2000 / 16] = {};
+
+  // 0xFF80-0xFFFE; IE sits at the top of the same page
+  inline bool isHighRam(u16 address) { return address >= 0xFF80 && address != IE_ADDRESS; }
+
+  inline void markWritten(u16 address) {
+    pageGenerations[address >> 8] = generation;
+    if ((address & 0xE000) == 0x8000) {
+      videoGenerations[(address & 0x1FFF) >> 4] = generation;
+    }
+  }
+  void markWritten(u16 address, u16 length);
+
+  // Calls `function` with `cartridge` cast to its concrete mapper class, so the calls it makes are direct and can be inlined
+  template <typename Function>
+  auto withMapper(Function function);
+
+  u8 readSlow(u16 address);
+  void writeSlow(u16 address, u8 value);
+  u8 readMemory(u16 address);
+  void writeMemory(u16 address, u8 value);
+  void writeRegister(u16 address, u8 value);
+
+  void mapPages(u8 first, u8 last, const u8* read, u8* write);
+  void mapMemory();
+  // Refreshes the pages for cartridge ROM and RAM after a bank switch, and page 0 for the boot ROM
+  void mapCartridge();
+  // Refreshes the VRAM and OAM pages for `videoMode`
+  void mapVideoMemory();
 };
\ No newline at end of file
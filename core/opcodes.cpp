@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <string.h>
+#include "./opcodes.hpp"
+
+// Replaces the operand placeholder in the mnemonic (d8, d16, a8, a16, r8) with its value.
+// Relative jumps are shown with their absolute target
+std::string disassemble(const u8* bytes, u16 address) {
+    u8 opCode = bytes[0];
+    if (opCode == 0xCB) {
+        return OPCODES[0x100 + bytes[1]].mnemonic;
+    }
+
+    const OpcodeInfo& info = OPCODES[opCode];
+    std::string text = info.mnemonic;
+    u16 operand = info.length == 3 ? (bytes[2] << 8) | bytes[1] : bytes[1];
+
+    const char* placeholder = nullptr;
+    char value[16];
+    switch (info.operand) {
+        case OPERAND_D8:
+            placeholder = "d8";
+            snprintf(value, sizeof(value), "$%02X", operand);
+            break;
+        case OPERAND_D16:
+            placeholder = "d16";
+            snprintf(value, sizeof(value), "$%04X", operand);
+            break;
+        case OPERAND_A8:
+            placeholder = "a8";
+            snprintf(value, sizeof(value), "$FF%02X", operand);
+            break;
+        case OPERAND_A16:
+            placeholder = "a16";
+            snprintf(value, sizeof(value), "$%04X", operand);
+            break;
+        case OPERAND_R8:
+            placeholder = "r8";
+            snprintf(value, sizeof(value), "$%04X", u16(address + 2 + (s8)operand));
+            break;
+        case OPERAND_SP_R8:
+            placeholder = "r8";
+            snprintf(value, sizeof(value), "%+d", (s8)operand);
+            break;
+        default:
+            break;
+    }
+
+    size_t at = placeholder != nullptr ? text.find(placeholder) : std::string::npos;
+    if (at != std::string::npos) {
+        size_t length = strlen(placeholder);
+        if (info.operand == OPERAND_SP_R8 && text[at - 1] == '+') {
+            //the sign comes with the value
+            at--;
+            length++;
+        }
+        text.replace(at, length, value);
+    }
+    return text;
+}
@@ -0,0 +1,354 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include "./util.hpp"
+
+// Static facts about every opcode, in one place for the interpreter, block cache, JIT,
+// recompiler and disassembler. Entries 0x000-0x0FF are the base opcodes, 0x100-0x1FF the
+// 0xCB-prefixed ones. Cycle counts are what `CPU::exec` returns for them, quirks included
+// https://www.pastraiser.com/cpu/gameboy/gameboy_opcodes.html
+
+enum OperandKind : u8 {
+  OPERAND_NONE,
+  OPERAND_D8,    //8-bit immediate
+  OPERAND_D16,   //16-bit immediate
+  OPERAND_A8,    //offset from 0xFF00
+  OPERAND_A16,   //absolute address
+  OPERAND_R8,    //signed jump offset from the next instruction
+  OPERAND_SP_R8, //signed offset added to SP
+  OPERAND_CB,    //the prefixed opcode
+};
+
+// `OpcodeInfo::flags`
+const u8 OP_READS_MEMORY = 1 << 0;  //reads memory besides its own operand bytes
+const u8 OP_WRITES_MEMORY = 1 << 1;
+const u8 OP_JUMP = 1 << 2;          //may move pc somewhere other than the next instruction
+const u8 OP_CONDITIONAL = 1 << 3;   //takes `takenCycles` instead of `cycles` when the branch is taken
+const u8 OP_CALL = 1 << 4;          //pushes a return address: CALL and RST
+const u8 OP_HALT = 1 << 5;          //HALT and STOP
+const u8 OP_ILLEGAL = 1 << 6;
+
+struct OpcodeInfo {
+  const char* mnemonic;
+  u8 length; //in bytes, including the opcode. Prefixed opcodes count the 0xCB too
+  u8 cycles;
+  u8 takenCycles;
+  OperandKind operand;
+  u8 flags;
+
+  // Anything after this instruction can't be decoded ahead of time as part of the same block
+  constexpr bool endsBlock() const { return flags & (OP_JUMP | OP_HALT | OP_ILLEGAL); }
+};
+
+constexpr OpcodeInfo BASE_OPCODES[256] = {
+  { "NOP",           1,  4,  4, OPERAND_NONE,   0 }, //0x00
+  { "LD BC,d16",     3, 12, 12, OPERAND_D16,    0 }, //0x01
+  { "LD (BC),A",     1,  8,  8, OPERAND_NONE,   OP_WRITES_MEMORY }, //0x02
+  { "INC BC",        1,  8,  8, OPERAND_NONE,   0 }, //0x03
+  { "INC B",         1,  4,  4, OPERAND_NONE,   0 }, //0x04
+  { "DEC B",         1,  4,  4, OPERAND_NONE,   0 }, //0x05
+  { "LD B,d8",       2,  8,  8, OPERAND_D8,     0 }, //0x06
+  { "RLCA",          1,  4,  4, OPERAND_NONE,   0 }, //0x07
+  { "LD (a16),SP",   3, 20, 20, OPERAND_A16,    OP_WRITES_MEMORY }, //0x08
+  { "ADD HL,BC",     1,  8,  8, OPERAND_NONE,   0 }, //0x09
+  { "LD A,(BC)",     1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0x0A
+  { "DEC BC",        1,  8,  8, OPERAND_NONE,   0 }, //0x0B
+  { "INC C",         1,  4,  4, OPERAND_NONE,   0 }, //0x0C
+  { "DEC C",         1,  4,  4, OPERAND_NONE,   0 }, //0x0D
+  { "LD C,d8",       2,  8,  8, OPERAND_D8,     0 }, //0x0E
+  { "RRCA",          1,  4,  4, OPERAND_NONE,   0 }, //0x0F
+  { "STOP",          2,  4,  4, OPERAND_NONE,   OP_HALT }, //0x10
+  { "LD DE,d16",     3, 12, 12, OPERAND_D16,    0 }, //0x11
+  { "LD (DE),A",     1,  8,  8, OPERAND_NONE,   OP_WRITES_MEMORY }, //0x12
+  { "INC DE",        1,  8,  8, OPERAND_NONE,   0 }, //0x13
+  { "INC D",         1,  4,  4, OPERAND_NONE,   0 }, //0x14
+  { "DEC D",         1,  4,  4, OPERAND_NONE,   0 }, //0x15
+  { "LD D,d8",       2,  8,  8, OPERAND_D8,     0 }, //0x16
+  { "RLA",           1,  4,  4, OPERAND_NONE,   0 }, //0x17
+  { "JR r8",         2, 12, 12, OPERAND_R8,     OP_JUMP }, //0x18
+  { "ADD HL,DE",     1,  8,  8, OPERAND_NONE,   0 }, //0x19
+  { "LD A,(DE)",     1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0x1A
+  { "DEC DE",        1,  8,  8, OPERAND_NONE,   0 }, //0x1B
+  { "INC E",         1,  4,  4, OPERAND_NONE,   0 }, //0x1C
+  { "DEC E",         1,  4,  4, OPERAND_NONE,   0 }, //0x1D
+  { "LD E,d8",       2,  8,  8, OPERAND_D8,     0 }, //0x1E
+  { "RRA",           1,  4,  4, OPERAND_NONE,   0 }, //0x1F
+  { "JR NZ,r8",      2,  8, 12, OPERAND_R8,     OP_JUMP | OP_CONDITIONAL }, //0x20
+  { "LD HL,d16",     3, 12, 12, OPERAND_D16,    0 }, //0x21
+  { "LD (HL+),A",    1,  8,  8, OPERAND_NONE,   OP_WRITES_MEMORY }, //0x22
+  { "INC HL",        1,  8,  8, OPERAND_NONE,   0 }, //0x23
+  { "INC H",         1,  4,  4, OPERAND_NONE,   0 }, //0x24
+  { "DEC H",         1,  4,  4, OPERAND_NONE,   0 }, //0x25
+  { "LD H,d8",       2,  8,  8, OPERAND_D8,     0 }, //0x26
+  { "DAA",           1,  4,  4, OPERAND_NONE,   0 }, //0x27
+  { "JR Z,r8",       2,  8, 12, OPERAND_R8,     OP_JUMP | OP_CONDITIONAL }, //0x28
+  { "ADD HL,HL",     1,  8,  8, OPERAND_NONE,   0 }, //0x29
+  { "LD A,(HL+)",    1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0x2A
+  { "DEC HL",        1,  8,  8, OPERAND_NONE,   0 }, //0x2B
+  { "INC L",         1,  4,  4, OPERAND_NONE,   0 }, //0x2C
+  { "DEC L",         1,  4,  4, OPERAND_NONE,   0 }, //0x2D
+  { "LD L,d8",       2,  8,  8, OPERAND_D8,     0 }, //0x2E
+  { "CPL",           1,  4,  4, OPERAND_NONE,   0 }, //0x2F
+  { "JR NC,r8",      2,  8, 12, OPERAND_R8,     OP_JUMP | OP_CONDITIONAL }, //0x30
+  { "LD SP,d16",     3, 12, 12, OPERAND_D16,    0 }, //0x31
+  { "LD (HL-),A",    1,  8,  8, OPERAND_NONE,   OP_WRITES_MEMORY }, //0x32
+  { "INC SP",        1,  8,  8, OPERAND_NONE,   0 }, //0x33
+  { "INC (HL)",      1, 12, 12, OPERAND_NONE,   OP_READS_MEMORY | OP_WRITES_MEMORY }, //0x34
+  { "DEC (HL)",      1, 12, 12, OPERAND_NONE,   OP_READS_MEMORY | OP_WRITES_MEMORY }, //0x35
+  { "LD (HL),d8",    2, 12, 12, OPERAND_D8,     OP_WRITES_MEMORY }, //0x36
+  { "SCF",           1,  4,  4, OPERAND_NONE,   0 }, //0x37
+  { "JR C,r8",       2,  8, 12, OPERAND_R8,     OP_JUMP | OP_CONDITIONAL }, //0x38
+  { "ADD HL,SP",     1,  8,  8, OPERAND_NONE,   0 }, //0x39
+  { "LD A,(HL-)",    1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0x3A
+  { "DEC SP",        1,  8,  8, OPERAND_NONE,   0 }, //0x3B
+  { "INC A",         1,  4,  4, OPERAND_NONE,   0 }, //0x3C
+  { "DEC A",         1,  4,  4, OPERAND_NONE,   0 }, //0x3D
+  { "LD A,d8",       2,  8,  8, OPERAND_D8,     0 }, //0x3E
+  { "CCF",           1,  4,  4, OPERAND_NONE,   0 }, //0x3F
+  { "LD B,B",        1,  4,  4, OPERAND_NONE,   0 }, //0x40
+  { "LD B,C",        1,  4,  4, OPERAND_NONE,   0 }, //0x41
+  { "LD B,D",        1,  4,  4, OPERAND_NONE,   0 }, //0x42
+  { "LD B,E",        1,  4,  4, OPERAND_NONE,   0 }, //0x43
+  { "LD B,H",        1,  4,  4, OPERAND_NONE,   0 }, //0x44
+  { "LD B,L",        1,  4,  4, OPERAND_NONE,   0 }, //0x45
+  { "LD B,(HL)",     1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0x46
+  { "LD B,A",        1,  4,  4, OPERAND_NONE,   0 }, //0x47
+  { "LD C,B",        1,  4,  4, OPERAND_NONE,   0 }, //0x48
+  { "LD C,C",        1,  4,  4, OPERAND_NONE,   0 }, //0x49
+  { "LD C,D",        1,  4,  4, OPERAND_NONE,   0 }, //0x4A
+  { "LD C,E",        1,  4,  4, OPERAND_NONE,   0 }, //0x4B
+  { "LD C,H",        1,  4,  4, OPERAND_NONE,   0 }, //0x4C
+  { "LD C,L",        1,  4,  4, OPERAND_NONE,   0 }, //0x4D
+  { "LD C,(HL)",     1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0x4E
+  { "LD C,A",        1,  4,  4, OPERAND_NONE,   0 }, //0x4F
+  { "LD D,B",        1,  4,  4, OPERAND_NONE,   0 }, //0x50
+  { "LD D,C",        1,  4,  4, OPERAND_NONE,   0 }, //0x51
+  { "LD D,D",        1,  4,  4, OPERAND_NONE,   0 }, //0x52
+  { "LD D,E",        1,  4,  4, OPERAND_NONE,   0 }, //0x53
+  { "LD D,H",        1,  4,  4, OPERAND_NONE,   0 }, //0x54
+  { "LD D,L",        1,  4,  4, OPERAND_NONE,   0 }, //0x55
+  { "LD D,(HL)",     1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0x56
+  { "LD D,A",        1,  4,  4, OPERAND_NONE,   0 }, //0x57
+  { "LD E,B",        1,  4,  4, OPERAND_NONE,   0 }, //0x58
+  { "LD E,C",        1,  4,  4, OPERAND_NONE,   0 }, //0x59
+  { "LD E,D",        1,  4,  4, OPERAND_NONE,   0 }, //0x5A
+  { "LD E,E",        1,  4,  4, OPERAND_NONE,   0 }, //0x5B
+  { "LD E,H",        1,  4,  4, OPERAND_NONE,   0 }, //0x5C
+  { "LD E,L",        1,  4,  4, OPERAND_NONE,   0 }, //0x5D
+  { "LD E,(HL)",     1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0x5E
+  { "LD E,A",        1,  4,  4, OPERAND_NONE,   0 }, //0x5F
+  { "LD H,B",        1,  4,  4, OPERAND_NONE,   0 }, //0x60
+  { "LD H,C",        1,  4,  4, OPERAND_NONE,   0 }, //0x61
+  { "LD H,D",        1,  4,  4, OPERAND_NONE,   0 }, //0x62
+  { "LD H,E",        1,  4,  4, OPERAND_NONE,   0 }, //0x63
+  { "LD H,H",        1,  4,  4, OPERAND_NONE,   0 }, //0x64
+  { "LD H,L",        1,  4,  4, OPERAND_NONE,   0 }, //0x65
+  { "LD H,(HL)",     1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0x66
+  { "LD H,A",        1,  4,  4, OPERAND_NONE,   0 }, //0x67
+  { "LD L,B",        1,  4,  4, OPERAND_NONE,   0 }, //0x68
+  { "LD L,C",        1,  4,  4, OPERAND_NONE,   0 }, //0x69
+  { "LD L,D",        1,  4,  4, OPERAND_NONE,   0 }, //0x6A
+  { "LD L,E",        1,  4,  4, OPERAND_NONE,   0 }, //0x6B
+  { "LD L,H",        1,  4,  4, OPERAND_NONE,   0 }, //0x6C
+  { "LD L,L",        1,  4,  4, OPERAND_NONE,   0 }, //0x6D
+  { "LD L,(HL)",     1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0x6E
+  { "LD L,A",        1,  4,  4, OPERAND_NONE,   0 }, //0x6F
+  { "LD (HL),B",     1,  8,  8, OPERAND_NONE,   OP_WRITES_MEMORY }, //0x70
+  { "LD (HL),C",     1,  8,  8, OPERAND_NONE,   OP_WRITES_MEMORY }, //0x71
+  { "LD (HL),D",     1,  8,  8, OPERAND_NONE,   OP_WRITES_MEMORY }, //0x72
+  { "LD (HL),E",     1,  8,  8, OPERAND_NONE,   OP_WRITES_MEMORY }, //0x73
+  { "LD (HL),H",     1,  8,  8, OPERAND_NONE,   OP_WRITES_MEMORY }, //0x74
+  { "LD (HL),L",     1,  8,  8, OPERAND_NONE,   OP_WRITES_MEMORY }, //0x75
+  { "HALT",          1,  4,  4, OPERAND_NONE,   OP_HALT }, //0x76
+  { "LD (HL),A",     1,  8,  8, OPERAND_NONE,   OP_WRITES_MEMORY }, //0x77
+  { "LD A,B",        1,  4,  4, OPERAND_NONE,   0 }, //0x78
+  { "LD A,C",        1,  4,  4, OPERAND_NONE,   0 }, //0x79
+  { "LD A,D",        1,  4,  4, OPERAND_NONE,   0 }, //0x7A
+  { "LD A,E",        1,  4,  4, OPERAND_NONE,   0 }, //0x7B
+  { "LD A,H",        1,  4,  4, OPERAND_NONE,   0 }, //0x7C
+  { "LD A,L",        1,  4,  4, OPERAND_NONE,   0 }, //0x7D
+  { "LD A,(HL)",     1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0x7E
+  { "LD A,A",        1,  4,  4, OPERAND_NONE,   0 }, //0x7F
+  { "ADD A,B",       1,  4,  4, OPERAND_NONE,   0 }, //0x80
+  { "ADD A,C",       1,  4,  4, OPERAND_NONE,   0 }, //0x81
+  { "ADD A,D",       1,  4,  4, OPERAND_NONE,   0 }, //0x82
+  { "ADD A,E",       1,  4,  4, OPERAND_NONE,   0 }, //0x83
+  { "ADD A,H",       1,  4,  4, OPERAND_NONE,   0 }, //0x84
+  { "ADD A,L",       1,  4,  4, OPERAND_NONE,   0 }, //0x85
+  { "ADD A,(HL)",    1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0x86
+  { "ADD A,A",       1,  4,  4, OPERAND_NONE,   0 }, //0x87
+  { "ADC A,B",       1,  4,  4, OPERAND_NONE,   0 }, //0x88
+  { "ADC A,C",       1,  4,  4, OPERAND_NONE,   0 }, //0x89
+  { "ADC A,D",       1,  4,  4, OPERAND_NONE,   0 }, //0x8A
+  { "ADC A,E",       1,  4,  4, OPERAND_NONE,   0 }, //0x8B
+  { "ADC A,H",       1,  4,  4, OPERAND_NONE,   0 }, //0x8C
+  { "ADC A,L",       1,  4,  4, OPERAND_NONE,   0 }, //0x8D
+  { "ADC A,(HL)",    1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0x8E
+  { "ADC A,A",       1,  4,  4, OPERAND_NONE,   0 }, //0x8F
+  { "SUB B",         1,  4,  4, OPERAND_NONE,   0 }, //0x90
+  { "SUB C",         1,  4,  4, OPERAND_NONE,   0 }, //0x91
+  { "SUB D",         1,  4,  4, OPERAND_NONE,   0 }, //0x92
+  { "SUB E",         1,  4,  4, OPERAND_NONE,   0 }, //0x93
+  { "SUB H",         1,  4,  4, OPERAND_NONE,   0 }, //0x94
+  { "SUB L",         1,  4,  4, OPERAND_NONE,   0 }, //0x95
+  { "SUB (HL)",      1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0x96
+  { "SUB A",         1,  4,  4, OPERAND_NONE,   0 }, //0x97
+  { "SBC A,B",       1,  4,  4, OPERAND_NONE,   0 }, //0x98
+  { "SBC A,C",       1,  4,  4, OPERAND_NONE,   0 }, //0x99
+  { "SBC A,D",       1,  4,  4, OPERAND_NONE,   0 }, //0x9A
+  { "SBC A,E",       1,  4,  4, OPERAND_NONE,   0 }, //0x9B
+  { "SBC A,H",       1,  4,  4, OPERAND_NONE,   0 }, //0x9C
+  { "SBC A,L",       1,  4,  4, OPERAND_NONE,   0 }, //0x9D
+  { "SBC A,(HL)",    1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0x9E
+  { "SBC A,A",       1,  4,  4, OPERAND_NONE,   0 }, //0x9F
+  { "AND B",         1,  4,  4, OPERAND_NONE,   0 }, //0xA0
+  { "AND C",         1,  4,  4, OPERAND_NONE,   0 }, //0xA1
+  { "AND D",         1,  4,  4, OPERAND_NONE,   0 }, //0xA2
+  { "AND E",         1,  4,  4, OPERAND_NONE,   0 }, //0xA3
+  { "AND H",         1,  4,  4, OPERAND_NONE,   0 }, //0xA4
+  { "AND L",         1,  4,  4, OPERAND_NONE,   0 }, //0xA5
+  { "AND (HL)",      1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0xA6
+  { "AND A",         1,  4,  4, OPERAND_NONE,   0 }, //0xA7
+  { "XOR B",         1,  4,  4, OPERAND_NONE,   0 }, //0xA8
+  { "XOR C",         1,  4,  4, OPERAND_NONE,   0 }, //0xA9
+  { "XOR D",         1,  4,  4, OPERAND_NONE,   0 }, //0xAA
+  { "XOR E",         1,  4,  4, OPERAND_NONE,   0 }, //0xAB
+  { "XOR H",         1,  4,  4, OPERAND_NONE,   0 }, //0xAC
+  { "XOR L",         1,  4,  4, OPERAND_NONE,   0 }, //0xAD
+  { "XOR (HL)",      1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0xAE
+  { "XOR A",         1,  4,  4, OPERAND_NONE,   0 }, //0xAF
+  { "OR B",          1,  4,  4, OPERAND_NONE,   0 }, //0xB0
+  { "OR C",          1,  4,  4, OPERAND_NONE,   0 }, //0xB1
+  { "OR D",          1,  4,  4, OPERAND_NONE,   0 }, //0xB2
+  { "OR E",          1,  4,  4, OPERAND_NONE,   0 }, //0xB3
+  { "OR H",          1,  4,  4, OPERAND_NONE,   0 }, //0xB4
+  { "OR L",          1,  4,  4, OPERAND_NONE,   0 }, //0xB5
+  { "OR (HL)",       1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0xB6
+  { "OR A",          1,  4,  4, OPERAND_NONE,   0 }, //0xB7
+  { "CP B",          1,  4,  4, OPERAND_NONE,   0 }, //0xB8
+  { "CP C",          1,  4,  4, OPERAND_NONE,   0 }, //0xB9
+  { "CP D",          1,  4,  4, OPERAND_NONE,   0 }, //0xBA
+  { "CP E",          1,  4,  4, OPERAND_NONE,   0 }, //0xBB
+  { "CP H",          1,  4,  4, OPERAND_NONE,   0 }, //0xBC
+  { "CP L",          1,  4,  4, OPERAND_NONE,   0 }, //0xBD
+  { "CP (HL)",       1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0xBE
+  { "CP A",          1,  4,  4, OPERAND_NONE,   0 }, //0xBF
+  { "RET NZ",        1,  8, 20, OPERAND_NONE,   OP_READS_MEMORY | OP_JUMP | OP_CONDITIONAL }, //0xC0
+  { "POP BC",        1, 12, 12, OPERAND_NONE,   OP_READS_MEMORY }, //0xC1
+  { "JP NZ,a16",     3, 12, 16, OPERAND_A16,    OP_JUMP | OP_CONDITIONAL }, //0xC2
+  { "JP a16",        3, 16, 16, OPERAND_A16,    OP_JUMP }, //0xC3
+  { "CALL NZ,a16",   3, 12, 24, OPERAND_A16,    OP_WRITES_MEMORY | OP_JUMP | OP_CALL | OP_CONDITIONAL }, //0xC4
+  { "PUSH BC",       1, 16, 16, OPERAND_NONE,   OP_WRITES_MEMORY }, //0xC5
+  { "ADD A,d8",      2,  8,  8, OPERAND_D8,     0 }, //0xC6
+  { "RST 00H",       1, 16, 16, OPERAND_NONE,   OP_WRITES_MEMORY | OP_JUMP | OP_CALL }, //0xC7
+  { "RET Z",         1,  8, 20, OPERAND_NONE,   OP_READS_MEMORY | OP_JUMP | OP_CONDITIONAL }, //0xC8
+  { "RET",           1, 16, 16, OPERAND_NONE,   OP_READS_MEMORY | OP_JUMP }, //0xC9
+  { "JP Z,a16",      3, 12, 16, OPERAND_A16,    OP_JUMP | OP_CONDITIONAL }, //0xCA
+  { "PREFIX CB",     2,  0,  0, OPERAND_CB,     0 }, //0xCB
+  { "CALL Z,a16",    3, 12, 24, OPERAND_A16,    OP_WRITES_MEMORY | OP_JUMP | OP_CALL | OP_CONDITIONAL }, //0xCC
+  { "CALL a16",      3, 24, 24, OPERAND_A16,    OP_WRITES_MEMORY | OP_JUMP | OP_CALL }, //0xCD
+  { "ADC A,d8",      2,  4,  4, OPERAND_D8,     0 }, //0xCE
+  { "RST 08H",       1, 16, 16, OPERAND_NONE,   OP_WRITES_MEMORY | OP_JUMP | OP_CALL }, //0xCF
+  { "RET NC",        1,  8, 20, OPERAND_NONE,   OP_READS_MEMORY | OP_JUMP | OP_CONDITIONAL }, //0xD0
+  { "POP DE",        1, 12, 12, OPERAND_NONE,   OP_READS_MEMORY }, //0xD1
+  { "JP NC,a16",     3, 12, 16, OPERAND_A16,    OP_JUMP | OP_CONDITIONAL }, //0xD2
+  { "ILLEGAL",       1,  4,  4, OPERAND_NONE,   OP_ILLEGAL }, //0xD3
+  { "CALL NC,a16",   3, 12, 24, OPERAND_A16,    OP_WRITES_MEMORY | OP_JUMP | OP_CALL | OP_CONDITIONAL }, //0xD4
+  { "PUSH DE",       1, 16, 16, OPERAND_NONE,   OP_WRITES_MEMORY }, //0xD5
+  { "SUB d8",        2,  4,  4, OPERAND_D8,     0 }, //0xD6
+  { "RST 10H",       1, 16, 16, OPERAND_NONE,   OP_WRITES_MEMORY | OP_JUMP | OP_CALL }, //0xD7
+  { "RET C",         1,  8, 20, OPERAND_NONE,   OP_READS_MEMORY | OP_JUMP | OP_CONDITIONAL }, //0xD8
+  { "RETI",          1, 16, 16, OPERAND_NONE,   OP_READS_MEMORY | OP_JUMP }, //0xD9
+  { "JP C,a16",      3, 12, 16, OPERAND_A16,    OP_JUMP | OP_CONDITIONAL }, //0xDA
+  { "ILLEGAL",       1,  4,  4, OPERAND_NONE,   OP_ILLEGAL }, //0xDB
+  { "CALL C,a16",    3, 12, 24, OPERAND_A16,    OP_WRITES_MEMORY | OP_JUMP | OP_CALL | OP_CONDITIONAL }, //0xDC
+  { "ILLEGAL",       1,  4,  4, OPERAND_NONE,   OP_ILLEGAL }, //0xDD
+  { "SBC A,d8",      2,  8,  8, OPERAND_D8,     0 }, //0xDE
+  { "RST 18H",       1, 16, 16, OPERAND_NONE,   OP_WRITES_MEMORY | OP_JUMP | OP_CALL }, //0xDF
+  { "LDH (a8),A",    2, 12, 12, OPERAND_A8,     OP_WRITES_MEMORY }, //0xE0
+  { "POP HL",        1, 12, 12, OPERAND_NONE,   OP_READS_MEMORY }, //0xE1
+  { "LD (C),A",      1,  8,  8, OPERAND_NONE,   OP_WRITES_MEMORY }, //0xE2
+  { "ILLEGAL",       1,  4,  4, OPERAND_NONE,   OP_ILLEGAL }, //0xE3
+  { "ILLEGAL",       1,  4,  4, OPERAND_NONE,   OP_ILLEGAL }, //0xE4
+  { "PUSH HL",       1, 16, 16, OPERAND_NONE,   OP_WRITES_MEMORY }, //0xE5
+  { "AND d8",        2,  8,  8, OPERAND_D8,     0 }, //0xE6
+  { "RST 20H",       1, 16, 16, OPERAND_NONE,   OP_WRITES_MEMORY | OP_JUMP | OP_CALL }, //0xE7
+  { "ADD SP,r8",     2, 16, 16, OPERAND_SP_R8,  0 }, //0xE8
+  { "JP HL",         1,  4,  4, OPERAND_NONE,   OP_JUMP }, //0xE9
+  { "LD (a16),A",    3, 16, 16, OPERAND_A16,    OP_WRITES_MEMORY }, //0xEA
+  { "ILLEGAL",       1,  4,  4, OPERAND_NONE,   OP_ILLEGAL }, //0xEB
+  { "ILLEGAL",       1,  4,  4, OPERAND_NONE,   OP_ILLEGAL }, //0xEC
+  { "ILLEGAL",       1,  4,  4, OPERAND_NONE,   OP_ILLEGAL }, //0xED
+  { "XOR d8",        2,  8,  8, OPERAND_D8,     0 }, //0xEE
+  { "RST 28H",       1, 16, 16, OPERAND_NONE,   OP_WRITES_MEMORY | OP_JUMP | OP_CALL }, //0xEF
+  { "LDH A,(a8)",    2, 12, 12, OPERAND_A8,     OP_READS_MEMORY }, //0xF0
+  { "POP AF",        1, 12, 12, OPERAND_NONE,   OP_READS_MEMORY }, //0xF1
+  { "LD A,(C)",      1,  8,  8, OPERAND_NONE,   OP_READS_MEMORY }, //0xF2
+  { "DI",            1,  4,  4, OPERAND_NONE,   0 }, //0xF3
+  { "ILLEGAL",       1,  4,  4, OPERAND_NONE,   OP_ILLEGAL }, //0xF4
+  { "PUSH AF",       1, 16, 16, OPERAND_NONE,   OP_WRITES_MEMORY }, //0xF5
+  { "OR d8",         2,  8,  8, OPERAND_D8,     0 }, //0xF6
+  { "RST 30H",       1, 16, 16, OPERAND_NONE,   OP_WRITES_MEMORY | OP_JUMP | OP_CALL }, //0xF7
+  { "LD HL,SP+r8",   2, 12, 12, OPERAND_SP_R8,  0 }, //0xF8
+  { "LD SP,HL",      1,  8,  8, OPERAND_NONE,   0 }, //0xF9
+  { "LD A,(a16)",    3, 16, 16, OPERAND_A16,    OP_READS_MEMORY }, //0xFA
+  { "EI",            1,  4,  4, OPERAND_NONE,   0 }, //0xFB
+  { "ILLEGAL",       1,  4,  4, OPERAND_NONE,   OP_ILLEGAL }, //0xFC
+  { "ILLEGAL",       1,  4,  4, OPERAND_NONE,   OP_ILLEGAL }, //0xFD
+  { "CP d8",         2,  8,  8, OPERAND_D8,     0 }, //0xFE
+  { "RST 38H",       1, 16, 16, OPERAND_NONE,   OP_WRITES_MEMORY | OP_JUMP | OP_CALL }, //0xFF
+};
+
+// Prefixed opcodes follow a regular pattern, so they are generated
+struct CBMnemonics {
+  char text[256][12];
+};
+
+constexpr CBMnemonics makeCBMnemonics() {
+  const char* operations[8] = { "RLC ", "RRC ", "RL ", "RR ", "SLA ", "SRA ", "SWAP ", "SRL " };
+  const char* bitOperations[3] = { "BIT ", "RES ", "SET " };
+  const char* registers[8] = { "B", "C", "D", "E", "H", "L", "(HL)", "A" };
+  CBMnemonics mnemonics = {};
+  for (int opCode = 0; opCode < 256; opCode++) {
+    char* out = mnemonics.text[opCode];
+    const char* operation = opCode < 0x40 ? operations[opCode >> 3] : bitOperations[(opCode >> 6) - 1];
+    while (*operation) { *out++ = *operation++; }
+    if (opCode >= 0x40) {
+      *out++ = '0' + ((opCode >> 3) & 0x7);
+      *out++ = ',';
+    }
+    const char* reg = registers[opCode & 0x7];
+    while (*reg) { *out++ = *reg++; }
+  }
+  return mnemonics;
+}
+
+inline constexpr CBMnemonics CB_MNEMONICS = makeCBMnemonics();
+
+constexpr std::array<OpcodeInfo, 512> makeOpcodeTable() {
+  std::array<OpcodeInfo, 512> table = {};
+  for (int opCode = 0; opCode < 256; opCode++) {
+    table[opCode] = BASE_OPCODES[opCode];
+
+    bool hlOperand = (opCode & 0x7) == 6;
+    bool isBit = opCode >= 0x40 && opCode < 0x80;
+    u8 flags = 0;
+    if (hlOperand) {
+      flags = isBit ? OP_READS_MEMORY : OP_READS_MEMORY | OP_WRITES_MEMORY;
+    }
+    u8 cycles = hlOperand ? 16 : 8;
+    table[0x100 + opCode] = { CB_MNEMONICS.text[opCode], 2, cycles, cycles, OPERAND_NONE, flags };
+  }
+  return table;
+}
+
+inline constexpr std::array<OpcodeInfo, 512> OPCODES = makeOpcodeTable();
+
+// Looks through the 0xCB prefix; `operand` is only used when `opCode` is 0xCB
+constexpr const OpcodeInfo& getOpcodeInfo(u8 opCode, u16 operand) {
+  return opCode == 0xCB ? OPCODES[0x100 + (operand & 0xFF)] : OPCODES[opCode];
+}
+
+// `bytes` holds the opcode and up to two operand bytes, `address` is where they were read from
+std::string disassemble(const u8* bytes, u16 address);
@@ -1,8 +1,19 @@
 #include "./ppu.hpp"
 
-PPU::PPU(MMU* mmu, CPU* cpu, Palette palette) : mmu(mmu), cpu(cpu), palette(palette) {
+PPU::PPU(MMU* mmu, InterruptController* interrupts, Palette palette) : mmu(mmu), interrupts(interrupts), palette(palette) {
   mode = OAM;
   cyclesLeft = 0;
+  for (u16 address = LCDC; address <= WX; address++) {
+    if (address != DMA) {
+      mmu->mapIORegister(address, this,
+        [](void* ppu, u16 address) { return ((PPU*)ppu)->readRegister(address); },
+        [](void* ppu, u16 address, u8 value) { ((PPU*)ppu)->writeRegister(address, value); });
+    }
+  }
+  for (u16 tile = 0; tile < TILE_ROWS / 8; tile++) {
+    decodeTile(tile);
+  }
+  tileGeneration = mmu->nextGeneration();
 }
 
 void PPU::updatePalette(Palette palette) {
@@ -11,7 +22,7 @@ void PPU::updatePalette(Palette palette) {
 
 // LCDC (0xFF40) - LCD Control
   // (see lcdc helper functions)
-u8 PPU::get_lcdc() { return mmu->readDirectly(LCDC); }
+u8 PPU::get_lcdc() { return lcdc; }
 // STAT (0xFF41) - LCD Status
   // Bit 6 - LYC=LY STAT Interrupt source         (1=Enable) (Read/Write)
   // Bit 5 - Mode 2 OAM STAT Interrupt source     (1=Enable) (Read/Write)
@@ -23,16 +34,16 @@ u8 PPU::get_lcdc() { return mmu->readDirectly(LCDC); }
   //           1: VBlank
   //           2: Searching OAM
   //           3: Transferring Data to LCD Controller
-u8 PPU::get_stat() { return mmu->readDirectly(STAT); }
+u8 PPU::get_stat() { return stat; }
 // ScrollY (0xFF42) - y pos of background
-u8 PPU::get_scy() { return mmu->readDirectly(SCY); }
+u8 PPU::get_scy() { return scy; }
 // ScrollX (0xFF43) - x pos of background
-u8 PPU::get_scx() { return mmu->readDirectly(SCX); }
+u8 PPU::get_scx() { return scx; }
 // LY (0xFF44) - LCD Y Coordinate (aka current scanline)
 // Holds values 0-153, with 144-153 indicating VBLANK
-u8 PPU::get_ly() { return mmu->readDirectly(LY); }
+u8 PPU::get_ly() { return ly; }
 // LYC (0xFF45) - LY Compare
-u8 PPU::get_lyc() { return mmu->readDirectly(LYC); }
+u8 PPU::get_lyc() { return lyc; }
 // DMA (0xFF46) - DMA Transfer and Start (160 cycles?)
 u8 PPU::get_dma() { return mmu->readDirectly(DMA); }
 // bgp (0xFF47) - BG palette data
@@ -40,20 +51,63 @@ u8 PPU::get_dma() { return mmu->readDirectly(DMA); }
   // Bit 5-4 Color for index 2
   // Bit 3-2 Color for index 1
   // Bit 1-0 Color for index 0
-u8 PPU::get_bgp() { return mmu->readDirectly(BGP); }
+u8 PPU::get_bgp() { return bgp; }
 // obp0 (0xFF48) - OBJ palette 0 dataQ
 // Just like bgp but bits 1-0 ignored because color index 0 is transparent for sprites
-u8 PPU::get_obp0() { return mmu->readDirectly(OBP0); }
+u8 PPU::get_obp0() { return obp0; }
 // obp1 (0XFF49) - OBJ palette 1 data
-u8 PPU::get_obp1() { return mmu->readDirectly(OBP1); }
+u8 PPU::get_obp1() { return obp1; }
 
-u8 PPU::get_wy() { return mmu->readDirectly(WY); }
-u8 PPU::get_wx() { return mmu->readDirectly(WX); }
+u8 PPU::get_wy() { return wy; }
+u8 PPU::get_wx() { return wx; }
 
 u8* PPU::getFrameBuffer() { return frameBuffer; }
 
 // Define setters as needed
-void PPU::set_ly(u8 ly) { mmu->writeDirectly(LY, ly); }
+void PPU::set_ly(u8 scanline) { ly = scanline; }
+
+u8 PPU::readRegister(u16 address) {
+  switch (address) {
+    case LCDC: return lcdc;
+    case STAT: return stat;
+    case SCY: return scy;
+    case SCX: return scx;
+    case LY: return ly;
+    case LYC: return lyc;
+    case BGP: return bgp;
+    case OBP0: return obp0;
+    case OBP1: return obp1;
+    case WY: return wy;
+    default: return wx;
+  }
+}
+
+// Writes land as they did in memory: STAT and LY take the whole value, and turning the LCD off
+// only takes effect at the next `step`
+void PPU::writeRegister(u16 address, u8 value) {
+  switch (address) {
+    case LCDC: lcdc = value; break;
+    case STAT:
+      stat = value;
+      mmu->setVideoMode(value & 0x3);
+      break;
+    case SCY: scy = value; break;
+    case SCX: scx = value; break;
+    case LY: ly = value; break;
+    case LYC: lyc = value; break;
+    case BGP: bgp = value; break;
+    case OBP0: obp0 = value; break;
+    case OBP1: obp1 = value; break;
+    case WY: wy = value; break;
+    case WX: wx = value; break;
+  }
+}
+
+void PPU::setMode(Mode mode) {
+  this->mode = mode;
+  stat = (stat & ~0x3) | mode;
+  mmu->setVideoMode(mode);
+}
 
 // lcdc register helper functions 
 // Bit 7	LCD and PPU enable	0=Off, 1=On
@@ -73,14 +127,10 @@ bool PPU::isObjEnabled() { return checkBit(get_lcdc(), 1); }
 // Bit 0	BG and Window enable/priority	0=Off, 1=On
 bool PPU::isBgWinEnabled() { return checkBit(get_lcdc(), 0); }
 
-void PPU::step(u8 cpuCyclesElapsed) {
+void PPU::step(u16 cpuCyclesElapsed) {
 
   if (!isLCDEnabled()) { 
-    mode = HBLANK;
-    u8 stat = get_stat();
-    stat = clearBit(stat, 0);
-    stat = clearBit(stat, 1);
-    mmu->writeDirectly(STAT, stat);
+    setMode(HBLANK);
     set_ly(0);
     return;
   }
@@ -98,11 +148,7 @@ void PPU::step(u8 cpuCyclesElapsed) {
       if (cyclesLeft >= OAM_CLOCKS) {
         cyclesLeft -= OAM_CLOCKS;
         
-        mode = VRAM;
-        u8 stat = get_stat();
-        stat = setBit(stat, 0);
-        stat = setBit(stat, 1);
-        mmu->writeDirectly(STAT, stat);
+        setMode(VRAM);
       }
       break;
     case VRAM:
@@ -111,15 +157,11 @@ void PPU::step(u8 cpuCyclesElapsed) {
 
         drawScanLine();
         
-        mode = HBLANK;
-        u8 stat = get_stat();
-        stat = clearBit(stat, 0);
-        stat = clearBit(stat, 1);
-        mmu->writeDirectly(STAT, stat);
+        setMode(HBLANK);
 
         // HBLANK stat interrupt
         if (checkBit(get_stat(), 3)) {
-          cpu->requestInterrupt(Interrupt::LCD_STAT);
+          interrupts->request(Interrupt::LCD_STAT);
         }
       }
       break;
@@ -129,34 +171,26 @@ void PPU::step(u8 cpuCyclesElapsed) {
 
         // get and increment scanline
         u8 scanline = get_ly() + 1;
-        mmu->writeDirectly(LY, scanline);
+        set_ly(scanline);
 
         // check lyc interupt
         checkLYC(scanline);
         
         // check current scanline >= 144, then enter VBLANK, else enter OAM to prepare to draw another line
         if (scanline >= 144) {
-          mode = VBLANK;
-          cpu->requestInterrupt(VBLANK_INT); 
-          u8 stat = get_stat();
-          stat = setBit(stat, 0);
-          stat = clearBit(stat, 1);
-          mmu->writeDirectly(STAT, stat);
+          setMode(VBLANK);
+          interrupts->request(VBLANK_INT); 
 
           // VBLANK stat interrupt 
           if (checkBit(get_stat(), 4)) {
-            cpu->requestInterrupt(Interrupt::LCD_STAT);
+            interrupts->request(Interrupt::LCD_STAT);
           }
         } else {
-          mode = OAM;
-          u8 stat = get_stat();
-          stat = clearBit(stat, 0);
-          stat = setBit(stat, 1);
-          mmu->writeDirectly(STAT, stat);
+          setMode(OAM);
 
           // OAM stat interrupt
           if (checkBit(get_stat(), 5)) {
-            cpu->requestInterrupt(Interrupt::LCD_STAT);
+            interrupts->request(Interrupt::LCD_STAT);
           }
         }
       }
@@ -167,7 +201,7 @@ void PPU::step(u8 cpuCyclesElapsed) {
 
         // increment current line
         u8 scanline = get_ly() + 1;
-        mmu->writeDirectly(LY, scanline);
+        set_ly(scanline);
 
         // check lyc interupt
         checkLYC(scanline);
@@ -176,17 +210,13 @@ void PPU::step(u8 cpuCyclesElapsed) {
         if (scanline >= 154) {
 
           // reset scanline to 0
-          mmu->writeDirectly(LY, 0);
+          set_ly(0);
           
-          mode = OAM;
-          u8 stat = get_stat();
-          stat = clearBit(stat, 0);
-          stat = setBit(stat, 1);
-          mmu->writeDirectly(STAT, stat);
+          setMode(OAM);
 
           // OAM stat interrupt
           if (checkBit(get_stat(), 5)) {
-            cpu->requestInterrupt(Interrupt::LCD_STAT);
+            interrupts->request(Interrupt::LCD_STAT);
           }
         }
       }
@@ -194,21 +224,34 @@ void PPU::step(u8 cpuCyclesElapsed) {
   }
 }
 
-void PPU::checkLYC(u8 scanline) {
-  u8 lyc = get_lyc();
-  u8 stat = get_stat();
+u16 PPU::getCyclesUntilChange() {
+  if (!isLCDEnabled()) {
+    // The next `step` still parks the PPU in HBLANK on line 0 if it isn't already
+    bool parked = mode == HBLANK && (get_stat() & 0x3) == 0 && get_ly() == 0;
+    return parked ? 0xFFFF : 0;
+  }
+  unsigned int modeClocks = VBLANK_CLOCKS;
+  if (mode == OAM) {
+    modeClocks = OAM_CLOCKS;
+  } else if (mode == VRAM) {
+    modeClocks = VRAM_CLOCKS;
+  } else if (mode == HBLANK) {
+    modeClocks = HBLANK_CLOCKS;
+  }
+  return cyclesLeft < modeClocks ? modeClocks - cyclesLeft : 0;
+}
 
+void PPU::checkLYC(u8 scanline) {
   if (scanline == lyc) {
     stat = setBit(stat, 2);
 
     // LYC=LY stat interrupt
-    if (checkBit(get_stat(), 6)) {
-      cpu->requestInterrupt(Interrupt::LCD_STAT);
+    if (checkBit(stat, 6)) {
+      interrupts->request(Interrupt::LCD_STAT);
     }
   } else {
     stat = clearBit(stat, 2);
   }
-  mmu->writeDirectly(STAT, stat);
 }
 
 // PPU mode typically goes from OAM -> VRAM -> HBLANK, repeating until VBLANK (aka mode 1)
@@ -217,6 +260,7 @@ void PPU::checkLYC(u8 scanline) {
   // VRAM - 172-289 clocks (43-72 cycles) [set default to start at 172?]
   // HBLANK - 87-204 clocks (22-51) cycles) (depending on prev) [set default to start at 289?]
 void PPU::drawScanLine() {
+  updateTiles();
 
   // Should rednering background and window be done separately for simplicity sake?
   if (isBgWinEnabled()) {
@@ -227,6 +271,34 @@ void PPU::drawScanLine() {
   }
 }
 
+// Pages of VRAM nothing wrote to since the last scanline are skipped without looking at their 16 tiles
+void PPU::updateTiles() {
+  for (u16 page = TILE_DATA >> 8; page < 0x98; page++) {
+    if (mmu->getPageGeneration(page) < tileGeneration) {
+      continue;
+    }
+    for (u16 tile = (page - 0x80) * 16; tile < (page - 0x7F) * 16; tile++) {
+      if (mmu->getVideoGeneration(TILE_DATA + tile * 16) >= tileGeneration) {
+        decodeTile(tile);
+      }
+    }
+  }
+  tileGeneration = mmu->nextGeneration();
+}
+
+// Pixel 0 of a row is bit 7 of its bytes; the second byte holds the high bit of each colour index
+void PPU::decodeTile(u16 tile) {
+  for (u16 row = tile * 8; row < tile * 8 + 8; row++) {
+    u8 low = mmu->readDirectly(TILE_DATA + row * 2);
+    u8 high = mmu->readDirectly(TILE_DATA + row * 2 + 1);
+    for (u8 pixel = 0; pixel < 8; pixel++) {
+      u8 colorId = (((high >> (7 - pixel)) & 1) << 1) | ((low >> (7 - pixel)) & 1);
+      tileRows[row][pixel] = colorId;
+      flippedTileRows[row][7 - pixel] = colorId;
+    }
+  }
+}
+
 // Tile Data in one of two locations: (controled by LCDC Bit 4)
   // 0X800-0X8FFF (unsigned numbers from 0 - 255)
   // 0X8800-0X97FF (singed nubmers from -128 - 127)
@@ -269,6 +341,12 @@ void PPU::renderTiles() {
 
   u8* pixelStartOfRow = frameBuffer + (LCD_WIDTH * 3 * currentLine);
 
+  // BGP can't change partway through a line
+  u8 colors[4];
+  for (int id = 0; id < 4; id++) {
+    colors[id] = getcolor(id, BGP);
+  }
+
   // draw current line of pixels
   for (int i = 0; i < LCD_WIDTH; i++) {
     u8 xPos = i + scrollX;
@@ -298,20 +376,9 @@ void PPU::renderTiles() {
       tileLoc += ((tileNum + 128) * 16);
     }
 
-     u8 line = yPos % 8;
-     line *= 2; // two bytes of mem per line
-     u8 byte1 = mmu->readDirectly(tileLoc + line);
-     u8 byte2 = mmu->readDirectly(tileLoc + line + 1);
-
-     int colorBit = xPos % 8;
-     colorBit -= 7;
-     colorBit *= -1;
-
-     int colorId = checkBit(byte2, colorBit);
-     colorId <<= 1;
-     colorId |= checkBit(byte1, colorBit);
-
-     int color = getcolor(colorId, BGP) ;
+    u8 line = yPos % 8;
+    int colorId = tileRows[(tileLoc - TILE_DATA) / 2 + line][xPos % 8];
+    int color = colors[colorId];
 
     u8* pixelStartLocation = pixelStartOfRow + 3 * i;
     pixelStartLocation[0] = palette[color][0];
@@ -321,7 +388,7 @@ void PPU::renderTiles() {
 }
 
 int PPU::getcolor(int id, u16 palette_address) {
-    u8 palette = mmu->readDirectly(palette_address);
+    u8 palette = readRegister(palette_address);
     int hi = 2 * id + 1;
     int lo = 2 * id;
     int bit1 = (palette >> hi) & 1;
@@ -379,34 +446,14 @@ void PPU::renderSprites() {
         line *= -1;
       }
 
-      // look up tile data
-      // 2 bytes of mem per line
-      line *= 2;
-      u16 sprite_addr = (0x8000 + (tileIndex * 16) + line);
-      u8 byte1 = mmu->readDirectly(sprite_addr);
-      u8 byte2 = mmu->readDirectly(sprite_addr + 1);
+      // look up tile data, a row of 8 pixels per 2 bytes
+      const u8* row = (xFlip ? flippedTileRows : tileRows)[tileIndex * 8 + line];
 
-      for (int k = 7; k >= 0; k--) {
-        int position = k;
-
-        if (xFlip) {
-          position -= 7;
-          position *= -1;
-        }
-
-        u8 colorId = 0;
-        if (checkBit(byte2, position)) {
-          colorId = setBit(colorId, 1);
-        }
-        if (checkBit(byte1, position)) {
-          colorId = setBit(colorId, 0);
-        }
-
-        int color = getcolor(colorId, pallete);
+      for (int xPixel = 0; xPixel < 8; xPixel++) {
+        u8 colorId = row[xPixel];
 
         if (colorId != 0) { // pixels with color index 0 (aka white) should be not rendered on sprites
-
-          int xPixel = 7 - k;
+          int color = getcolor(colorId, pallete);
           int pixel = xPos + xPixel;
         
           u8* pixelStartLocation = pixelStartOfRow + 3 * pixel;
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "./mmu.hpp"
-#include "./cpu.hpp"
+#include "./interrupts.hpp"
 #include "./palettes.hpp"
 #include "./util.hpp"
 
@@ -14,6 +14,8 @@ const u16 HBLANK_CLOCKS = 204;
 const u16 VBLANK_CLOCKS = 456;
 
 const u16 OAM_TABLE = 0xFE00;
+const u16 TILE_DATA = 0x8000;
+const u16 TILE_ROWS = 0x1800 / 2; //384 tiles of 8 rows, 2 bytes each
 
 const u16 LCDC = 0xFF40;
 const u16 STAT = 0xFF41;
@@ -43,10 +45,13 @@ public:
   // During restricted modes, any attempt to read returns $FF, any attempt to write are ignored
   Mode mode;
 
-  PPU(MMU* mmu, CPU* cpu, Palette palette);
+  PPU(MMU* mmu, InterruptController* interrupts, Palette palette);
 
   // Allow the PPU to cycle `cpuCyclesElapsed / 2` times per call
-  void step(u8 cpuCyclesElapsed);
+  void step(u16 cpuCyclesElapsed);
+  // How many cycles `step` can be given in total before the mode, LY or STAT next changes.
+  // Nothing changes while the LCD is off
+  u16 getCyclesUntilChange();
 
   // This is pulled out into a method, instead of public field access, so you only
   // have to update the buffer when SDL asks for it
@@ -67,7 +72,7 @@ public:
   u8 get_wx();
 
   // Register setters
-  void set_ly(u8 ly);
+  void set_ly(u8 scanline);
   
   void checkLYC(u8 scanline);
 
@@ -77,10 +82,27 @@ public:
     
 private:
   MMU* mmu; 
-  CPU* cpu;
+  InterruptController* interrupts;
 
   unsigned int cyclesLeft;
 
+  // LCDC-WX, which the PPU claims from the MMU at construction, except DMA
+  u8 lcdc = 0;
+  u8 stat = 0;
+  u8 scy = 0;
+  u8 scx = 0;
+  u8 ly = 0;
+  u8 lyc = 0;
+  u8 bgp = 0;
+  u8 obp0 = 0;
+  u8 obp1 = 0;
+  u8 wy = 0;
+  u8 wx = 0;
+  u8 readRegister(u16 address);
+  void writeRegister(u16 address, u8 value);
+  // Sets `mode` and the mode bits of STAT, and tells the MMU, which maps VRAM and OAM by mode
+  void setMode(Mode mode);
+
   // 'lcdc' register helper functions
   bool isLCDEnabled();
   u16 windowTileMapArea();
@@ -96,6 +118,16 @@ private:
   void renderTiles();
   void renderSprites();
 
+  // Tile data in 0x8000-0x97FF decoded to a colour index (0-3) per pixel, one row of 8 for every
+  // 2 bytes, so row `(address - TILE_DATA) / 2` holds the pixels of the 2 bytes at `address`. Rows
+  // in `flippedTileRows` are mirrored for sprites with X flip. A tile is only decoded again after
+  // the MMU's write generations show its 16 bytes were written
+  u8 tileRows[TILE_ROWS][8];
+  u8 flippedTileRows[TILE_ROWS][8];
+  u32 tileGeneration;
+  void updateTiles();
+  void decodeTile(u16 tile);
+
   Palette palette;
 
   // 160 x 144 x 3 (last dimenstion is pixel, rgb)
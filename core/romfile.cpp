@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <stdio.h>
+#include "./romfile.hpp"
+#include "./cartridge.hpp"
+#include "./idleloops.hpp"
+#include "./opcodes.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define ROM_MMAP
+#endif
+
+RomFile::RomFile(u8* data, u32 size, bool mapped) : data(data), size(size), mapped(mapped) {}
+
+RomFile::~RomFile() {
+    #ifdef ROM_MMAP
+    if (mapped) {
+        munmap(data, size);
+        return;
+    }
+    #endif
+    delete[] data;
+}
+
+// Cartridges index banks by the size in their header, so a file cut short of it is padded with zeros
+static u32 getPaddedSize(const u8* header, u32 headerLength, u32 size) {
+    if (headerLength <= ROM_SIZE_ADDRESS || header[ROM_SIZE_ADDRESS] > 0x08) {
+        return size;
+    }
+    return std::max(getRomSize(header[ROM_SIZE_ADDRESS]), size);
+}
+
+RomFile* RomFile::open(const char* path) {
+    #ifdef ROM_MMAP
+    int descriptor = ::open(path, O_RDONLY);
+    if (descriptor < 0) {
+        std::cerr << path << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    struct stat info;
+    bool statted = fstat(descriptor, &info) == 0;
+    if (!statted || !S_ISREG(info.st_mode)) {
+        std::cerr << path << ": " << (statted ? "not a regular file" : strerror(errno)) << std::endl;
+        close(descriptor);
+        return nullptr;
+    }
+    u32 size = info.st_size;
+
+    // Every bank is likely to be needed sooner or later, and the whole ROM is at most a few MB
+    int flags = MAP_PRIVATE;
+    #ifdef MAP_POPULATE
+    flags |= MAP_POPULATE;
+    #endif
+    void* memory = size > 0 ? mmap(nullptr, size, PROT_READ, flags, descriptor, 0) : MAP_FAILED;
+    close(descriptor);
+    if (memory != MAP_FAILED) {
+        #ifndef MAP_POPULATE
+        madvise(memory, size, MADV_WILLNEED);
+        #endif
+        u8* data = (u8*)memory;
+        if (getPaddedSize(data, size, size) == size) {
+            return new RomFile(data, size, true);
+        }
+        munmap(memory, size);
+    }
+    #endif
+
+    std::ifstream stream(path, std::ios::ate | std::ios::binary);
+    if (!stream.is_open()) {
+        std::cerr << path << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    std::streamoff end = stream.tellg();
+    if (end < 0) {
+        std::cerr << path << ": could not read" << std::endl;
+        return nullptr;
+    }
+    u32 fileSize = end;
+    u8 header[ROM_SIZE_ADDRESS + 1] = {};
+    u32 headerLength = std::min<u32>(fileSize, sizeof(header));
+    stream.seekg(0);
+    stream.read((char*)header, headerLength);
+    u32 paddedSize = getPaddedSize(header, headerLength, fileSize);
+
+    if (paddedSize == 0) {
+        std::cerr << path << ": empty file" << std::endl;
+        return nullptr;
+    }
+    u8* data = new u8[paddedSize]();
+    stream.seekg(0);
+    stream.read((char*)data, fileSize);
+    return new RomFile(data, paddedSize, false);
+}
+
+// Every image in use, by the hash of its contents. Entries are weak so the last cartridge to let go
+// of an image frees it; the lock makes it safe to create cartridges from several threads
+static std::mutex sharedRomLock;
+static std::unordered_map<u64, std::weak_ptr<SharedRom>> sharedRoms;
+
+// FNV-1a
+static u64 hashRom(const u8* data, u32 size) {
+    u64 hash = 0xCBF29CE484222325;
+    for (u32 i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 0x100000001B3;
+    }
+    return hash;
+}
+
+SharedRom::SharedRom(RomFile* file, u64 hash) : file(file), hash(hash), info(::getInfo(file->getData())),
+    bankCount(file->getSize() / 0x4000), decodedBanks(new std::unique_ptr<DecodedBank>[bankCount]), decoded(new std::once_flag[bankCount]) {
+    for (const IdleLoopHint& hint : IDLE_LOOP_HINTS) {
+        if (hint.title != nullptr && info.title == hint.title) {
+            idleLoopHints.push_back(hint.address >= 0x4000 ? u32(hint.bank) * 0x4000 + hint.address - 0x4000 : hint.address);
+        }
+    }
+}
+
+SharedRom::~SharedRom() {
+    {
+        std::lock_guard<std::mutex> guard(sharedRomLock);
+        // An identical image may have been loaded again while this one was on its way out
+        auto found = sharedRoms.find(hash);
+        if (found != sharedRoms.end() && found->second.expired()) {
+            sharedRoms.erase(found);
+        }
+    }
+    delete file;
+}
+
+std::shared_ptr<SharedRom> SharedRom::open(const char* path) {
+    RomFile* file = RomFile::open(path);
+    return file == nullptr ? nullptr : share(file);
+}
+
+std::shared_ptr<SharedRom> SharedRom::share(RomFile* file) {
+    u64 hash = hashRom(file->getData(), file->getSize());
+    // Declared before the lock, so that if this holds the last reference it's dropped after unlocking
+    std::shared_ptr<SharedRom> existing;
+    std::lock_guard<std::mutex> guard(sharedRomLock);
+    std::weak_ptr<SharedRom>& entry = sharedRoms[hash];
+    existing = entry.lock();
+    if (existing != nullptr && existing->getSize() == file->getSize() && memcmp(existing->getData(), file->getData(), file->getSize()) == 0) {
+        delete file;
+        return existing;
+    }
+    std::shared_ptr<SharedRom> image(new SharedRom(file, hash));
+    if (existing == nullptr) {
+        entry = image;
+    }
+    return image;
+}
+
+const DecodedBank* SharedRom::getDecodedBank(u32 bank) {
+    if (bank >= bankCount) {
+        return nullptr;
+    }
+    std::call_once(decoded[bank], [this, bank]() { decodeBank(bank); });
+    return decodedBanks[bank].get();
+}
+
+// Every byte is decoded, not just those code was seen to start at, so no bank is ever decoded twice
+void SharedRom::decodeBank(u32 bank) {
+    std::unique_ptr<DecodedBank> decodedBank(new DecodedBank());
+    const u8* data = getData() + bank * 0x4000;
+    for (u32 offset = 0; offset < 0x4000; offset++) {
+        u8 opCode = data[offset];
+        u8 length = OPCODES[opCode].length;
+        u16 operand = 0;
+        if (offset + length <= 0x4000) {
+            if (length == 2) {
+                operand = data[offset + 1];
+            } else if (length == 3) {
+                operand = data[offset + 1] | (data[offset + 2] << 8);
+            }
+        }
+        decodedBank->ops[offset] = { opCode, length, operand, 0 };
+    }
+
+    // The block `BlockCache::build` makes at each offset, when no breakpoint splits it
+    DecodedOp ops[MAX_BLOCK_OPS];
+    for (u32 start = 0; start < 0x4000; start++) {
+        u32 end = start;
+        u16 count = 0;
+        while (count < MAX_BLOCK_OPS) {
+            const DecodedOp& op = decodedBank->ops[end];
+            if (end + op.length > 0x4000) {
+                break;
+            }
+            ops[count++] = op;
+            end += op.length;
+            if (OPCODES[op.opCode].endsBlock()) {
+                break;
+            }
+        }
+        bool hinted = std::find(idleLoopHints.begin(), idleLoopHints.end(), bank * 0x4000 + start) != idleLoopHints.end();
+        decodedBank->loops[start] = count > 0 ? findBulkLoop(ops, count, start, end, hinted) : 0;
+    }
+    decodedBanks[bank] = std::move(decodedBank);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "./util.hpp"
+#include "./blockcache.hpp"
+#include "./cartridge.hpp"
+
+// A boot or cartridge ROM image, mapped read-only from disk so the OS can share its pages between
+// emulator processes and only fault in the banks that get used. Where mapping isn't available, or
+// the file is shorter than its header says, it's read into memory instead. Nothing may write to it
+class RomFile {
+public:
+  // nullptr, after printing why, if the file can't be opened or read
+  static RomFile* open(const char* path);
+  ~RomFile();
+
+  u8* getData() { return data; }
+  u32 getSize() { return size; }
+private:
+  RomFile(u8* data, u32 size, bool mapped);
+
+  u8* data;
+  u32 size;
+  bool mapped; //else `data` came from `new[]`
+};
+
+// A 16 KB ROM bank decoded for the block cache. `ops` has the instruction starting at every byte; one
+// running past the end of the bank keeps its length but not its operand. `loops` has, for the block
+// starting at every byte, what `findBulkLoop` makes of it when no breakpoint splits it
+struct DecodedBank {
+  DecodedOp ops[0x4000];
+  u8 loops[0x4000];
+};
+
+// One ROM image and what's derived from it, shared by every cartridge in the process made from
+// the same bytes. Found by a hash of the contents, and freed once the last cartridge using it is.
+// Only immutable data belongs here: bank registers and cartridge RAM stay with each `Cartridge`,
+// and compiled code, breakpoints and superinstructions with each CPU's `BlockCache`
+class SharedRom {
+public:
+  // The image for the ROM at `path`, loaded unless an identical one is already in use. nullptr if it can't be read
+  static std::shared_ptr<SharedRom> open(const char* path);
+  // Same, for an image already in memory. `file` is taken over, or deleted if an identical image is found
+  static std::shared_ptr<SharedRom> share(RomFile* file);
+  ~SharedRom();
+
+  u8* getData() { return file->getData(); }
+  u32 getSize() { return file->getSize(); }
+  u64 getHash() { return hash; }
+  const CartridgeInfo& getInfo() { return info; }
+  // Bank `bank`, decoded the first time any cartridge asks for it. nullptr if the image doesn't have all of it
+  const DecodedBank* getDecodedBank(u32 bank);
+private:
+  SharedRom(RomFile* file, u64 hash);
+
+  RomFile* file;
+  u64 hash;
+  CartridgeInfo info;
+
+  std::vector<u32> idleLoopHints; //offsets into the image of the blocks listed for its title in `IDLE_LOOP_HINTS`
+  u32 bankCount;
+  std::unique_ptr<std::unique_ptr<DecodedBank>[]> decodedBanks;
+  std::unique_ptr<std::once_flag[]> decoded; //per bank, so cartridges on several threads can share the decoding
+
+  void decodeBank(u32 bank);
+};
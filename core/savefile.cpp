@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include "./savefile.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SAVE_MMAP
+#endif
+
+SaveFile::SaveFile(std::string path, u8* data, u32 size, bool mapped) : path(path), data(data), size(size), mapped(mapped) {
+    saver = std::thread(&SaveFile::saveWhenIdle, this);
+}
+
+SaveFile::~SaveFile() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closing = true;
+    }
+    wake.notify_one();
+    saver.join();
+    if (!mapped) {
+        snapshot.assign(data, data + size);
+    }
+    save();
+
+    #ifdef SAVE_MMAP
+    if (mapped) {
+        munmap(data, size);
+        return;
+    }
+    #endif
+    delete[] data;
+}
+
+SaveFile* SaveFile::open(const char* path, u32 size) {
+    #ifdef SAVE_MMAP
+    int descriptor = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (descriptor < 0) {
+        std::cerr << path << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    struct stat info;
+    bool statted = fstat(descriptor, &info) == 0;
+    if (!statted || !S_ISREG(info.st_mode)) {
+        std::cerr << path << ": " << (statted ? "not a regular file" : strerror(errno)) << std::endl;
+        close(descriptor);
+        return nullptr;
+    }
+    // Saves from other emulators may carry extra data after the RAM, which is left as it is
+    if (info.st_size < size && ftruncate(descriptor, size) != 0) {
+        std::cerr << path << ": " << strerror(errno) << std::endl;
+        close(descriptor);
+        return nullptr;
+    }
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if (memory != MAP_FAILED) {
+        return new SaveFile(path, (u8*)memory, size, true);
+    }
+    #endif
+
+    u8* data = new u8[size]();
+    std::ifstream stream(path, std::ios::binary);
+    if (stream.is_open()) {
+        stream.read((char*)data, size);
+    } else {
+        // Fail now rather than on the first save if the file can't be created
+        std::ofstream created(path, std::ios::binary);
+        if (!created.is_open()) {
+            std::cerr << path << ": " << strerror(errno) << std::endl;
+            delete[] data;
+            return nullptr;
+        }
+        created.write((char*)data, size);
+    }
+    return new SaveFile(path, data, size, false);
+}
+
+void SaveFile::changed() {
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> guard(lock);
+    // Copied here, between frames, as the saver can't tell when the emulator is done writing `data`
+    if (!mapped) {
+        snapshot.assign(data, data + size);
+    }
+    lastChange = now;
+    if (!dirty) {
+        dirty = true;
+        firstChange = now;
+        wake.notify_one();
+    }
+}
+
+// Runs on `saver` until the file is closed
+void SaveFile::saveWhenIdle() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (!closing) {
+        if (!dirty) {
+            wake.wait(guard);
+            continue;
+        }
+        auto due = std::min(lastChange + SAVE_DELAY, firstChange + SAVE_MAX_DELAY);
+        if (std::chrono::steady_clock::now() < due) {
+            wake.wait_until(guard, due);
+            continue;
+        }
+        dirty = false;
+        guard.unlock();
+        save();
+        guard.lock();
+    }
+}
+
+// The kernel only writes the pages that were actually changed
+void SaveFile::save() {
+    #ifdef SAVE_MMAP
+    if (mapped) {
+        if (msync(data, size, MS_SYNC) != 0) {
+            std::cerr << path << ": " << strerror(errno) << std::endl;
+        }
+        return;
+    }
+    #endif
+    std::vector<u8> copy;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        copy = snapshot;
+    }
+    std::ofstream stream(path, std::ios::binary | std::ios::in | std::ios::out);
+    if (!stream.is_open() || !stream.write((char*)copy.data(), copy.size())) {
+        std::cerr << path << ": could not save" << std::endl;
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "./util.hpp"
+
+// Wait this long after cartridge RAM was last written before saving it, but never longer than
+// SAVE_MAX_DELAY after the first unsaved write, for games that write to it every frame
+const std::chrono::milliseconds SAVE_DELAY(500);
+const std::chrono::milliseconds SAVE_MAX_DELAY(5000);
+
+// Battery-backed cartridge RAM, kept in a file between runs. The file is mapped shared, so the
+// cartridge reads and writes it like any other memory and opening an existing save costs nothing.
+// A background thread pushes changes to disk once writes stop; where mapping isn't available the
+// RAM is read into memory instead, and the same thread writes back a copy of all of it taken by `changed`
+class SaveFile {
+public:
+  // `size` bytes, created or extended with zeros as needed. nullptr, after printing why, if the file can't be used
+  static SaveFile* open(const char* path, u32 size);
+  // Saves anything still unsaved before returning
+  ~SaveFile();
+
+  u8* getData() { return data; }
+  // Something in `getData()` may have been written. Takes a lock, so call it at most once a frame, not per write
+  void changed();
+private:
+  SaveFile(std::string path, u8* data, u32 size, bool mapped);
+
+  std::string path;
+  u8* data;
+  u32 size;
+  bool mapped; //else `data` came from `new[]`
+
+  std::mutex lock;
+  std::condition_variable wake;
+  std::vector<u8> snapshot; //`data` as of the last `changed`, when not `mapped`
+  bool dirty = false;
+  bool closing = false;
+  std::chrono::steady_clock::time_point firstChange;
+  std::chrono::steady_clock::time_point lastChange;
+  std::thread saver;
+
+  void saveWhenIdle();
+  void save();
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include "./opcodes.hpp"
+#include "./util.hpp"
+
+// Opcode sequences the interpreter runs as one handler when they appear back to back in a
+// decoded block. The fused handler returns the summed cycles, so Timer and PPU catch up once per
+// sequence. It only runs past the first op while neither of them would change state in the
+// meantime, which keeps the result identical to running the ops one at a time.
+// Run with `--profile-pairs` to see which sequences a ROM spends its time in, then add them here
+struct Superinstruction {
+  u8 count; //2 or 3
+  u8 opCodes[3];
+};
+
+inline constexpr Superinstruction SUPERINSTRUCTIONS[] = {
+  { 2, { 0x2A, 0x12 } },       //LD A,(HL+) ; LD (DE),A
+  { 2, { 0x1A, 0x22 } },       //LD A,(DE) ; LD (HL+),A
+  { 2, { 0x05, 0x20 } },       //DEC B ; JR NZ
+  { 2, { 0x0D, 0x20 } },       //DEC C ; JR NZ
+  { 2, { 0xF0, 0xFE } },       //LDH A,(a8) ; CP d8
+  { 2, { 0xF0, 0xE6 } },       //LDH A,(a8) ; AND d8
+  { 3, { 0x0B, 0x78, 0xB1 } }, //DEC BC ; LD A,B ; OR C
+  { 2, { 0x78, 0xB1 } },       //LD A,B ; OR C
+};
+
+inline constexpr u8 SUPERINSTRUCTION_COUNT = sizeof(SUPERINSTRUCTIONS) / sizeof(Superinstruction);
+
+// Register pair (`CPU::reg16` encoding) an op writes memory through, or -1 if it writes nowhere or
+// somewhere else. Those are the only writes a fused op may make, since the address is known just before it runs
+constexpr int getWriteRegister16(u8 opCode) {
+  if (opCode == 0x02) { return 0; } //LD (BC),A
+  if (opCode == 0x12) { return 1; } //LD (DE),A
+  if (opCode == 0x22 || opCode == 0x32 || opCode == 0x34 || opCode == 0x35 || opCode == 0x36) { return 2; }
+  if (opCode >= 0x70 && opCode <= 0x77 && opCode != 0x76) { return 2; } //LD (HL),r
+  return -1;
+}
+
+// Every op but the last must leave memory, control flow and IME alone, so the ones after it
+// are still the next ops in the same block when the fused handler gets to them
+constexpr bool canLeadSuperinstruction(u8 opCode) {
+  const OpcodeInfo& info = OPCODES[opCode];
+  return opCode != 0xCB && opCode != 0xF3 && opCode != 0xFB && !(info.flags & OP_WRITES_MEMORY) && !info.endsBlock();
+}
+
+// Every op but the first may only write through a register pair
+constexpr bool canFollowInSuperinstruction(u8 opCode) {
+  const OpcodeInfo& info = OPCODES[opCode];
+  bool writesElsewhere = (info.flags & OP_WRITES_MEMORY) && getWriteRegister16(opCode) < 0;
+  return opCode != 0xCB && !writesElsewhere && !(info.flags & (OP_HALT | OP_ILLEGAL));
+}
+
+constexpr bool isValidSuperinstruction(const Superinstruction& fused) {
+  if (fused.count < 2 || fused.count > 3) {
+    return false;
+  }
+  for (u8 i = 0; i < fused.count; i++) {
+    bool last = i + 1 == fused.count;
+    if ((!last && !canLeadSuperinstruction(fused.opCodes[i])) || (i > 0 && !canFollowInSuperinstruction(fused.opCodes[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+constexpr bool allSuperinstructionsValid() {
+  for (const Superinstruction& fused : SUPERINSTRUCTIONS) {
+    if (!isValidSuperinstruction(fused)) {
+      return false;
+    }
+  }
+  return true;
+}
+static_assert(allSuperinstructionsValid(), "a superinstruction contains an op that can't be fused there");
+
+// Index + 1 of the longest superinstruction matching `opCodes`, or 0 if none does
+constexpr u8 findSuperinstruction(const u8* opCodes, u8 available) {
+  u8 found = 0;
+  u8 foundCount = 0;
+  for (u8 index = 0; index < SUPERINSTRUCTION_COUNT; index++) {
+    const Superinstruction& fused = SUPERINSTRUCTIONS[index];
+    if (fused.count > available || fused.count <= foundCount) {
+      continue;
+    }
+    bool matches = true;
+    for (u8 i = 0; i < fused.count; i++) {
+      matches = matches && opCodes[i] == fused.opCodes[i];
+    }
+    if (matches) {
+      found = index + 1;
+      foundCount = fused.count;
+    }
+  }
+  return found;
+}
+
+// Copy and fill loops the CPU runs in bulk. Each one is a whole block ending in a JR NZ back to
+// its first op, counting down B, C or BC (via LD A,B ; OR C). `CPU::runLoop` works out what the
+// ops do to memory and registers at compile time
+struct LoopKernel {
+  u8 count;
+  u8 opCodes[7];
+};
+
+inline constexpr LoopKernel LOOP_KERNELS[] = {
+  { 3, { 0x22, 0x05, 0x20 } },                         //LD (HL+),A ; DEC B ; JR NZ
+  { 3, { 0x22, 0x0D, 0x20 } },                         //LD (HL+),A ; DEC C ; JR NZ
+  { 3, { 0x32, 0x05, 0x20 } },                         //LD (HL-),A ; DEC B ; JR NZ
+  { 3, { 0x32, 0x0D, 0x20 } },                         //LD (HL-),A ; DEC C ; JR NZ
+  { 6, { 0x3E, 0x22, 0x0B, 0x78, 0xB1, 0x20 } },       //LD A,d8 ; LD (HL+),A ; DEC BC ; LD A,B ; OR C ; JR NZ
+  { 6, { 0xAF, 0x22, 0x0B, 0x78, 0xB1, 0x20 } },       //XOR A ; LD (HL+),A ; DEC BC ; LD A,B ; OR C ; JR NZ
+  { 6, { 0x7A, 0x22, 0x0B, 0x78, 0xB1, 0x20 } },       //LD A,D ; LD (HL+),A ; DEC BC ; LD A,B ; OR C ; JR NZ
+  { 6, { 0x7B, 0x22, 0x0B, 0x78, 0xB1, 0x20 } },       //LD A,E ; LD (HL+),A ; DEC BC ; LD A,B ; OR C ; JR NZ
+  { 5, { 0x1A, 0x22, 0x13, 0x05, 0x20 } },             //LD A,(DE) ; LD (HL+),A ; INC DE ; DEC B ; JR NZ
+  { 5, { 0x1A, 0x22, 0x13, 0x0D, 0x20 } },             //LD A,(DE) ; LD (HL+),A ; INC DE ; DEC C ; JR NZ
+  { 5, { 0x2A, 0x12, 0x13, 0x05, 0x20 } },             //LD A,(HL+) ; LD (DE),A ; INC DE ; DEC B ; JR NZ
+  { 5, { 0x2A, 0x12, 0x13, 0x0D, 0x20 } },             //LD A,(HL+) ; LD (DE),A ; INC DE ; DEC C ; JR NZ
+  { 7, { 0x1A, 0x22, 0x13, 0x0B, 0x78, 0xB1, 0x20 } }, //LD A,(DE) ; LD (HL+),A ; INC DE ; DEC BC ; LD A,B ; OR C ; JR NZ
+  { 7, { 0x2A, 0x12, 0x13, 0x0B, 0x78, 0xB1, 0x20 } }, //LD A,(HL+) ; LD (DE),A ; INC DE ; DEC BC ; LD A,B ; OR C ; JR NZ
+};
+
+inline constexpr u8 LOOP_KERNEL_COUNT = sizeof(LOOP_KERNELS) / sizeof(LoopKernel);
+
+// Cycles for one pass with the JR taken
+constexpr u16 getLoopCycles(const LoopKernel& kernel) {
+  u16 cycles = 0;
+  for (u8 i = 0; i + 1 < kernel.count; i++) {
+    cycles += OPCODES[kernel.opCodes[i]].cycles;
+  }
+  return cycles + OPCODES[kernel.opCodes[kernel.count - 1]].takenCycles;
+}
+
+constexpr u16 getLoopLength(const LoopKernel& kernel) {
+  u16 length = 0;
+  for (u8 i = 0; i < kernel.count; i++) {
+    length += OPCODES[kernel.opCodes[i]].length;
+  }
+  return length;
+}
+
+constexpr bool hasOp(const LoopKernel& kernel, u8 opCode) {
+  for (u8 i = 0; i < kernel.count; i++) {
+    if (kernel.opCodes[i] == opCode) {
+      return true;
+    }
+  }
+  return false;
+}
+
+constexpr bool allLoopKernelsValid() {
+  for (const LoopKernel& kernel : LOOP_KERNELS) {
+    u8 counter = kernel.opCodes[kernel.count - 2];
+    if (kernel.opCodes[kernel.count - 1] != 0x20 || (counter != 0x05 && counter != 0x0D && counter != 0xB1)) {
+      return false;
+    }
+  }
+  return true;
+}
+static_assert(allLoopKernelsValid(), "a loop kernel must end in DEC B, DEC C or OR C, then JR NZ");
+
+// Index + 1 of the loop kernel whose ops are exactly `opCodes`, or 0
+constexpr u8 findLoopKernel(const u8* opCodes, u8 count) {
+  for (u8 index = 0; index < LOOP_KERNEL_COUNT; index++) {
+    const LoopKernel& kernel = LOOP_KERNELS[index];
+    bool matches = kernel.count == count;
+    for (u8 i = 0; matches && i < count; i++) {
+      matches = opCodes[i] == kernel.opCodes[i];
+    }
+    if (matches) {
+      return index + 1;
+    }
+  }
+  return 0;
+}
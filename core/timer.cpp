@@ -1,9 +1,12 @@
 #include "./timer.hpp"
 
-Timer::Timer(MMU* mmu, CPU* cpu) : mmu(mmu), cpu(cpu) {}
+Timer::Timer(MMU* mmu, InterruptController* interrupts) : mmu(mmu), interrupts(interrupts) {
+  mmu->mapIORegister(DIV_ADDRESS, this, nullptr, [](void* timer, u16, u8) { ((Timer*)timer)->resetDiv(); });
+  mmu->mapIORegister(TAC_ADDRESS, this, nullptr, [](void* timer, u16, u8 value) { ((Timer*)timer)->setControl(value); });
+}
 
 // cpuCyclesElapsed is measured by memory cycles
-void Timer::step(u8 cpuCyclesElapsed) {
+void Timer::step(u16 cpuCyclesElapsed) {
   divCyclesLeft += cpuCyclesElapsed;
 
   // DIV is always counting at 16384Hz (CPU_Clock / 256)
@@ -23,7 +26,7 @@ void Timer::step(u8 cpuCyclesElapsed) {
       u8 timerCounter = mmu->readDirectly(TIMA_ADDRESS);
       if (timerCounter == 0xFF) { // Will overflow
         timerCounter = mmu->readDirectly(TMA_ADDRESS);
-        cpu->requestInterrupt(TIMER);
+        interrupts->request(TIMER);
       } else {
         timerCounter++;
       }
@@ -33,22 +36,55 @@ void Timer::step(u8 cpuCyclesElapsed) {
   }
 }
 
-bool Timer::timerEnabled() {
-  return readBit(mmu->readDirectly(TAC_ADDRESS), 2);
+u16 Timer::getCyclesUntilChange() {
+  u16 cycles = 256 - divCyclesLeft;
+  if (timerEnabled()) {
+    u16 divisor = getDivisor();
+    u16 timaCycles = timaCyclesLeft < divisor ? divisor - timaCyclesLeft : 0;
+    cycles = timaCycles < cycles ? timaCycles : cycles;
+  }
+  return cycles;
 }
 
-u16 Timer::getDivisor() {
+u16 Timer::getCyclesUntilOverflow() {
+  if (!timerEnabled()) {
+    return 0xFFFF;
+  }
+  u16 divisor = getDivisor();
+  u32 cycles = timaCyclesLeft < divisor ? divisor - timaCyclesLeft : 0;
+  cycles += u32(0xFF - mmu->readDirectly(TIMA_ADDRESS)) * divisor;
+  return cycles < 0xFFFF ? cycles : 0xFFFF;
+}
+
+// Any write to DIV resets it
+void Timer::resetDiv() {
+  mmu->writeDirectly(DIV_ADDRESS, 0);
+}
+
+void Timer::setControl(u8 tac) {
+  mmu->writeDirectly(TAC_ADDRESS, tac);
+  timaEnabled = readBit(tac, 2);
   // interpret bottom two bits as enum
-  switch (static_cast<TIMER_DIVISOR>(mmu->readDirectly(TAC_ADDRESS) & 0b11)) {
+  switch (static_cast<TIMER_DIVISOR>(tac & 0b11)) {
     case d1024: 
-      return 1024;
+      timaDivisor = 1024;
+      break;
     case d16:
-      return 16;
+      timaDivisor = 16;
+      break;
     case d64: 
-      return 64;
+      timaDivisor = 64;
+      break;
     case d256: 
-      return 256;
-    default:
-      return 256;
+      timaDivisor = 256;
+      break;
   }
+}
+
+bool Timer::timerEnabled() {
+  return timaEnabled;
+}
+
+u16 Timer::getDivisor() {
+  return timaDivisor;
 }
\ No newline at end of file
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "./mmu.hpp"
-#include "./cpu.hpp"
+#include "./interrupts.hpp"
 #include "./util.hpp"
 
 // The value in bits 0-1 of 0xFF07 control the timer speed 
@@ -15,17 +15,27 @@ enum TIMER_DIVISOR {
 
 class Timer {
 public:
-  Timer(MMU* mmu, CPU* cpu);
+  Timer(MMU* mmu, InterruptController* interrupts);
 
-  void step(u8 cpuCyclesElapsed);
+  void step(u16 cpuCyclesElapsed);
+  // How many cycles `step` can be given in total before DIV or TIMA next changes
+  u16 getCyclesUntilChange();
+  // How many cycles `step` can be given in total before TIMA next overflows and requests an interrupt
+  u16 getCyclesUntilOverflow();
 
   void resetDiv();
+  // Called by the MMU when the CPU writes TAC
+  void setControl(u8 tac);
 private:
   MMU* mmu;
-  CPU* cpu;
+  InterruptController* interrupts;
 
   u16 divCyclesLeft  = 0;
   u16 timaCyclesLeft = 0;
+
+  // Decoded from TAC when it is written, rather than read back on every step
+  bool timaEnabled = false;
+  u16 timaDivisor = 1024;
   
   bool timerEnabled();
   u16 getDivisor();
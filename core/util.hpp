@@ -5,6 +5,7 @@
 using u8 = uint8_t;
 using u16 = uint16_t;
 using u32 = uint32_t;
+using u64 = uint64_t;
 using s8 = int8_t;
 using s16 = uint16_t;
 
@@ -24,11 +25,11 @@ inline u16 changeIthBitToX(u16 value, u8 index, u8 x) {
   return (value & ~(1 << index)) | (x << index);
 }
 
-inline u8 getHighNibble(u8 value) {
+constexpr u8 getHighNibble(u8 value) {
   return (value & 0xF0) >> 4;
 }
 
-inline u8 getLowNibble(u8 value) {
+constexpr u8 getLowNibble(u8 value) {
   return value & 0x0F;
 }
 
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "./util.hpp"
+
+enum WatchAccess : u8 {
+  WATCH_READ  = 1,
+  WATCH_WRITE = 2,
+};
+
+// A watched access, as the CPU made it. `pc` is where the instruction making it starts (for a fused
+// sequence or compiled block, where that starts), and `cycle` how many cycles the CPU had run before it
+struct WatchHit {
+  u16 address;
+  u8 value; //read, or about to be written
+  WatchAccess access;
+  u16 pc;
+  u16 bank; //ROM bank mapped at 0x4000-0x7FFF
+  u64 cycle;
+};
+
+typedef void (*WatchHandler)(void* owner, const WatchHit& hit);
+
+// Calls `handler` on every CPU access of the kinds in `access` to `first`-`last`, or only those
+// reading or writing `value` if it isn't -1. Handlers must not add or remove watchpoints
+struct Watchpoint {
+  u16 first;
+  u16 last;
+  u8 access; //WATCH_READ and/or WATCH_WRITE
+  int value;
+  WatchHandler handler;
+  void* owner;
+  u32 id = 0; //set by `MMU::addWatchpoint`
+};
@@ -1,4 +1,3 @@
-#include <fstream>
 #include <iostream>
 #include <cstring>
 
@@ -8,6 +7,7 @@
 #include "core/util.hpp"
 #include "core/cartridge.hpp"
 #include "core/gameboy.hpp"
+#include "core/romfile.hpp"
 
 const char TITLE[] = "gb-emulator";
 const int WIDTH = 160;
@@ -15,24 +15,21 @@ const int HEIGHT = 144;
 const int NUM_BYTES_OF_PIXELS = 3 * 144 * 160;
 const double FPS = 60.0;
 
-u8 *boot_rom;
-u8 *game_rom;
+RomFile *boot_rom;
+std::shared_ptr<SharedRom> game_rom;
 SDL_Window *window;
 SDL_Renderer *renderer;
 SDL_Texture *texture;
 
 void free_boot_rom(void) {
 	if (boot_rom != nullptr) {
-		delete[] boot_rom;
+		delete boot_rom;
 		boot_rom = nullptr;
 	}
 }
 
 void free_game_rom(void) {
-	if (game_rom != nullptr) {
-		delete[] game_rom;
-		game_rom = nullptr;
-	}
+	game_rom = nullptr;
 }
 
 void destroy_window(void) {
@@ -47,42 +44,86 @@ void destroy_texture(void) {
 	SDL_DestroyTexture(texture);
 }
 
-int load_binary_file(char *filename, u8 **buffer) {
-	std::ifstream file;
-
-	file.open(filename, std::ios::ate | std::ios::binary);
-
-	if (!file.is_open()) {
-		std::cerr << filename << ": " << strerror(errno) << std::endl;
+RomFile *load_rom_file(char *filename) {
+	RomFile *file = RomFile::open(filename);
+	if (file == nullptr) {
 		exit(EXIT_FAILURE);
 	}
+	return file;
+}
 
-	int file_size = file.tellg();
-
-	*buffer = new u8[file_size];
+// The ROM's path with its extension, if any, replaced by .sav
+std::string get_save_path(const char *rom_filename) {
+	std::string path = rom_filename;
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+	if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+		path.erase(dot);
+	}
+	return path + ".sav";
+}
 
-	file.seekg(0);
-	file.read((char *) *buffer, file_size);
+void print_watch_hit(void *owner, const WatchHit &hit) {
+	const char *access = hit.access == WATCH_READ ? "read" : "write";
+	printf("WATCH :: %s %04X = %02X by %02X:%04X at cycle %llu\n", access, hit.address, hit.value, hit.bank, hit.pc, (unsigned long long) hit.cycle);
+}
 
-	file.close();
+// ADDRESS[-LAST][:r|:w|:rw][=VALUE], all in hex. Watches writes unless told otherwise
+bool parse_watchpoint(const char *spec, Watchpoint *watchpoint) {
+	char *end;
+	watchpoint->first = strtoul(spec, &end, 16);
+	watchpoint->last = watchpoint->first;
+	watchpoint->access = WATCH_WRITE;
+	watchpoint->value = -1;
+	watchpoint->handler = print_watch_hit;
+	watchpoint->owner = nullptr;
+	if (end == spec) {
+		return false;
+	}
+	if (*end == '-') {
+		watchpoint->last = strtoul(end + 1, &end, 16);
+	}
+	if (*end == ':') {
+		watchpoint->access = 0;
+		for (end++; *end == 'r' || *end == 'w'; end++) {
+			watchpoint->access |= *end == 'r' ? WATCH_READ : WATCH_WRITE;
+		}
+	}
+	if (*end == '=') {
+		watchpoint->value = strtoul(end + 1, &end, 16);
+	}
+	return *end == '\0' && watchpoint->access != 0 && watchpoint->first <= watchpoint->last;
+}
 
-	return file_size;
+// [BANK:]ADDRESS in hex
+bool parse_breakpoint(const char *spec, u16 *bank, u16 *address) {
+	char *end;
+	*bank = 0;
+	*address = strtoul(spec, &end, 16);
+	if (*end == ':') {
+		*bank = *address;
+		*address = strtoul(end + 1, &end, 16);
+	}
+	return end != spec && *end == '\0';
 }
 
 int main(int argc, char *argv[]) {
 	if (argc < 3) {
-		std::cerr << "Usage: " << argv[0] << " [boot_rom_file] [game_rom_file]" << std::endl;
+		std::cerr << "Usage: " << argv[0] << " [boot_rom_file] [game_rom_file] [--jit] [--aot module] [--profile-pairs] [--watch address] [--until bank:address]" << std::endl;
 		exit(EXIT_FAILURE);
 	}
 
 	char *boot_rom_filename = argv[1];
 	char *game_rom_filename = argv[2];
 
-	load_binary_file(boot_rom_filename, &boot_rom);
+	boot_rom = load_rom_file(boot_rom_filename);
 
 	atexit(free_boot_rom);
 
-	load_binary_file(game_rom_filename, &game_rom);
+	game_rom = SharedRom::open(game_rom_filename);
+	if (game_rom == nullptr) {
+		exit(EXIT_FAILURE);
+	}
 	
 	atexit(free_game_rom);
 
@@ -131,7 +172,36 @@ int main(int argc, char *argv[]) {
 	std::atexit(destroy_texture);
 
 	Cartridge* cartridge = createCartridge(game_rom);
-	GameBoy* gameBoy = new GameBoy(boot_rom, cartridge);
+	if (cartridge->hasBattery()) {
+		cartridge->useSaveFile(get_save_path(game_rom_filename).c_str());
+	}
+	GameBoy* gameBoy = new GameBoy(boot_rom->getData(), cartridge);
+	bool until_breakpoint = false;
+	u64 cycles_run = 0;
+	for (int i = 3; i < argc; i++) {
+		if (strcmp(argv[i], "--jit") == 0) {
+			gameBoy->enableJit();
+		} else if (strcmp(argv[i], "--aot") == 0 && i + 1 < argc) {
+			gameBoy->loadRecompiledModule(argv[++i]);
+		} else if (strcmp(argv[i], "--profile-pairs") == 0) {
+			gameBoy->enableSequenceProfile();
+		} else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+			Watchpoint watchpoint;
+			if (parse_watchpoint(argv[++i], &watchpoint)) {
+				gameBoy->addWatchpoint(watchpoint);
+			} else {
+				std::cerr << argv[i] << ": expected ADDRESS[-LAST][:r|:w|:rw][=VALUE] in hex" << std::endl;
+			}
+		} else if (strcmp(argv[i], "--until") == 0 && i + 1 < argc) {
+			u16 bank, address;
+			if (parse_breakpoint(argv[++i], &bank, &address)) {
+				gameBoy->addBreakpoint(bank, address);
+				until_breakpoint = true;
+			} else {
+				std::cerr << argv[i] << ": expected [BANK:]ADDRESS in hex" << std::endl;
+			}
+		}
+	}
 	u8* frameBuffer = gameBoy->getFrameBuffer();
 
 	SDL_SetWindowTitle(window, gameBoy->getTitle());
@@ -406,7 +476,16 @@ int main(int argc, char *argv[]) {
 		}
 		#endif
 
-		gameBoy->step();
+		if (until_breakpoint) {
+			// Measures how long the game takes to get somewhere, then carries on as usual
+			cycles_run += gameBoy->runUntilBreakpoint(CYCLES_PER_STEP);
+			if (gameBoy->stoppedAtBreakpoint()) {
+				printf("BREAK :: reached after %llu cycles (%.3f s emulated)\n", (unsigned long long) cycles_run, cycles_run / (CYCLES_PER_STEP * 60.0));
+				until_breakpoint = false;
+			}
+		} else {
+			gameBoy->step();
+		}
 
 		SDL_RenderClear(renderer);
 		SDL_UpdateTexture(texture, nullptr, frameBuffer, WIDTH * sizeof(u8) * 3);
@@ -417,5 +496,7 @@ int main(int argc, char *argv[]) {
 			SDL_Delay(1000 / FPS);
 		}
 	}
+	gameBoy->printSequenceProfile();
+	delete cartridge; //saves anything not yet written out
 	return 0;
 }
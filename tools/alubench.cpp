@@ -0,0 +1,113 @@
+// ALU microbenchmark. Runs a generated cartridge whose whole time goes to a loop of 8-bit ALU ops,
+// once with nothing reading the flags they set and once with a conditional branch or DAA after
+// nearly every one, and prints how long each took. Nothing is drawn: the boot ROM below leaves the
+// LCD off, so Timer and PPU cost next to nothing. `--jit` runs them through the JIT instead.
+//
+//   g++ -std=c++17 -O2 tools/alubench.cpp core/*.cpp -pthread -o gb-alubench
+//   ./gb-alubench [frames] [--jit]
+//
+// Build it against a tree from before lazy flags (cpu.cpp using changeIthBitToX for every flag) to
+// compare eager and lazy flag evaluation on the same programs.
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "../core/cartridge.hpp"
+#include "../core/gameboy.hpp"
+
+struct Program {
+    const char* name;
+    std::vector<u8> code;
+};
+
+const Program PROGRAMS[] = {
+    { "flags unread", {
+        0x80,               //loop: ADD A,B
+        0x89,               //ADC A,C
+        0x92,               //SUB D
+        0x9B,               //SBC A,E
+        0xBC,               //CP H
+        0x2C,               //INC L
+        0x05,               //DEC B
+        0xA1,               //AND C
+        0xAA,               //XOR D
+        0xB3,               //OR E
+        0x3C,               //INC A
+        0xC6, 0x35,         //ADD A,35h
+        0xD6, 0x11,         //SUB 11h
+        0xFE, 0x80,         //CP 80h
+        0x14,               //INC D
+        0x1C,               //INC E
+        0x24,               //INC H
+        0x0C,               //INC C
+        0x18, 0xE9,         //JR loop
+    } },
+    { "flags read", {
+        0x80,               //loop: ADD A,B
+        0x38, 0x00,         //JR C,+0
+        0x89,               //ADC A,C
+        0x30, 0x00,         //JR NC,+0
+        0x92,               //SUB D
+        0x20, 0x00,         //JR NZ,+0
+        0x9B,               //SBC A,E
+        0x28, 0x00,         //JR Z,+0
+        0xBC,               //CP H
+        0x27,               //DAA
+        0x2C,               //INC L
+        0x05,               //DEC B
+        0x20, 0x00,         //JR NZ,+0
+        0x18, 0xEC,         //JR loop
+    } },
+};
+
+// Runs NOPs up to 0x00FC, then unmaps itself so the next instruction is the cartridge's at 0x0100
+std::vector<u8> makeBootRom() {
+    std::vector<u8> boot(BOOT_ROM_SIZE, 0x00);
+    const u8 disable[] = { 0x3E, 0x01, 0xE0, 0x50 }; //LD A,01h ; LDH (50h),A
+    memcpy(boot.data() + 0xFC, disable, sizeof(disable));
+    return boot;
+}
+
+std::vector<u8> makeRom(const Program& program) {
+    std::vector<u8> rom(getRomSize(0x00), 0x00);
+    const u8 entry[] = { 0x00, 0xC3, 0x50, 0x01 }; //NOP ; JP 0150h
+    memcpy(rom.data() + 0x100, entry, sizeof(entry));
+    strcpy((char*)rom.data() + TITLE_ADDRESS, "ALUBENCH");
+    memcpy(rom.data() + 0x150, program.code.data(), program.code.size());
+    return rom;
+}
+
+int main(int argc, char* argv[]) {
+    int frames = 3000;
+    bool jit = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--jit") == 0) {
+            jit = true;
+        } else {
+            frames = atoi(argv[i]);
+        }
+    }
+    std::vector<u8> boot = makeBootRom();
+
+    for (const Program& program : PROGRAMS) {
+        std::vector<u8> rom = makeRom(program);
+        Cartridge* cartridge = createCartridge(rom.data());
+        GameBoy* gameBoy = new GameBoy(boot.data(), cartridge);
+        if (jit && !gameBoy->enableJit()) {
+            return 1;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++) {
+            gameBoy->step();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        printf("%-13s %d frames in %.3f s  (%.1f frames/s)\n", program.name, frames, elapsed.count(), frames / elapsed.count());
+
+        delete gameBoy;
+        delete cartridge;
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+// Bank switching microbenchmark. Runs a generated cartridge that switches ROM bank, reads from it
+// and reads and writes cartridge RAM on every pass of a tight loop, once per mapper, and prints how
+// long each took. Nothing is drawn: the boot ROM below leaves the LCD off.
+//
+//   g++ -std=c++17 -O2 tools/bankbench.cpp core/*.cpp -pthread -o gb-bankbench
+//   ./gb-bankbench [frames]
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "../core/cartridge.hpp"
+#include "../core/gameboy.hpp"
+
+struct Mapper {
+    const char* name;
+    u8 type;
+    u8 romSizeCode;
+    u8 ramSizeCode;
+};
+
+const Mapper MAPPERS[] = {
+    { "MBC1", 0x03, 0x05, 0x03 },
+    { "MBC2", 0x06, 0x03, 0x00 },
+    { "MBC3", 0x13, 0x06, 0x03 },
+    { "MBC5", 0x1B, 0x08, 0x04 },
+};
+
+const u8 PROGRAM[] = {
+    0x3E, 0x0A,         //LD A,0Ah
+    0xEA, 0x00, 0x00,   //LD (0000h),A    enable RAM
+    0x04,               //loop: INC B
+    0x78,               //LD A,B
+    0xEA, 0x00, 0x21,   //LD (2100h),A    ROM bank, with address bit 8 set for MBC2
+    0xFA, 0x00, 0x40,   //LD A,(4000h)
+    0xEA, 0x00, 0xA0,   //LD (A000h),A
+    0xFA, 0x00, 0xA0,   //LD A,(A000h)
+    0x78,               //LD A,B
+    0xE6, 0x03,         //AND 03h
+    0xEA, 0x00, 0x40,   //LD (4000h),A    RAM bank
+    0x18, 0xEA,         //JR loop
+};
+
+// Runs NOPs up to 0x00FC, then unmaps itself so the next instruction is the cartridge's at 0x0100
+std::vector<u8> makeBootRom() {
+    std::vector<u8> boot(BOOT_ROM_SIZE, 0x00);
+    const u8 disable[] = { 0x3E, 0x01, 0xE0, 0x50 }; //LD A,01h ; LDH (50h),A
+    memcpy(boot.data() + 0xFC, disable, sizeof(disable));
+    return boot;
+}
+
+// The first byte of every bank is its number, so reads can't all be served from one page
+std::vector<u8> makeRom(const Mapper& mapper) {
+    std::vector<u8> rom(getRomSize(mapper.romSizeCode), 0x00);
+    for (u32 bank = 0; bank < rom.size() / 0x4000; bank++) {
+        rom[bank * 0x4000] = bank;
+    }
+    const u8 entry[] = { 0x00, 0xC3, 0x50, 0x01 }; //NOP ; JP 0150h
+    memcpy(rom.data() + 0x100, entry, sizeof(entry));
+    strcpy((char*)rom.data() + TITLE_ADDRESS, "BANKBENCH");
+    rom[MBC_TYPE_ADDRESS] = mapper.type;
+    rom[ROM_SIZE_ADDRESS] = mapper.romSizeCode;
+    rom[RAM_SIZE_ADDRESS] = mapper.ramSizeCode;
+    memcpy(rom.data() + 0x150, PROGRAM, sizeof(PROGRAM));
+    return rom;
+}
+
+int main(int argc, char* argv[]) {
+    int frames = argc > 1 ? atoi(argv[1]) : 600;
+    std::vector<u8> boot = makeBootRom();
+
+    for (const Mapper& mapper : MAPPERS) {
+        std::vector<u8> rom = makeRom(mapper);
+        Cartridge* cartridge = createCartridge(rom.data());
+        GameBoy* gameBoy = new GameBoy(boot.data(), cartridge);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++) {
+            gameBoy->step();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        printf("%s  %d frames in %.3f s  (%.1f frames/s)\n", mapper.name, frames, elapsed.count(), frames / elapsed.count());
+
+        delete gameBoy;
+        delete cartridge;
+    }
+    return 0;
+}
@@ -0,0 +1,426 @@
+// Ahead-of-time recompiler. Walks the code reachable from a cartridge's entry point and interrupt
+// vectors, bank by bank, and writes one C++ function per guest block. The output builds into a
+// module the emulator loads with `--aot`; anything the walk missed falls back to the interpreter.
+//
+//   g++ -std=c++17 -O2 tools/recompile.cpp core/cartridge.cpp core/opcodes.cpp core/savefile.cpp -pthread -o gb-recompile
+//   ./gb-recompile game.gb game_aot.cpp
+//   g++ -std=c++17 -O2 -shared -fPIC -I. game_aot.cpp -o game_aot.so
+//   ./gb-emulator boot.bin game.gb --aot ./game_aot.so
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <vector>
+#include <stdio.h>
+#include "../core/aot.hpp"
+#include "../core/blockcache.hpp"
+#include "../core/cartridge.hpp"
+#include "../core/opcodes.hpp"
+
+const u16 ENTRY_POINT = 0x100;
+const u16 INTERRUPT_VECTORS[] = { 0x40, 0x48, 0x50, 0x58, 0x60 };
+
+struct Instruction {
+    u16 address;
+    DecodedOp op;
+};
+
+std::vector<u8> rom;
+u16 bankCount;
+
+// Blocks found so far, keyed by (bank << 16) | address, so they come out in ROM order
+std::map<u32, std::vector<Instruction>> blocks;
+std::vector<u32> pending;
+
+u32 getKey(u16 bank, u16 address) {
+    return (u32(bank) << 16) | address;
+}
+
+bool readRom(u16 bank, u32 address, u8* value) {
+    u32 offset = address < 0x4000 ? address : bank * 0x4000 + (address - 0x4000);
+    if (offset >= rom.size()) {
+        return false;
+    }
+    *value = rom[offset];
+    return true;
+}
+
+// Code in bank 0 can't know which bank will be mapped at 0x4000-0x7FFF, so those targets are tried in all of them
+void addTarget(u16 fromBank, u32 address) {
+    if (address < 0x4000) {
+        pending.push_back(getKey(0, address));
+    } else if (address <= 0x7FFF) {
+        if (fromBank != 0) {
+            pending.push_back(getKey(fromBank, address));
+        } else {
+            for (u16 bank = 1; bank < bankCount; bank++) {
+                pending.push_back(getKey(bank, address));
+            }
+        }
+    }
+}
+
+// Same block boundaries as `BlockCache::build`
+void decodeBlock(u16 bank, u16 start) {
+    std::vector<Instruction>& block = blocks[getKey(bank, start)];
+    u32 regionEnd = start < 0x4000 ? 0x4000 : 0x8000;
+    u32 address = start;
+    bool fallsThrough = true;
+
+    while (block.size() < MAX_BLOCK_OPS) {
+        u8 opCode, low = 0, high = 0;
+        if (!readRom(bank, address, &opCode)) {
+            fallsThrough = false;
+            break;
+        }
+        const OpcodeInfo& info = OPCODES[opCode];
+        u8 length = info.length;
+        if (address + length > regionEnd || (length > 1 && !readRom(bank, address + 1, &low)) || (length > 2 && !readRom(bank, address + 2, &high))) {
+            fallsThrough = false;
+            break;
+        }
+
+        u16 operand = (high << 8) | low;
+        block.push_back({ (u16)address, { opCode, length, operand } });
+        address += length;
+
+        if (info.flags & OP_JUMP) {
+            if (info.operand == OPERAND_R8) {
+                addTarget(bank, u16(address + (s8)operand));
+            } else if (info.operand == OPERAND_A16) {
+                addTarget(bank, operand);
+            } else if ((opCode & 0xC7) == 0xC7) { //RST
+                addTarget(bank, opCode & 0x38);
+            }
+            // Calls return and conditional jumps may not be taken, anything else leaves for good
+            if (!(info.flags & (OP_CALL | OP_CONDITIONAL))) {
+                fallsThrough = false;
+            }
+        }
+
+        if (info.endsBlock()) {
+            break;
+        }
+    }
+
+    if (fallsThrough && address < regionEnd) {
+        addTarget(bank, address);
+    }
+}
+
+void walk() {
+    addTarget(0, ENTRY_POINT);
+    for (u16 vector : INTERRUPT_VECTORS) {
+        addTarget(0, vector);
+    }
+    while (!pending.empty()) {
+        u32 key = pending.back();
+        pending.pop_back();
+        if (blocks.count(key) == 0) {
+            decodeBlock(key >> 16, key & 0xFFFF);
+        }
+    }
+}
+
+// Written at the top of every module. Guest registers live in a local `Registers` for the whole
+// block, so the compiler can keep them in host registers, and go back to the CPU only around
+// handler calls and on exit. F is always resolved: the JIT resolves it before entering a block
+const char MODULE_PRELUDE[] = R"(// Generated by tools/recompile. Do not edit
+
+#include "core/aot.hpp"
+
+static u16* pc;
+static u16* operand;
+static u8* const* registers;
+static u16* const* registers16;
+static u32 (*runHandler)(JIT* jit, u8 opCode, u32 lagCycles);
+static const u32* deadline;
+
+static void init(const AotContext* context) {
+    pc = context->pc;
+    operand = context->operand;
+    registers = context->registers;
+    registers16 = context->registers16;
+    runHandler = context->runHandler;
+    deadline = context->deadline;
+}
+
+struct Registers {
+    u8 b, c, d, e, h, l, f, a;
+};
+
+static inline void load(Registers& r) {
+    r.b = *registers[0]; r.c = *registers[1]; r.d = *registers[2]; r.e = *registers[3];
+    r.h = *registers[4]; r.l = *registers[5]; r.f = *registers[6]; r.a = *registers[7];
+}
+
+static inline void store(const Registers& r) {
+    *registers[0] = r.b; *registers[1] = r.c; *registers[2] = r.d; *registers[3] = r.e;
+    *registers[4] = r.h; *registers[5] = r.l; *registers[6] = r.f; *registers[7] = r.a;
+}
+
+// Runs the interpreter's handler through the JIT, exactly as compiled blocks do, returning the new lag
+static inline u32 handle(JIT* jit, Registers& r, u8 opCode, u16 next, u16 value, u32 lag) {
+    store(r);
+    *pc = next;
+    *operand = value;
+    lag = runHandler(jit, opCode, lag);
+    load(r);
+    return lag;
+}
+
+static inline u8 add8(u8& f, u8 x, u8 y, u8 carry) {
+    u16 result = x + y + carry;
+    f = ((u8)result == 0) << 7 | (((x & 0xF) + (y & 0xF) + carry) > 0xF) << 5 | (result > 0xFF) << 4;
+    return result;
+}
+
+static inline u8 sub8(u8& f, u8 x, u8 y, u8 carry) {
+    int result = x - y - carry;
+    f = ((u8)result == 0) << 7 | 0x40 | (((x & 0xF) - (y & 0xF) - carry) < 0) << 5 | (result < 0) << 4;
+    return result;
+}
+
+static inline u8 inc8(u8& f, u8 x) {
+    x++;
+    f = (f & 0x10) | (x == 0) << 7 | ((x & 0xF) == 0) << 5;
+    return x;
+}
+
+static inline u8 dec8(u8& f, u8 x) {
+    x--;
+    f = (f & 0x10) | (x == 0) << 7 | 0x40 | ((x & 0xF) == 0xF) << 5;
+    return x;
+}
+
+static inline void addHl(Registers& r, u16 value) {
+    u16 hl = r.h << 8 | r.l;
+    u32 result = hl + value;
+    r.f = (r.f & 0x80) | (((hl & 0xFFF) + (value & 0xFFF)) > 0xFFF) << 5 | (result > 0xFFFF) << 4;
+    r.h = result >> 8;
+    r.l = result;
+}
+)";
+
+const char* const REGISTER_NAMES[8] = { "r.b", "r.c", "r.d", "r.e", "r.h", "r.l", "r.f", "r.a" };
+const char* const PAIR_HIGH[3] = { "r.b", "r.d", "r.h" };
+const char* const PAIR_LOW[3] = { "r.c", "r.e", "r.l" };
+const char* const CONDITIONS[4] = { "!(r.f & 0x80)", "r.f & 0x80", "!(r.f & 0x10)", "r.f & 0x10" };
+
+// The C++ for an op that only touches registers, or an empty string if it needs its handler
+std::string getInlineBody(const DecodedOp& op) {
+    u8 opCode = op.opCode;
+    u8 high = (opCode >> 3) & 0x7;
+    u8 low = opCode & 0x7;
+    u8 pair = opCode >> 4;
+    char body[160] = "";
+
+    if (opCode == 0x00) {
+        snprintf(body, sizeof(body), ";");
+    } else if ((opCode & 0xC7) == 0x06 && opCode != 0x36) {
+        snprintf(body, sizeof(body), "%s = 0x%02X;", REGISTER_NAMES[high], op.operand & 0xFF);
+    } else if (opCode >= 0x40 && opCode <= 0x7F && high != 6 && low != 6) {
+        snprintf(body, sizeof(body), "%s = %s;", REGISTER_NAMES[high], REGISTER_NAMES[low]);
+    } else if ((opCode >= 0x80 && opCode <= 0xBF && low != 6) || (opCode & 0xC7) == 0xC6) {
+        char value[8];
+        if (opCode >= 0xC0) {
+            snprintf(value, sizeof(value), "0x%02X", op.operand & 0xFF);
+        } else {
+            snprintf(value, sizeof(value), "%s", REGISTER_NAMES[low]);
+        }
+        switch (high) {
+            case 0: snprintf(body, sizeof(body), "r.a = add8(r.f, r.a, %s, 0);", value); break;
+            case 1: snprintf(body, sizeof(body), "r.a = add8(r.f, r.a, %s, r.f >> 4 & 1);", value); break;
+            case 2: snprintf(body, sizeof(body), "r.a = sub8(r.f, r.a, %s, 0);", value); break;
+            case 3: snprintf(body, sizeof(body), "r.a = sub8(r.f, r.a, %s, r.f >> 4 & 1);", value); break;
+            case 4: snprintf(body, sizeof(body), "r.a &= %s; r.f = (r.a == 0) << 7 | 0x20;", value); break;
+            case 5: snprintf(body, sizeof(body), "r.a ^= %s; r.f = (r.a == 0) << 7;", value); break;
+            case 6: snprintf(body, sizeof(body), "r.a |= %s; r.f = (r.a == 0) << 7;", value); break;
+            default: snprintf(body, sizeof(body), "sub8(r.f, r.a, %s, 0);", value); break;
+        }
+    } else if ((opCode & 0xC7) == 0x04 && high != 6) {
+        snprintf(body, sizeof(body), "%s = inc8(r.f, %s);", REGISTER_NAMES[high], REGISTER_NAMES[high]);
+    } else if ((opCode & 0xC7) == 0x05 && high != 6) {
+        snprintf(body, sizeof(body), "%s = dec8(r.f, %s);", REGISTER_NAMES[high], REGISTER_NAMES[high]);
+    } else if ((opCode & 0xCF) == 0x01) {
+        if (pair == 3) {
+            snprintf(body, sizeof(body), "*registers16[3] = 0x%04X;", op.operand);
+        } else {
+            snprintf(body, sizeof(body), "%s = 0x%02X; %s = 0x%02X;", PAIR_HIGH[pair], op.operand >> 8, PAIR_LOW[pair], op.operand & 0xFF);
+        }
+    } else if ((opCode & 0xC7) == 0x03) {
+        const char* change = opCode & 0x8 ? "- 1" : "+ 1";
+        if (pair == 3) {
+            snprintf(body, sizeof(body), "*registers16[3] = *registers16[3] %s;", change);
+        } else {
+            snprintf(body, sizeof(body), "{ u16 value = (%s << 8 | %s) %s; %s = value >> 8; %s = value; }", PAIR_HIGH[pair], PAIR_LOW[pair], change, PAIR_HIGH[pair], PAIR_LOW[pair]);
+        }
+    } else if ((opCode & 0xCF) == 0x09) {
+        if (pair == 3) {
+            snprintf(body, sizeof(body), "addHl(r, *registers16[3]);");
+        } else {
+            snprintf(body, sizeof(body), "addHl(r, %s << 8 | %s);", PAIR_HIGH[pair], PAIR_LOW[pair]);
+        }
+    } else if (opCode == 0x07) {
+        snprintf(body, sizeof(body), "r.f = (r.a >> 7) << 4; r.a = r.a << 1 | r.a >> 7;");
+    } else if (opCode == 0x0F) {
+        snprintf(body, sizeof(body), "r.f = (r.a & 1) << 4; r.a = r.a >> 1 | r.a << 7;");
+    } else if (opCode == 0x17) {
+        snprintf(body, sizeof(body), "{ u8 carry = r.f >> 4 & 1; r.f = (r.a >> 7) << 4; r.a = r.a << 1 | carry; }");
+    } else if (opCode == 0x1F) {
+        snprintf(body, sizeof(body), "{ u8 carry = r.f >> 4 & 1; r.f = (r.a & 1) << 4; r.a = r.a >> 1 | carry << 7; }");
+    } else if (opCode == 0x2F) {
+        snprintf(body, sizeof(body), "r.a = ~r.a; r.f |= 0x60;");
+    } else if (opCode == 0x37) {
+        snprintf(body, sizeof(body), "r.f = (r.f & 0x80) | 0x10;");
+    } else if (opCode == 0x3F) {
+        snprintf(body, sizeof(body), "r.f = (r.f & 0x90) ^ 0x10;");
+    }
+    return body;
+}
+
+// One line per instruction, in the same order and with the same exits as the JIT's code for the
+// block. Register ops, ALU and flag ops are written out, and so are direct jumps, the one at the
+// end of a loop staying inside the function. Cycles add up in `lag` and are only handed over on
+// exit or to a handler, which catches Timer and PPU up itself before writing memory
+void writeInstruction(FILE* out, const std::vector<Instruction>& block, size_t index, bool* exits) {
+    const Instruction& instruction = block[index];
+    const DecodedOp& op = instruction.op;
+    u8 opCode = op.opCode;
+    u16 next = instruction.address + op.length;
+    u16 start = block.front().address;
+    bool last = index + 1 == block.size();
+    const OpcodeInfo& info = OPCODES[opCode];
+
+    u8 bytes[3] = { opCode, u8(op.operand), u8(op.operand >> 8) };
+    std::string text = disassemble(bytes, instruction.address);
+
+    bool relative = opCode == 0x18 || (opCode & 0xE7) == 0x20;
+    bool absolute = opCode == 0xC3 || (opCode & 0xE7) == 0xC2;
+    if (relative || absolute) {
+        u16 target = relative ? u16(next + (s8)op.operand) : op.operand;
+        char taken[128];
+        if (target == start) {
+            snprintf(taken, sizeof(taken), "lag += %d; if (lag < end) goto start; *pc = 0x%04X; goto exit;", info.takenCycles, target);
+        } else {
+            snprintf(taken, sizeof(taken), "lag += %d; *pc = 0x%04X; goto exit;", info.takenCycles, target);
+        }
+        if (opCode == 0x18 || opCode == 0xC3) {
+            fprintf(out, "    %s // %s\n", taken, text.c_str());
+        } else {
+            fprintf(out, "    if (%s) { %s } // %s\n", CONDITIONS[(opCode >> 3) & 0x3], taken, text.c_str());
+            fprintf(out, "    lag += %d; *pc = 0x%04X; goto exit;\n", info.cycles, next);
+        }
+        *exits = true;
+        return;
+    }
+
+    std::string body = getInlineBody(op);
+    if (!body.empty()) {
+        if (last) {
+            fprintf(out, "    %s lag += %d; *pc = 0x%04X; // %s\n", body.c_str(), info.cycles, next, text.c_str());
+        } else {
+            fprintf(out, "    %s lag += %d; if (lag >= end) { *pc = 0x%04X; goto exit; } // %s\n", body.c_str(), info.cycles, next, text.c_str());
+            *exits = true;
+        }
+        return;
+    }
+
+    // EI may let an interrupt through, which `JIT::run` takes before the next op
+    fprintf(out, "    lag = handle(jit, r, 0x%02X, 0x%04X, 0x%04X, lag);", opCode, next, op.length > 1 ? op.operand : 0);
+    if (last) {
+        fprintf(out, " // %s\n", text.c_str());
+    } else if (opCode == 0xFB) {
+        fprintf(out, " goto exit; // %s\n", text.c_str());
+        *exits = true;
+    } else {
+        fprintf(out, " end = *deadline; if (lag >= end) goto exit; // %s\n", text.c_str());
+        *exits = true;
+    }
+}
+
+bool loopsToStart(const std::vector<Instruction>& block) {
+    const DecodedOp& op = block.back().op;
+    u16 next = block.back().address + op.length;
+    bool relative = op.opCode == 0x18 || (op.opCode & 0xE7) == 0x20;
+    bool absolute = op.opCode == 0xC3 || (op.opCode & 0xE7) == 0xC2;
+    return (relative && u16(next + (s8)op.operand) == block.front().address) || (absolute && op.operand == block.front().address);
+}
+
+void writeModule(FILE* out) {
+    fprintf(out, "%s", MODULE_PRELUDE);
+
+    for (auto& [key, block] : blocks) {
+        if (block.empty()) {
+            continue;
+        }
+        u16 bank = key >> 16;
+        fprintf(out, "\n// bank %d, %04X-%04X\n", bank, block.front().address, block.back().address + block.back().op.length - 1);
+        fprintf(out, "static u32 block_%03X_%04X(CPU* cpu, JIT* jit, u32 lag) {\n", bank, key & 0xFFFF);
+        fprintf(out, "    Registers r;\n    load(r);\n    [[maybe_unused]] u32 end = *deadline;\n");
+        if (loopsToStart(block)) {
+            fprintf(out, "start:\n");
+        }
+        bool exits = false;
+        for (size_t i = 0; i < block.size(); i++) {
+            writeInstruction(out, block, i, &exits);
+        }
+        if (exits) {
+            fprintf(out, "exit:\n");
+        }
+        fprintf(out, "    store(r);\n    return lag;\n}\n");
+    }
+
+    u32 blockCount = 0;
+    fprintf(out, "\nstatic const AotBlockEntry blocks[] = {\n");
+    for (auto& [key, block] : blocks) {
+        if (!block.empty()) {
+            fprintf(out, "    { 0x%03X, 0x%04X, block_%03X_%04X },\n", key >> 16, key & 0xFFFF, key >> 16, key & 0xFFFF);
+            blockCount++;
+        }
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "extern \"C\" const AotModule gbAotModule = {\n    {");
+    for (u16 i = 0; i < 16 && rom[TITLE_ADDRESS + i] != 0; i++) {
+        fprintf(out, " (char)0x%02X,", rom[TITLE_ADDRESS + i]);
+    }
+    fprintf(out, " 0 },\n");
+    fprintf(out, "    0x%02X,\n    0x%04X,\n", rom[HEADER_CHECKSUM_ADDRESS], (rom[GLOBAL_CHECKSUM_ADDRESS] << 8) | rom[GLOBAL_CHECKSUM_ADDRESS + 1]);
+    fprintf(out, "    %u,\n    blocks,\n    init,\n};\n", blockCount);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " [game_rom_file] [output_cpp_file]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::ifstream file(argv[1], std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << argv[1] << ": could not open" << std::endl;
+        return EXIT_FAILURE;
+    }
+    rom.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (rom.size() < 0x8000) {
+        std::cerr << argv[1] << ": too small to be a cartridge" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    CartridgeInfo info = getInfo(rom.data());
+    bankCount = std::min<u32>(info.romSize, rom.size()) / 0x4000;
+    walk();
+
+    FILE* out = fopen(argv[2], "w");
+    if (out == nullptr) {
+        std::cerr << argv[2] << ": could not open for writing" << std::endl;
+        return EXIT_FAILURE;
+    }
+    writeModule(out);
+    fclose(out);
+
+    printf("%s: %zu blocks in %d banks\n", argv[1], blocks.size(), bankCount);
+    return EXIT_SUCCESS;
+}
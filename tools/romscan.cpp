@@ -0,0 +1,409 @@
+// ROM library scanner. Walks a directory tree for .gb and .gbc files on every core and records each
+// header (title, mapper, ROM and RAM size, checksums) in an index file. Files whose size and
+// modification time match the existing index aren't opened again, so rescanning a large library
+// only costs a directory walk. With --frames, each new or changed ROM is also run headless in its
+// own process for that many frames, to flag unsupported mappers, illegal opcodes and crashes.
+//
+//   g++ -std=c++17 -O2 tools/romscan.cpp core/*.cpp -pthread -o gb-romscan
+//   ./gb-romscan roms/ roms.idx [--frames 600] [--boot boot.bin] [--jobs 8] [--timeout 60]
+//   ./gb-romscan --list roms.idx
+//
+// The index is binary, in host byte order: "GBRI", a u32 version and entry count, then each entry
+// as `writeEntry` lays it out. --list prints it as tab-separated text for scripts.
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../core/cartridge.hpp"
+#include "../core/gameboy.hpp"
+#include "../core/romfile.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define SCAN_RUN
+#endif
+
+namespace fs = std::filesystem;
+
+const char INDEX_MAGIC[4] = { 'G', 'B', 'R', 'I' };
+const u32 INDEX_VERSION = 1;
+const u16 HEADER_END = 0x150;
+
+enum RunResult : u8 {
+    NOT_RUN,
+    RUN_OK,
+    UNSUPPORTED_MAPPER, //not run
+    ILLEGAL_OPCODE,
+    EMULATOR_ERROR,     //printed an "ERROR ::" line
+    CRASHED,
+    TIMED_OUT,
+    UNREADABLE,
+};
+
+const char* RUN_RESULT_NAMES[] = { "-", "ok", "unsupported", "illegal-opcode", "error", "crashed", "timeout", "unreadable" };
+
+struct Entry {
+    std::string path; //relative to the scanned directory
+    u64 size;
+    int64_t modified; //only compared for equality
+    char title[17];
+    u8 typeCode;      //header byte 0x147
+    u8 type;          //MBCType
+    u32 romSize;
+    u32 ramSize;
+    u8 headerChecksum;
+    bool headerChecksumValid;
+    u16 globalChecksum;
+    bool battery;
+    bool clock;
+    u32 framesRun;
+    u8 runResult;     //RunResult
+};
+
+struct Options {
+    u32 frames = 0;
+    const char* bootPath = nullptr;
+    u32 jobs = std::max(1u, std::thread::hardware_concurrency());
+    u32 timeout = 60; //seconds per ROM
+    std::string self;
+};
+
+template <typename T>
+void put(std::ostream& out, T value) {
+    out.write((const char*)&value, sizeof(value));
+}
+
+template <typename T>
+bool get(std::istream& in, T* value) {
+    return (bool)in.read((char*)value, sizeof(*value));
+}
+
+void writeEntry(std::ostream& out, const Entry& entry) {
+    put<u16>(out, entry.path.size());
+    out.write(entry.path.data(), entry.path.size());
+    put(out, entry.size);
+    put(out, entry.modified);
+    out.write(entry.title, 16);
+    put(out, entry.typeCode);
+    put(out, entry.type);
+    put(out, entry.romSize);
+    put(out, entry.ramSize);
+    put(out, entry.headerChecksum);
+    put<u8>(out, entry.headerChecksumValid | (entry.battery << 1) | (entry.clock << 2));
+    put(out, entry.globalChecksum);
+    put(out, entry.framesRun);
+    put(out, entry.runResult);
+}
+
+bool readEntry(std::istream& in, Entry* entry) {
+    u16 pathLength;
+    u8 flags;
+    if (!get(in, &pathLength)) {
+        return false;
+    }
+    entry->path.resize(pathLength);
+    in.read(&entry->path[0], pathLength);
+    memset(entry->title, 0, sizeof(entry->title));
+    bool read = get(in, &entry->size) && get(in, &entry->modified) && in.read(entry->title, 16) &&
+        get(in, &entry->typeCode) && get(in, &entry->type) && get(in, &entry->romSize) && get(in, &entry->ramSize) &&
+        get(in, &entry->headerChecksum) && get(in, &flags) && get(in, &entry->globalChecksum) &&
+        get(in, &entry->framesRun) && get(in, &entry->runResult);
+    entry->headerChecksumValid = flags & 0x1;
+    entry->battery = flags & 0x2;
+    entry->clock = flags & 0x4;
+    return read;
+}
+
+// Empty if there's no index yet or it's from another version, so everything is scanned again
+std::vector<Entry> readIndex(const char* path) {
+    std::vector<Entry> entries;
+    std::ifstream in(path, std::ios::binary);
+    char magic[4];
+    u32 version, count;
+    if (!in.is_open() || !in.read(magic, 4) || memcmp(magic, INDEX_MAGIC, 4) != 0 || !get(in, &version) || version != INDEX_VERSION || !get(in, &count)) {
+        return entries;
+    }
+    entries.resize(count);
+    for (u32 i = 0; i < count; i++) {
+        if (!readEntry(in, &entries[i])) {
+            std::cerr << path << ": truncated, rescanning everything" << std::endl;
+            return {};
+        }
+    }
+    return entries;
+}
+
+// Written beside the old index and renamed over it, so an interrupted scan leaves the old one intact
+bool writeIndex(const char* path, const std::vector<Entry>& entries) {
+    std::string temporary = std::string(path) + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(INDEX_MAGIC, 4);
+        put(out, INDEX_VERSION);
+        put<u32>(out, entries.size());
+        for (const Entry& entry : entries) {
+            writeEntry(out, entry);
+        }
+        if (!out) {
+            std::cerr << temporary << ": could not write" << std::endl;
+            return false;
+        }
+    }
+    std::error_code error;
+    fs::rename(temporary, path, error);
+    if (error) {
+        std::cerr << path << ": " << error.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool isRomFile(const fs::path& path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension == ".gb" || extension == ".gbc";
+}
+
+// Reads only the header, not the whole ROM
+bool readHeader(const fs::path& path, Entry* entry) {
+    u8 header[HEADER_END + 1] = {}; //the extra zero ends the title for `getInfo`
+    std::ifstream in(path, std::ios::binary);
+    if (!in.read((char*)header, HEADER_END)) {
+        return false;
+    }
+    CartridgeInfo info = getInfo(header);
+    memset(entry->title, 0, sizeof(entry->title));
+    for (u16 i = 0; i < 16 && header[TITLE_ADDRESS + i] >= 0x20 && header[TITLE_ADDRESS + i] < 0x7F; i++) {
+        entry->title[i] = header[TITLE_ADDRESS + i];
+    }
+    u8 checksum = 0;
+    for (u16 address = TITLE_ADDRESS; address < HEADER_CHECKSUM_ADDRESS; address++) {
+        checksum = checksum - header[address] - 1;
+    }
+    entry->typeCode = header[MBC_TYPE_ADDRESS];
+    entry->type = info.type;
+    entry->romSize = header[ROM_SIZE_ADDRESS] <= 0x08 ? info.romSize : 0;
+    entry->ramSize = info.ramSize;
+    entry->headerChecksum = header[HEADER_CHECKSUM_ADDRESS];
+    entry->headerChecksumValid = checksum == entry->headerChecksum;
+    entry->globalChecksum = (header[GLOBAL_CHECKSUM_ADDRESS] << 8) | header[GLOBAL_CHECKSUM_ADDRESS + 1];
+    entry->battery = info.battery;
+    entry->clock = info.clock;
+    return true;
+}
+
+// Runs in the child process `runRom` starts. Returns the exit code
+int runOne(const char* romPath, const char* bootPath, u32 frames, u32 timeout) {
+    #ifdef SCAN_RUN
+    alarm(timeout);
+    #endif
+    std::shared_ptr<SharedRom> rom = SharedRom::open(romPath);
+    if (rom == nullptr) {
+        return EXIT_FAILURE;
+    }
+    // Without a boot ROM, run NOPs up to 0x00FC, then unmap it so the cartridge starts at 0x0100
+    u8 boot[BOOT_ROM_SIZE] = {};
+    const u8 disable[] = { 0x3E, 0x01, 0xE0, 0x50 }; //LD A,01h ; LDH (50h),A
+    memcpy(boot + 0xFC, disable, sizeof(disable));
+    if (bootPath != nullptr) {
+        std::ifstream in(bootPath, std::ios::binary);
+        in.read((char*)boot, BOOT_ROM_SIZE);
+    }
+    GameBoy* gameBoy = new GameBoy(boot, createCartridge(rom));
+    for (u32 i = 0; i < frames; i++) {
+        gameBoy->step();
+    }
+    return EXIT_SUCCESS;
+}
+
+// Runs the ROM in a fresh copy of this program, so a crash or hang only loses that ROM, and reads what it printed
+RunResult runRom(const Options& options, const fs::path& path, const Entry& entry) {
+    if (entry.type == OTHER) {
+        return UNSUPPORTED_MAPPER;
+    }
+    #ifdef SCAN_RUN
+    int output[2];
+    // Close-on-exec, or children other workers fork at the same time would hold the write end open
+    if (pipe2(output, O_CLOEXEC) != 0) {
+        return UNREADABLE;
+    }
+    std::string frames = std::to_string(options.frames);
+    std::string timeout = std::to_string(options.timeout);
+    std::string rom = path.string();
+    std::vector<const char*> arguments = { options.self.c_str(), "--run-one", rom.c_str(), frames.c_str(), timeout.c_str() };
+    if (options.bootPath != nullptr) {
+        arguments.push_back(options.bootPath);
+    }
+    arguments.push_back(nullptr);
+
+    pid_t child = fork();
+    if (child == 0) {
+        dup2(output[1], STDOUT_FILENO);
+        dup2(output[1], STDERR_FILENO);
+        close(output[0]);
+        close(output[1]);
+        execv(arguments[0], (char* const*)arguments.data());
+        _exit(127);
+    }
+    close(output[1]);
+    if (child < 0) {
+        close(output[0]);
+        return UNREADABLE;
+    }
+
+    // Only the start of each line matters, but the pipe must be drained for the child to finish
+    std::string printed;
+    char buffer[4096];
+    ssize_t length;
+    while ((length = read(output[0], buffer, sizeof(buffer))) > 0) {
+        printed.append(buffer, length);
+        if (printed.size() > (1 << 20)) {
+            printed.erase(0, printed.size() - 4096);
+        }
+    }
+    close(output[0]);
+    int status;
+    waitpid(child, &status, 0);
+
+    if (WIFSIGNALED(status)) {
+        return WTERMSIG(status) == SIGALRM ? TIMED_OUT : CRASHED;
+    }
+    if (WEXITSTATUS(status) != EXIT_SUCCESS) {
+        return UNREADABLE;
+    }
+    if (printed.find("illegal opcode") != std::string::npos) {
+        return ILLEGAL_OPCODE;
+    }
+    if (printed.find("ERROR ::") != std::string::npos) {
+        return EMULATOR_ERROR;
+    }
+    return RUN_OK;
+    #else
+    return NOT_RUN;
+    #endif
+}
+
+void printIndex(const std::vector<Entry>& entries) {
+    printf("path\ttitle\tmapper\ttype\trom\tram\tbattery\tclock\theader_checksum\tglobal_checksum\tframes\tresult\n");
+    const char* mappers[] = { "none", "MBC1", "MBC2", "MBC3", "MBC5", "other" };
+    for (const Entry& entry : entries) {
+        printf("%s\t%s\t%s\t%02X\t%u\t%u\t%d\t%d\t%02X%s\t%04X\t%u\t%s\n", entry.path.c_str(), entry.title, mappers[std::min<u8>(entry.type, OTHER)],
+            entry.typeCode, entry.romSize, entry.ramSize, entry.battery, entry.clock, entry.headerChecksum, entry.headerChecksumValid ? "" : "!",
+            entry.globalChecksum, entry.framesRun, RUN_RESULT_NAMES[std::min<u8>(entry.runResult, UNREADABLE)]);
+    }
+}
+
+std::string getSelfPath(const char* argv0) {
+    #ifdef SCAN_RUN
+    char path[4096];
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length > 0) {
+        return std::string(path, length);
+    }
+    #endif
+    return argv0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 5 && strcmp(argv[1], "--run-one") == 0) {
+        return runOne(argv[2], argc > 5 ? argv[5] : nullptr, atoi(argv[3]), atoi(argv[4]));
+    }
+    if (argc == 3 && strcmp(argv[1], "--list") == 0) {
+        printIndex(readIndex(argv[2]));
+        return EXIT_SUCCESS;
+    }
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " [rom_directory] [index_file] [--frames n] [--boot boot_rom_file] [--jobs n] [--timeout seconds]" << std::endl;
+        std::cerr << "       " << argv[0] << " --list [index_file]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    fs::path root = argv[1];
+    const char* indexPath = argv[2];
+    Options options;
+    options.self = getSelfPath(argv[0]);
+    for (int i = 3; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--frames") == 0) {
+            options.frames = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--boot") == 0) {
+            options.bootPath = argv[i + 1];
+        } else if (strcmp(argv[i], "--jobs") == 0) {
+            options.jobs = std::max(1, atoi(argv[i + 1]));
+        } else if (strcmp(argv[i], "--timeout") == 0) {
+            options.timeout = std::max(1, atoi(argv[i + 1]));
+        }
+    }
+
+    std::map<std::string, Entry> previous;
+    for (Entry& entry : readIndex(indexPath)) {
+        previous[entry.path] = entry;
+    }
+
+    // The walk itself is cheap next to reading headers, so only the per-file work is spread out
+    std::vector<Entry> entries;
+    std::error_code error;
+    for (auto it = fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied, error); !error && it != fs::recursive_directory_iterator(); it.increment(error)) {
+        if (!it->is_regular_file(error) || !isRomFile(it->path())) {
+            continue;
+        }
+        Entry entry = {};
+        entry.path = fs::relative(it->path(), root, error).generic_string();
+        entry.size = it->file_size(error);
+        entry.modified = it->last_write_time(error).time_since_epoch().count();
+        entries.push_back(entry);
+    }
+    if (error) {
+        std::cerr << root.string() << ": " << error.message() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<u32> scanned(0), ran(0);
+    auto work = [&]() {
+        for (size_t i = next++; i < entries.size(); i = next++) {
+            Entry& entry = entries[i];
+            auto found = previous.find(entry.path);
+            bool unchanged = found != previous.end() && found->second.size == entry.size && found->second.modified == entry.modified;
+            if (unchanged) {
+                entry = found->second;
+            } else {
+                scanned++;
+                if (!readHeader(root / entry.path, &entry)) {
+                    entry.runResult = UNREADABLE;
+                    continue;
+                }
+            }
+            if (options.frames > 0 && entry.framesRun != options.frames && entry.runResult != UNREADABLE) {
+                ran++;
+                entry.runResult = runRom(options, root / entry.path, entry);
+                entry.framesRun = entry.runResult == NOT_RUN ? 0 : options.frames;
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (u32 i = 0; i < std::min<size_t>(options.jobs, entries.size()); i++) {
+        workers.emplace_back(work);
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.path < b.path; });
+    if (!writeIndex(indexPath, entries)) {
+        return EXIT_FAILURE;
+    }
+    printf("%zu ROMs, %u read, %u run\n", entries.size(), scanned.load(), ran.load());
+    return EXIT_SUCCESS;
+}